@@ -0,0 +1,234 @@
+/*++
+
+    Copyright (c) Pai Financials LLC.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+Module Name:
+
+    CircuitBreaker.cpp
+
+Abstract:
+
+    Implements the circuit breaker of the queries sent to a host
+
+Author:
+
+    nabieasaurus
+
+--*/
+#include "StdAfx.h"
+#include "CircuitBreaker.h"
+
+
+_Use_decl_annotations_
+void
+CCircuitBreaker::SetHost(
+    LPCSTR Host
+    )
+/*++
+
+Routine Description:
+
+    Sets the host guarded by the breaker, called when the data source
+    is connected. The breaker starts closed
+
+Parameters:
+
+    Host - The host name of the data source
+
+--*/
+{
+    CAutoLock al(m_Lock);
+
+    m_sHost.assign(Host);
+    m_State = BreakerClosed;
+    m_nFailures = 0;
+    m_dwOpenMs = BREAKER_OPEN_MS;
+    m_bProbing = false;
+}
+
+
+bool
+CCircuitBreaker::Allow(
+    void
+    )
+/*++
+
+Routine Description:
+
+    Decides if the query is sent. The queries are sent while closed and
+    fail while open. Once the open time is over the breaker is half open
+    and one query at a time is let through as the probe.
+
+Return Value:
+
+    true - if the query is sent
+    false - if the query fails without being sent
+
+--*/
+{
+    CAutoLock al(m_Lock);
+
+    if (m_State == BreakerOpen)
+    {
+        if ((DWORD)(GetTickCount() - m_dwOpened) < m_dwOpenMs)
+        {
+            m_nRejected++;
+            return false;
+        }
+
+        LogInfo("Circuit breaker half open, probing %s", m_sHost.c_str());
+        m_State = BreakerHalfOpen;
+        m_bProbing = false;
+    }
+
+    if (m_State == BreakerHalfOpen)
+    {
+        if (m_bProbing == true)
+        {
+            m_nRejected++;
+            return false;
+        }
+
+        m_bProbing = true;
+    }
+
+    return true;
+}
+
+
+_Use_decl_annotations_
+void
+CCircuitBreaker::OnResult(
+    bool Answered
+    )
+/*++
+
+Routine Description:
+
+    Counts the consecutive failures while closed and opens the breaker at
+    the threshold. The probe closes the breaker if it was answered or
+    opens it for twice the time. The queries sent before the breaker
+    opened and completing after do not change it.
+
+Parameters:
+
+    Answered - If the host answered the query
+
+--*/
+{
+    CAutoLock al(m_Lock);
+
+    switch (m_State)
+    {
+    case BreakerClosed:
+        if (Answered == true)
+        {
+            m_nFailures = 0;
+        }
+        else if (++m_nFailures >= BREAKER_FAILURE_THRESHOLD)
+        {
+            Open(BREAKER_OPEN_MS);
+        }
+        break;
+
+    case BreakerHalfOpen:
+        m_bProbing = false;
+
+        if (Answered == true)
+        {
+            LogInfo("Circuit breaker closed, %s is answering", m_sHost.c_str());
+            m_State = BreakerClosed;
+            m_nFailures = 0;
+            m_dwOpenMs = BREAKER_OPEN_MS;
+        }
+        else
+        {
+            Open((m_dwOpenMs * 2 < BREAKER_MAX_OPEN_MS) ? m_dwOpenMs * 2 : BREAKER_MAX_OPEN_MS);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+
+_Use_decl_annotations_
+void
+CCircuitBreaker::Open(
+    DWORD OpenMs
+    )
+/*++
+
+Routine Description:
+
+    Opens the breaker for the time
+
+Parameters:
+
+    OpenMs - The milliseconds the queries fail before the next probe
+
+--*/
+{
+    m_State = BreakerOpen;
+    m_dwOpened = GetTickCount();
+    m_dwOpenMs = OpenMs;
+    m_nTrips++;
+
+    LogWarn("Circuit breaker open for %d ms, %s is not answering", OpenMs, m_sHost.c_str());
+}
+
+
+_Use_decl_annotations_
+INT
+CCircuitBreaker::Format(
+    LPSTR Buffer,
+    INT BufferSize
+    )
+/*++
+
+Routine Description:
+
+    Formats the host, the state, the consecutive failures, the time left
+    open, the trips and the rejected queries as name=value pairs separated
+    by semicolons
+
+Parameters:
+
+    Buffer - Returns the text
+
+    BufferSize - The size of the buffer including the terminating null
+
+Return Value:
+
+    The number of characters written, -1 if the text was truncated
+
+--*/
+{
+    CAutoLock   al(m_Lock);
+    DWORD       dwElapsed = GetTickCount() - m_dwOpened;
+    DWORD       dwLeft = ((m_State == BreakerOpen) && (dwElapsed < m_dwOpenMs)) ? m_dwOpenMs - dwElapsed : 0;
+
+    return _snprintf_s(Buffer, BufferSize, _TRUNCATE,
+        "Host=%s;Breaker=%s;Failures=%u;OpenMsLeft=%u;Trips=%d;Rejected=%d",
+        m_sHost.c_str(), StateName(m_State), m_nFailures, dwLeft, m_nTrips, m_nRejected);
+}
@@ -0,0 +1,151 @@
+/*++
+
+    Copyright (c) Pai Financials LLC.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+Module Name:
+
+    CircuitBreaker.h
+
+Abstract:
+
+    Circuit breaker of the queries sent to a host
+
+Author:
+
+    nabieasaurus
+
+--*/
+#pragma once
+
+#include "Lock.h"
+
+//
+// The breaker opens after the consecutive failures and stays open for the
+// open time, doubled every time the probe fails up to the maximum
+//
+#define BREAKER_FAILURE_THRESHOLD   5
+#define BREAKER_OPEN_MS             (30 * 1000)
+#define BREAKER_MAX_OPEN_MS         (10 * 60 * 1000)
+
+//
+// The states of the breaker
+//
+enum EBreakerState
+{
+    BreakerClosed,                      // The queries are sent
+    BreakerOpen,                        // The queries fail without being sent
+    BreakerHalfOpen,                    // One query is sent to probe the host
+    BreakerStateCount,
+};
+
+
+/*++
+
+Class Name:
+
+    CCircuitBreaker
+
+Class Description:
+
+    Stops the queries to a host that is down, so the callers do not pay
+    the connect and receive timeouts for every query. The breaker is
+    closed while the host answers. After a number of consecutive
+    failures it opens and the queries fail at once. Once the open time
+    is over one query is let through to probe the host: if it is
+    answered the breaker closes, otherwise it opens again for twice the
+    time.
+
+    A failure is a query without a response or with a 5xx or 429 status,
+    any other response shows the host is up.
+
+--*/
+class CCircuitBreaker
+{
+protected:
+    String          m_sHost;
+    EBreakerState   m_State;
+    UINT32          m_nFailures;            // Consecutive failures while closed
+    DWORD           m_dwOpened;             // When the breaker opened
+    DWORD           m_dwOpenMs;             // How long it stays open
+    bool            m_bProbing;             // The probe is in flight
+    LONG volatile   m_nTrips;               // Times the breaker opened
+    LONG volatile   m_nRejected;            // Queries failed while open
+    CLock           m_Lock;
+
+    //
+    // Opens the breaker. Called with the lock held
+    //
+    void Open(_In_ DWORD OpenMs);
+
+    // Not copyable
+    CCircuitBreaker(const CCircuitBreaker&);
+    CCircuitBreaker& operator = (const CCircuitBreaker&);
+
+    // C'tor/D'tor
+public:
+    CCircuitBreaker(void) :
+        m_State(BreakerClosed), m_nFailures(0), m_dwOpened(0), m_dwOpenMs(BREAKER_OPEN_MS),
+        m_bProbing(false), m_nTrips(0), m_nRejected(0) { }
+
+    // Properties
+public:
+    inline EBreakerState GetState(void) const { return m_State; }
+    inline LONG GetTrips(void) const { return m_nTrips; }
+    inline LONG GetRejected(void) const { return m_nRejected; }
+
+    static LPCSTR StateName(_In_ EBreakerState State) {
+        static LPCSTR StrStates[] = { "Closed", "Open", "HalfOpen" };
+
+        return ((UINT32)State < _countof(StrStates)) ? StrStates[State] : "";
+    }
+
+    // Operations
+public:
+    //
+    // Sets the host guarded by the breaker and closes it
+    //
+    void SetHost(
+        _In_ LPCSTR Host
+        );
+
+    //
+    // Returns true if the query can be sent. A query let through must be
+    // followed by OnResult
+    //
+    bool Allow(void);
+
+    //
+    // Records the result of a query that was let through
+    //
+    void OnResult(
+        _In_ bool Answered
+        );
+
+    //
+    // Formats the state of the breaker into the buffer, returns the
+    // characters written
+    //
+    INT Format(
+        _Out_writes_(BufferSize) LPSTR Buffer,
+        _In_ INT BufferSize
+        );
+};
@@ -0,0 +1,241 @@
+/*++
+
+    Copyright (c) Pai Financials LLC.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+Module Name:
+
+    ConcurrencyLimit.cpp
+
+Abstract:
+
+    Implements the adaptive limit of the queries in flight
+
+Author:
+
+    nabieasaurus
+
+--*/
+#include "StdAfx.h"
+#include "ConcurrencyLimit.h"
+
+
+_Use_decl_annotations_
+void
+CConcurrencyLimit::SetLimits(
+    UINT32 MaxInFlight,
+    bool Adaptive
+    )
+/*++
+
+Routine Description:
+
+    Sets the maximum of the queries in flight. Called before the fetch
+    threads are started
+
+Parameters:
+
+    MaxInFlight - The queries in flight at most, 0 for no limit unless
+        the limit is adaptive
+
+    Adaptive - If the limit follows the responses of the data source
+
+--*/
+{
+    CAutoLock al(m_Lock);
+
+    m_bAdaptive = Adaptive;
+    m_bStopped = false;
+    m_nMax = ((MaxInFlight == 0) && (Adaptive == true)) ? AIMD_DEFAULT_MAX : MaxInFlight;
+    m_Limit = (Adaptive == true) ? 1 : m_nMax;
+    m_LatencyAverage = 0;
+    m_LatencyBaseline = 0;
+
+    m_SlotFree.WakeAll();
+}
+
+
+bool
+CConcurrencyLimit::Acquire(
+    void
+    )
+/*++
+
+Routine Description:
+
+    Waits till the queries in flight are under the limit and takes a
+    slot. The slots are freed by Release of the queries in flight
+
+Return Value:
+
+    true - if the query can be sent, Release frees the slot
+    false - if the limit was stopped, no slot is taken
+
+--*/
+{
+    if (m_bStopped == true) { return false; }
+    if (IsLimited() == false) { return true; }
+
+    CAutoLock al(m_Lock);
+
+    while ((m_nInFlight >= (UINT32)m_Limit) && (m_bStopped == false))
+    {
+        m_SlotFree.Wait(m_Lock);
+    }
+
+    if (m_bStopped == true) { return false; }
+
+    m_nInFlight++;
+    return true;
+}
+
+
+void
+CConcurrencyLimit::Stop(
+    void
+    )
+/*++
+
+Routine Description:
+
+    Fails the waits for a slot, so the threads stopping do not wait for
+    the queries in flight of the others. Resume or SetLimits starts it
+    again
+
+--*/
+{
+    CAutoLock al(m_Lock);
+
+    m_bStopped = true;
+    m_SlotFree.WakeAll();
+}
+
+
+_Use_decl_annotations_
+void
+CConcurrencyLimit::Release(
+    EFetchOutcome Outcome,
+    DWORD LatencyMs
+    )
+/*++
+
+Routine Description:
+
+    Frees the slot of the query. In the adaptive mode a query that
+    completed raises the limit by 1/limit unless the latency spiked, a
+    throttled response or a page that did not parse cuts it. The queries
+    that got no response do not change it.
+
+Parameters:
+
+    Outcome - The result of the query
+
+    LatencyMs - The time from the request to the end of the response
+
+--*/
+{
+    if (IsLimited() == false) { return; }
+
+    CAutoLock al(m_Lock);
+
+    if (m_nInFlight > 0) { m_nInFlight--; }
+
+    if (m_bAdaptive == true)
+    {
+        if (Outcome == FetchOutcomeOk)
+        {
+            //
+            // The baseline follows the lowest average and drifts up to it
+            //
+            m_LatencyAverage = (m_LatencyAverage == 0) ? LatencyMs :
+                m_LatencyAverage + (LatencyMs - m_LatencyAverage) / (1 << AIMD_AVERAGE_SHIFT);
+
+            if ((m_LatencyBaseline == 0) || (m_LatencyAverage < m_LatencyBaseline))
+            {
+                m_LatencyBaseline = m_LatencyAverage;
+            }
+            else
+            {
+                m_LatencyBaseline += (m_LatencyAverage - m_LatencyBaseline) / (1 << AIMD_BASELINE_SHIFT);
+            }
+
+            if ((m_LatencyAverage > m_LatencyBaseline * AIMD_LATENCY_FACTOR) &&
+                (m_LatencyAverage > AIMD_LATENCY_FLOOR_MS))
+            {
+                Decrease(AIMD_LATENCY_DECREASE, "latency");
+            }
+            else if (m_Limit < m_nMax)
+            {
+                m_Limit += 1 / m_Limit;
+                if (m_Limit > m_nMax) { m_Limit = m_nMax; }
+            }
+        }
+        else if (Outcome == FetchOutcomeThrottled)
+        {
+            Decrease(AIMD_THROTTLE_FACTOR, "throttled");
+        }
+        else if (Outcome == FetchOutcomeParseFailed)
+        {
+            Decrease(AIMD_THROTTLE_FACTOR, "parse failure");
+        }
+    }
+
+    m_SlotFree.WakeAll();
+}
+
+
+_Use_decl_annotations_
+void
+CConcurrencyLimit::Decrease(
+    double Factor,
+    LPCSTR Reason
+    )
+/*++
+
+Routine Description:
+
+    Cuts the limit by the factor, not under 1. The decreases within the
+    hold of the last one or the round trip, whichever is longer, are the
+    same congestion and are counted once.
+
+Parameters:
+
+    Factor - The limit is multiplied by it
+
+    Reason - Why the limit is cut, for the log
+
+--*/
+{
+    DWORD dwNow = GetTickCount();
+    DWORD dwHold = (m_LatencyAverage > AIMD_DECREASE_HOLD_MS) ? (DWORD)m_LatencyAverage :
+        AIMD_DECREASE_HOLD_MS;
+
+    if ((m_nDecreases != 0) && ((DWORD)(dwNow - m_dwLastDecrease) < dwHold)) { return; }
+
+    m_Limit *= Factor;
+    if (m_Limit < 1) { m_Limit = 1; }
+
+    m_dwLastDecrease = dwNow;
+    m_nDecreases++;
+
+    LogInfo("Queries in flight limited to %d, %s, latency = %d ms, baseline = %d ms",
+        (INT)m_Limit, Reason, (INT)m_LatencyAverage, (INT)m_LatencyBaseline);
+}
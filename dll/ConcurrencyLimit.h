@@ -0,0 +1,178 @@
+/*++
+
+    Copyright (c) Pai Financials LLC.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+Module Name:
+
+    ConcurrencyLimit.h
+
+Abstract:
+
+    Additive increase, multiplicative decrease limit of the queries in
+    flight to the data source
+
+Author:
+
+    nabieasaurus
+
+--*/
+#pragma once
+
+#include "Lock.h"
+
+//
+// The ceiling of the adaptive limit when the ini file does not set one
+//
+#define AIMD_DEFAULT_MAX            16
+
+//
+// The limit is cut by half on a throttled response or a page that does not
+// parse and by a quarter on a latency spike. The average latency is a spike
+// when it is over the factor of the baseline and over the floor
+//
+#define AIMD_THROTTLE_FACTOR        0.5
+#define AIMD_LATENCY_DECREASE       0.75
+#define AIMD_LATENCY_FACTOR         2
+#define AIMD_LATENCY_FLOOR_MS       250
+
+//
+// The weights of the latency average and of the baseline drifting up to it,
+// as the shift of the divisor
+//
+#define AIMD_AVERAGE_SHIFT          3
+#define AIMD_BASELINE_SHIFT         8
+
+//
+// The decreases within the hold of the last one are counted once, the
+// responses in flight were sent before the limit came down
+//
+#define AIMD_DECREASE_HOLD_MS       1000
+
+//
+// The result of a query as seen by the limit
+//
+enum EFetchOutcome
+{
+    FetchOutcomeOk,                     // The page was received and parsed
+    FetchOutcomeThrottled,              // 429 or 503 from the data source
+    FetchOutcomeParseFailed,            // The page was received and did not parse
+    FetchOutcomeFailed,                 // Any other error response, does not change the limit
+    FetchOutcomeUnavailable,            // No response or a 5xx, does not change the limit
+    FetchOutcomeRejected,               // Not sent, the circuit breaker is open
+};
+
+
+/*++
+
+Class Name:
+
+    CConcurrencyLimit
+
+Class Description:
+
+    Limits the queries in flight to the data source. The adaptive limit
+    finds the largest number the data source sustains: every query that
+    completes in time raises it by 1/limit, so by one for a full round of
+    queries, and a throttled response, a page that does not parse or a
+    spike of the latency cuts it by a factor. The decreases are held for
+    a round trip so one bad round cuts it once.
+
+    The latency is compared to a baseline that follows the lowest
+    average and drifts up slowly, so the limit follows the data source
+    through the day.
+
+    Without the adaptive mode the limit stays at the maximum. A maximum
+    of 0 does not limit the queries.
+
+--*/
+class CConcurrencyLimit
+{
+protected:
+    double          m_Limit;                // The queries allowed in flight
+    UINT32          m_nMax;
+    UINT32          m_nInFlight;
+    bool            m_bAdaptive;
+    bool volatile   m_bStopped;             // The waiters give up, set on shutdown
+    double          m_LatencyAverage;       // Milliseconds
+    double          m_LatencyBaseline;
+    DWORD           m_dwLastDecrease;
+    LONG volatile   m_nDecreases;
+    CLock           m_Lock;
+    CCondition      m_SlotFree;
+
+    //
+    // Cuts the limit by the factor, once for the hold. Called with the lock held
+    //
+    void Decrease(_In_ double Factor, _In_ LPCSTR Reason);
+
+    // Not copyable
+    CConcurrencyLimit(const CConcurrencyLimit&);
+    CConcurrencyLimit& operator = (const CConcurrencyLimit&);
+
+    // C'tor/D'tor
+public:
+    CConcurrencyLimit(void) :
+        m_Limit(0), m_nMax(0), m_nInFlight(0), m_bAdaptive(false), m_bStopped(false), m_LatencyAverage(0),
+        m_LatencyBaseline(0), m_dwLastDecrease(0), m_nDecreases(0) { }
+
+    // Properties
+public:
+    inline bool IsLimited(void) const { return m_nMax != 0; }
+    inline LONG GetLimit(void) const { return (LONG)m_Limit; }
+    inline LONG GetDecreases(void) const { return m_nDecreases; }
+    inline LONG GetLatency(void) const { return (LONG)m_LatencyAverage; }
+
+    // Operations
+public:
+    //
+    // Sets the maximum of the queries in flight. The adaptive limit starts
+    // at 1 and grows up to the maximum, AIMD_DEFAULT_MAX if it is 0
+    //
+    void SetLimits(
+        _In_ UINT32 MaxInFlight,
+        _In_ bool Adaptive
+        );
+
+    //
+    // Waits for a slot of the queries in flight. Returns false without a
+    // slot once the limit is stopped
+    //
+    bool Acquire(void);
+
+    //
+    // Wakes up the waiters and fails the waits till resumed or the limits
+    // are set again
+    //
+    void Stop(void);
+
+    inline void Resume(void) {
+        m_bStopped = false;
+    }
+
+    //
+    // Frees the slot and adjusts the limit by the result of the query
+    //
+    void Release(
+        _In_ EFetchOutcome Outcome,
+        _In_ DWORD LatencyMs
+        );
+};
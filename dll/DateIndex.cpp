@@ -0,0 +1,150 @@
+/*++
+
+    Copyright (c) Pai Financials LLC.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    DateIndex.cpp
+
+Abstract:
+
+    Implements the index of the tickers ordered by the earnings date
+
+Author:
+
+    nabieasaurus
+
+--*/
+#include "StdAfx.h"
+#include "DateIndex.h"
+
+
+_Use_decl_annotations_
+void
+CDateIndex::Update(
+    const TICKER_KEY& Ticker,
+    UINT32 EarningsDate
+    )
+/*++
+
+Routine Description:
+
+    Removes the entry of the ticker for its previous date and adds it for
+    the new date
+
+Parameters:
+
+    Ticker - The ticker symbol in upper case
+
+    EarningsDate - The earnings date, 0 if the ticker has no date
+
+--*/
+{
+    CAutoLock           al(m_Lock);
+    DATE_INDEX_ENTRY    entry;
+    UINT32*             pDate = m_Dates.Find(Ticker);
+
+    entry.Ticker = Ticker;
+
+    if (pDate != NULL)
+    {
+        if (*pDate == EarningsDate) { return; }
+
+        entry.EarningsDate = *pDate;
+        m_Entries.erase(entry);
+        m_Dates.Erase(Ticker);
+    }
+
+    if (EarningsDate == 0) { return; }
+
+    entry.EarningsDate = EarningsDate;
+    m_Entries.insert(entry);
+    m_Dates.Insert(Ticker, EarningsDate);
+}
+
+
+void
+CDateIndex::Clear(
+    void
+    )
+/*++
+
+Routine Description:
+
+    Removes all of the tickers, called when the cache is reloaded
+
+--*/
+{
+    CAutoLock al(m_Lock);
+
+    m_Entries.clear();
+    m_Dates.Clear();
+}
+
+
+_Use_decl_annotations_
+INT
+CDateIndex::GetRange(
+    UINT32 From,
+    UINT32 To,
+    LPSTR Buffer,
+    INT BufferSize
+    )
+/*++
+
+Routine Description:
+
+    Copies the tickers reporting in the range into the buffer. The start
+    of the range is found in the ordered entries and the entries are
+    walked till the end of the range, so the cost is the lookup plus the
+    tickers returned.
+
+Parameters:
+
+    From - The first earnings date of the range
+
+    To - The earnings date past the end of the range
+
+    Buffer - Returns the tickers separated by commas
+
+    BufferSize - The size of the buffer including the terminating null
+
+Return Value:
+
+    The number of tickers copied
+
+--*/
+{
+    CAutoLock           al(m_Lock);
+    DATE_INDEX_ENTRY    first;
+    CTickerList         list(Buffer, BufferSize);
+
+    first.EarningsDate = From;
+    first.Ticker.Clear();
+
+    for (std::set<DATE_INDEX_ENTRY>::const_iterator it = m_Entries.lower_bound(first);
+        (it != m_Entries.end()) && (it->EarningsDate < To); it++)
+    {
+        if (list.Append(it->Ticker) == false) { break; }
+    }
+
+    return list.Count();
+}
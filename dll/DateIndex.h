@@ -0,0 +1,125 @@
+/*++
+
+    Copyright (c) Pai Financials LLC.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    DateIndex.h
+
+Abstract:
+
+    Index of the tickers ordered by the earnings date
+
+Author:
+
+    nabieasaurus
+
+--*/
+#pragma once
+
+#include "Lock.h"
+#include "TickerMap.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// struct
+//      DATE_INDEX_ENTRY
+//
+// abstract
+//      One ticker in the date index. The entries are ordered by the date
+//      and the tickers of the same date by name.
+//
+struct DATE_INDEX_ENTRY
+{
+    UINT32      EarningsDate;
+    TICKER_KEY  Ticker;
+
+    inline bool operator < (const DATE_INDEX_ENTRY& Entry) const {
+        if (EarningsDate != Entry.EarningsDate) return EarningsDate < Entry.EarningsDate;
+        return strncmp(Ticker.Chars, Entry.Ticker.Chars, TICKER_KEY_SIZE) < 0;
+    }
+};
+
+
+/*++
+
+Class Name:
+
+    CDateIndex
+
+Class Description:
+
+    Keeps the tickers that have an earnings date ordered by the date, so
+    the tickers reporting in a range of dates are found with one lookup
+    of the start of the range and a walk to its end. The date of each
+    ticker is kept in a ticker map to find its entry when the date
+    changes.
+
+    The index covers every record of the cache, including the ones that
+    were evicted and are only in the cache file.
+
+--*/
+class CDateIndex
+{
+protected:
+    std::set<DATE_INDEX_ENTRY>  m_Entries;
+    CTickerMap<UINT32>          m_Dates;            // Ticker to the date in the index
+    CLock                       m_Lock;
+
+    // Not copyable
+    CDateIndex(const CDateIndex&);
+    CDateIndex& operator = (const CDateIndex&);
+
+    // C'tor/D'tor
+public:
+    CDateIndex(void) { }
+    ~CDateIndex(void) { }
+
+    // Properties
+public:
+    inline UINT32 Size(void) { return m_Dates.Size(); }
+
+    // Operations
+public:
+    //
+    // Moves the ticker to the earnings date. A date of 0 removes the
+    // ticker from the index
+    //
+    void Update(
+        _In_ const TICKER_KEY& Ticker,
+        _In_ UINT32 EarningsDate
+        );
+
+    void Clear(void);
+
+    //
+    // Copies the tickers with the earnings date in [From, To) into the
+    // buffer separated by commas, ordered by the date. Returns the number
+    // of tickers copied, stops at the last ticker that fits
+    //
+    INT GetRange(
+        _In_ UINT32 From,
+        _In_ UINT32 To,
+        _Out_writes_(BufferSize) LPSTR Buffer,
+        _In_ INT BufferSize
+        );
+};
@@ -90,6 +90,214 @@ Abstract:
 }
 
 
+CEarningsDataPtr_t
+GetEarningsDataByHandle(
+    INT Handle
+    )
+/*
+
+Abstract:
+
+    Same as GetEarningsData for the symbol handle. The handle is validated
+    by the earnings manager.
+
+*/
+{
+    CEarningsDataPtr_t pEarningsData = NULL;
+    EnterFunc();
+
+    __try
+    {
+        if (gEarningsMain.Initialize(GetModuleHandle(NULL)))
+        {
+            pEarningsData = gEarningsMain.m_EarningsRelease.GetEarningsDataByHandle(Handle);
+        }
+    }
+    __except(EXCEPTION_EXECUTE_HANDLER)
+    {
+        LogError("Exception code = %x", GetExceptionCode());
+        pEarningsData = NULL;
+    }
+
+    LeaveFunc();
+    return pEarningsData;
+}
+
+
+static
+bool
+GetDaysToEarningsByHandle(
+    _In_ INT Handle,
+    _Out_ INT& Days
+    )
+/*
+
+Abstract:
+
+    Same as GetEarningsDataByHandle for the days to the earnings release
+    computed by the columnar store.
+
+*/
+{
+    bool bRet = false;
+    EnterFunc();
+
+    Days = 0;
+
+    __try
+    {
+        if (gEarningsMain.Initialize(GetModuleHandle(NULL)))
+        {
+            bRet = gEarningsMain.m_EarningsRelease.GetDaysToEarningsByHandle(Handle, Days);
+        }
+    }
+    __except(EXCEPTION_EXECUTE_HANDLER)
+    {
+        LogError("Exception code = %x", GetExceptionCode());
+        bRet = false;
+    }
+
+    LeaveFunc();
+    return bRet;
+}
+
+
+//
+// The getters return a copy of the field in a buffer of the calling thread
+// since the cached record can be changed or freed once the getter returns.
+// Each getter has its own buffer so one statement can call all of them, as
+// the indicators do.
+//
+#define EARNINGS_FIELD_SIZE         64
+
+static __declspec(thread) CHAR  tlsReleaseDate[EARNINGS_FIELD_SIZE];
+static __declspec(thread) CHAR  tlsReleaseTime[EARNINGS_FIELD_SIZE];
+static __declspec(thread) CHAR  tlsDaysToRelease[EARNINGS_FIELD_SIZE];
+static __declspec(thread) CHAR  tlsNotes[EARNINGS_NOTES_SIZE];
+
+//
+// The diagnostics text of the calling thread
+//
+#define EARNINGS_DIAGNOSTICS_SIZE   512
+
+static __declspec(thread) CHAR  tlsDiagnostics[EARNINGS_DIAGNOSTICS_SIZE];
+
+
+//
+// Copies the cached record into the snapshot, called in the epoch. Returns
+// the snapshot or NULL if there is no record
+//
+static
+CEarningsDataPtr_t
+ReadRecord(
+    _In_opt_ CEarningsDataPtr_t pData,
+    _Out_ CEarningsData& Snapshot
+    )
+{
+    if (pData == NULL) { return NULL; }
+
+    pData->Read(Snapshot);
+    return &Snapshot;
+}
+
+
+//
+// The fields returned by the getters. Shared by the ticker and the
+// handle variants of the exported functions. Called with the snapshot.
+//
+static
+LPCSTR
+EarningsReleaseDate(
+    _In_opt_ CEarningsDataPtr_t pData
+    )
+{
+    if ((pData != NULL) && (pData->IsAvailable() == true))
+    {
+        strncpy_s(tlsReleaseDate, pData->GetEarningsDateText(), _TRUNCATE);
+        return tlsReleaseDate;
+    }
+
+    return EARNINGS_NOT_AVAILABLE;
+}
+
+
+static
+LPCSTR
+EarningsReleaseTime(
+    _In_opt_ CEarningsDataPtr_t pData
+    )
+{
+    if ((pData != NULL) && (pData->IsAvailable() == true))
+    {
+        strncpy_s(tlsReleaseTime, CEarningsData::ReleaseTimeText(pData->GetReleaseTime()), _TRUNCATE);
+        return tlsReleaseTime;
+    }
+
+    return EARNINGS_NOT_AVAILABLE;
+}
+
+
+static
+LPCSTR
+DaysToEarningsRelease(
+    _In_opt_ CEarningsDataPtr_t pData
+    )
+{
+    if ((pData != NULL) && (pData->IsAvailable() == true))
+    {
+        strncpy_s(tlsDaysToRelease, 
+            CEarningsData::FieldCache.GetDaysText(pData->GetDaysToEarnings()), _TRUNCATE);
+        return tlsDaysToRelease;
+    }
+
+    return EARNINGS_NOT_AVAILABLE;
+}
+
+
+static
+INT
+EarningsConfirmation(
+    _In_opt_ CEarningsDataPtr_t pData
+    )
+{
+    if ((pData != NULL) && (pData->IsAvailable() == true))
+    {
+        return pData->IsConfirmed() ? 1 : 0;
+    }
+
+    return 0;
+}
+
+
+static
+INT
+EarningsStale(
+    _In_opt_ CEarningsDataPtr_t pData
+    )
+{
+    return ((pData != NULL) && (pData->IsStale() == true)) ? 1 : 0;
+}
+
+
+static
+LPCSTR
+EarningsNotes(
+    _In_opt_ CEarningsDataPtr_t pData
+    )
+{
+    if (pData != NULL)
+    {
+        LogTrace("GetEarningsNotes Returning[%s]: %s", 
+            pData->GetTicker(),
+            pData->GetNotes());
+        strncpy_s(tlsNotes, pData->GetNotes(), _TRUNCATE);
+        return tlsNotes;
+    }
+
+    return "";
+}
+
+
 _Use_decl_annotations_
 LPCSTR
 WINAPI
@@ -105,13 +313,12 @@ Abstract:
 --*/
 {
     EnterFunc();
-    LPCSTR retVal = EARNINGS_NOT_AVAILABLE;
-
-    CEarningsDataPtr_t pData = GetEarningsData(Ticker);
+    LPCSTR          retVal;
+    CEarningsData   snapshot;
 
-    if ((pData != NULL) && (pData->IsAvailable == true))
     {
-        retVal = pData->StrEarningsDate.c_str();
+        CEpochGuard eg(gEarningsMain.m_EarningsRelease.GetEpochs());
+        retVal = EarningsReleaseDate(ReadRecord(GetEarningsData(Ticker), snapshot));
     }
 
     LeaveFunc();
@@ -134,13 +341,12 @@ Abstract:
 --*/
 {
     EnterFunc();
-    LPCSTR retVal = EARNINGS_NOT_AVAILABLE;
+    LPCSTR          retVal;
+    CEarningsData   snapshot;
 
-    CEarningsDataPtr_t pData = GetEarningsData(Ticker);
-
-    if ((pData != NULL) && (pData->IsAvailable == true))
     {
-        retVal = pData->StrEarningsTime.c_str();
+        CEpochGuard eg(gEarningsMain.m_EarningsRelease.GetEpochs());
+        retVal = EarningsReleaseTime(ReadRecord(GetEarningsData(Ticker), snapshot));
     }
 
     LeaveFunc();
@@ -163,14 +369,12 @@ Abstract:
 --*/
 {
     EnterFunc();
-    LPCSTR retVal = EARNINGS_NOT_AVAILABLE;
-
-    CEarningsDataPtr_t pData = GetEarningsData(Ticker);
+    LPCSTR          retVal;
+    CEarningsData   snapshot;
 
-    if ((pData != NULL) && (pData->IsAvailable == true))
     {
-        pData->UpdateStrEarningsDays();
-        retVal = pData->StrEarningsDays.c_str();
+        CEpochGuard eg(gEarningsMain.m_EarningsRelease.GetEpochs());
+        retVal = DaysToEarningsRelease(ReadRecord(GetEarningsData(Ticker), snapshot));
     }
 
     LeaveFunc();
@@ -188,17 +392,17 @@ GetEarningsConfirmation(
 
 Abstract:
 
-    Returns the notes from the earnings file
+    Returns 1 if the earnings release date and time are confirmed
 
 --*/
 {
     EnterFunc();
-    INT retVal = 0;
-    CEarningsDataPtr_t pData = GetEarningsData(Ticker);
+    INT             retVal;
+    CEarningsData   snapshot;
 
-    if ((pData != NULL) && (pData->IsAvailable == true))
     {
-        retVal = pData->IsConfirmed ? 1 : 0;
+        CEpochGuard eg(gEarningsMain.m_EarningsRelease.GetEpochs());
+        retVal = EarningsConfirmation(ReadRecord(GetEarningsData(Ticker), snapshot));
     }
 
     LeaveFunc();
@@ -221,15 +425,12 @@ Abstract:
 --*/
 {
     EnterFunc();
-    LPCSTR retVal = "";
-    CEarningsDataPtr_t pData = GetEarningsData(Ticker);
+    LPCSTR          retVal;
+    CEarningsData   snapshot;
 
-    if (pData != NULL)
     {
-        LogTrace("GetEarningsNotes Returning[%s]: %s", 
-            pData->StrTicker.c_str(),
-            pData->StrEarningsNotes.c_str());
-        retVal = pData->StrEarningsNotes.c_str();
+        CEpochGuard eg(gEarningsMain.m_EarningsRelease.GetEpochs());
+        retVal = EarningsNotes(ReadRecord(GetEarningsData(Ticker), snapshot));
     }
 
     LeaveFunc();
@@ -238,7 +439,208 @@ Abstract:
 
 
 _Use_decl_annotations_
-void
+INT
+WINAPI
+GetSymbolHandle(
+    LPCSTR Ticker
+    )
+/*++
+
+Abstract:
+
+    Returns the handle for the ticker symbol to be passed to the ByHandle
+    functions. The handle does not change for the life of the process so
+    the indicators can look it up once per symbol. Returns 0 if the ticker
+    is not valid or the dll could not be initialized.
+
+--*/
+{
+    EnterFunc();
+    INT retVal = 0;
+
+    if ((Ticker == NULL) || (Ticker[0] == '\0') || 
+        (strlen(Ticker) > MAX_TICKER_LENGTH))
+    {
+        LogError("Invalid parameters passed to the function");
+        return retVal;
+    }
+
+    __try
+    {
+        if (gEarningsMain.Initialize(GetModuleHandle(NULL)))
+        {
+            retVal = gEarningsMain.m_EarningsRelease.GetSymbolHandle(Ticker);
+        }
+    }
+    __except(EXCEPTION_EXECUTE_HANDLER)
+    {
+        LogError("Exception code = %x", GetExceptionCode());
+        retVal = 0;
+    }
+
+    LeaveFunc();
+    return retVal;
+}
+
+
+_Use_decl_annotations_
+LPCSTR
+WINAPI
+GetEarningsReleaseDateByHandle(
+    INT Handle
+    )
+/*++
+
+Abstract:
+
+    Returns the date of the next earnings release
+
+--*/
+{
+    EnterFunc();
+    LPCSTR          retVal;
+    CEarningsData   snapshot;
+
+    {
+        CEpochGuard eg(gEarningsMain.m_EarningsRelease.GetEpochs());
+        retVal = EarningsReleaseDate(ReadRecord(GetEarningsDataByHandle(Handle), snapshot));
+    }
+
+    LeaveFunc();
+    return retVal;
+}
+
+
+_Use_decl_annotations_
+LPCSTR
+WINAPI
+GetEarningsReleaseTimeByHandle(
+    INT Handle
+    )
+/*++
+
+Abstract:
+
+    Returns the time when the earnings will be released
+
+--*/
+{
+    EnterFunc();
+    LPCSTR          retVal;
+    CEarningsData   snapshot;
+
+    {
+        CEpochGuard eg(gEarningsMain.m_EarningsRelease.GetEpochs());
+        retVal = EarningsReleaseTime(ReadRecord(GetEarningsDataByHandle(Handle), snapshot));
+    }
+
+    LeaveFunc();
+    return retVal;
+}
+
+
+_Use_decl_annotations_
+LPCSTR
+WINAPI
+GetDaysToEarningsReleaseByHandle(
+    INT Handle
+    )
+/*++
+
+Abstract:
+
+    Returns Number of days to next earnings release as a string.
+
+--*/
+{
+    EnterFunc();
+    INT             days;
+    LPCSTR          retVal;
+    CEarningsData   snapshot;
+
+    {
+        CEpochGuard eg(gEarningsMain.m_EarningsRelease.GetEpochs());
+        CEarningsDataPtr_t pData = ReadRecord(GetEarningsDataByHandle(Handle), snapshot);
+
+        //
+        // The columnar store has the days computed for all the symbols,
+        // so only the formatting is done here
+        //
+        if ((pData != NULL) && (pData->IsAvailable() == true) &&
+            GetDaysToEarningsByHandle(Handle, days))
+        {
+            strncpy_s(tlsDaysToRelease, CEarningsData::FieldCache.GetDaysText(days), _TRUNCATE);
+            retVal = tlsDaysToRelease;
+        }
+        else
+        {
+            retVal = DaysToEarningsRelease(pData);
+        }
+    }
+
+    LeaveFunc();
+    return retVal;
+}
+
+
+_Use_decl_annotations_
+INT
+WINAPI
+GetEarningsConfirmationByHandle(
+    INT Handle
+    )
+/*++
+
+Abstract:
+
+    Returns 1 if the earnings release date and time are confirmed
+
+--*/
+{
+    EnterFunc();
+    INT             retVal;
+    CEarningsData   snapshot;
+
+    {
+        CEpochGuard eg(gEarningsMain.m_EarningsRelease.GetEpochs());
+        retVal = EarningsConfirmation(ReadRecord(GetEarningsDataByHandle(Handle), snapshot));
+    }
+
+    LeaveFunc();
+    return retVal;
+}
+
+
+_Use_decl_annotations_
+LPCSTR
+WINAPI
+GetEarningsNotesByHandle(
+    INT Handle
+    )
+/*++
+
+Abstract:
+
+    Returns the notes from the earnings file
+
+--*/
+{
+    EnterFunc();
+    LPCSTR          retVal;
+    CEarningsData   snapshot;
+
+    {
+        CEpochGuard eg(gEarningsMain.m_EarningsRelease.GetEpochs());
+        retVal = EarningsNotes(ReadRecord(GetEarningsDataByHandle(Handle), snapshot));
+    }
+
+    LeaveFunc();
+    return retVal;
+}
+
+
+_Use_decl_annotations_
+INT
 WINAPI
 SetEarningsNotes(
     LPCSTR Ticker,
@@ -248,34 +650,340 @@ SetEarningsNotes(
 
 Abstract:
 
-    Sets the notes for the ticker
+    Sets the notes for the ticker. Returns 1 if the notes were set, 0 if
+    the ticker is not valid or the notes could not be kept.
 
 --*/
 {
     EnterFunc();
-    if (Notes == NULL) return;
+    INT retVal = 0;
 
-    CEarningsDataPtr_t  pData = GetEarningsData(Ticker);
+    if (Notes == NULL) return retVal;
 
-    if (pData != NULL)
+    //
+    // Make sure the ticker is in the cache before setting the notes
+    //
+    if (GetEarningsData(Ticker) != NULL)
     {
-        //
-        // TODO: Rare race condition
-        //
-        pData->StrEarningsNotes = Notes;
-        gEarningsMain.m_EarningsRelease.m_bCacheDirty = true;
+        retVal = gEarningsMain.m_EarningsRelease.SetEarningsNotes(Ticker, Notes) ? 1 : 0;
+    }
+
+    LeaveFunc();
+    return retVal;
+}
+
+
+_Use_decl_annotations_
+INT
+WINAPI
+GetEarningsCounter(
+    LPCSTR CounterName
+    )
+/*++
+
+Abstract:
+
+    Returns the value of the counter maintained by the earnings manager,
+    e.g. CacheHits, CacheMisses, Fetches, FetchesCoalesced. Returns -1
+    if the counter name is not known.
+
+--*/
+{
+    EnterFunc();
+    INT retVal = -1;
+
+    if ((CounterName != NULL) && (CounterName[0] != '\0'))
+    {
+        retVal = (INT)gEarningsMain.m_EarningsRelease.GetCounter(CounterName);
+    }
+
+    LeaveFunc();
+    return retVal;
+}
+
+
+INT
+WINAPI
+ShutdownEarnings(
+    void
+    )
+/*++
+
+Abstract:
+
+    Stops the background queries, saves the earnings data to the file and
+    disconnects. The application calls it before unloading the dll, the
+    unload saves the data too but can not wait for the background threads
+    to finish. Returns 1 if the dll was shut down, 0 otherwise.
+
+--*/
+{
+    EnterFunc();
+    INT retVal = 0;
+
+    __try
+    {
+        retVal = gEarningsMain.Shutdown() ? 1 : 0;
+    }
+    __except(EXCEPTION_EXECUTE_HANDLER)
+    {
+        LogError("Exception code = %x", GetExceptionCode());
+    }
+
+    LeaveFunc();
+    return retVal;
+}
+
+
+LPCSTR
+WINAPI
+GetEarningsDiagnostics(
+    void
+    )
+/*++
+
+Abstract:
+
+    Returns the state of the circuit breaker around the data source and
+    of the fetch limits as Name=Value pairs separated by ';', e.g.
+    Host=www.earningswhispers.com;Breaker=Open;Failures=5;OpenMsLeft=21000;...
+    The text is truncated to the buffer of the calling thread.
+
+--*/
+{
+    EnterFunc();
+
+    gEarningsMain.m_EarningsRelease.GetDiagnostics(tlsDiagnostics, _countof(tlsDiagnostics));
+
+    LeaveFunc();
+    return tlsDiagnostics;
+}
+
+
+_Use_decl_annotations_
+INT
+WINAPI
+SimulateRefreshPolicy(
+    INT Policy,
+    INT Days
+    )
+/*++
+
+Abstract:
+
+    Diagnostic only. Replays the cache file for the days under the refresh
+    policy and returns the number of queries it would send, to compare the
+    policies on a real cache file. It reads the whole file on the calling
+    thread, so it is meant for the test tools and not for the indicators.
+    Returns -1 if the policy is not known or the file cannot be read.
+
+--*/
+{
+    EnterFunc();
+    INT retVal = -1;
+
+    if ((Policy >= 0) && (Policy < RefreshPolicyCount) && (Days > 0))
+    {
+        retVal = gEarningsMain.m_EarningsRelease.SimulateRefreshPolicy((ERefreshPolicy)Policy, Days);
+    }
+
+    LeaveFunc();
+    return retVal;
+}
 
-        LogTrace("SetEarningsNotes Setting[%s]: %s", 
-            pData->StrTicker.c_str(), Notes);
+
+_Use_decl_annotations_
+INT
+WINAPI
+GetSymbolsReportingBetween(
+    INT FromDays,
+    INT ToDays,
+    LPSTR Buffer,
+    INT BufferSize
+    )
+/*++
+
+Abstract:
+
+    Copies the tickers with the earnings release between FromDays and
+    ToDays days from today, both included, into the buffer. The tickers
+    are separated by commas and ordered by the earnings date. Returns the
+    number of tickers copied or -1 if the parameters are not valid or the
+    dll could not be initialized.
+
+--*/
+{
+    EnterFunc();
+    INT retVal = -1;
+
+    if ((Buffer == NULL) || (BufferSize <= 0) || (FromDays > ToDays))
+    {
+        LogError("Invalid parameters passed to the function");
+        return retVal;
+    }
+
+    __try
+    {
+        if (gEarningsMain.Initialize(GetModuleHandle(NULL)))
+        {
+            retVal = gEarningsMain.m_EarningsRelease.GetSymbolsReportingBetween(
+                FromDays, ToDays, Buffer, BufferSize);
+        }
+    }
+    __except(EXCEPTION_EXECUTE_HANDLER)
+    {
+        LogError("Exception code = %x", GetExceptionCode());
+        retVal = -1;
     }
 
     LeaveFunc();
+    return retVal;
 }
 
 
+_Use_decl_annotations_
+INT
+WINAPI
+GetEarningsCalendar(
+    INT Days,
+    INT ReleaseTime,
+    LPSTR Buffer,
+    INT BufferSize
+    )
+/*++
+
+Abstract:
+
+    Copies the tickers with the earnings release on the day Days days from
+    today at the release time into the buffer, separated by commas and
+    ordered by the ticker. The release time is 1 before the open, 2 during
+    the market, 3 after the close and 0 if it is not known. Returns the
+    number of tickers copied or -1 if the parameters are not valid or the
+    dll could not be initialized.
+
+--*/
+{
+    EnterFunc();
+    INT retVal = -1;
+
+    if ((Buffer == NULL) || (BufferSize <= 0) ||
+        (ReleaseTime < ReleaseUnknown) || (ReleaseTime > ReleaseAfterClose))
+    {
+        LogError("Invalid parameters passed to the function");
+        return retVal;
+    }
+
+    __try
+    {
+        if (gEarningsMain.Initialize(GetModuleHandle(NULL)))
+        {
+            retVal = gEarningsMain.m_EarningsRelease.GetEarningsCalendar(
+                Days, (EReleaseTime)ReleaseTime, Buffer, BufferSize);
+        }
+    }
+    __except(EXCEPTION_EXECUTE_HANDLER)
+    {
+        LogError("Exception code = %x", GetExceptionCode());
+        retVal = -1;
+    }
+
+    LeaveFunc();
+    return retVal;
+}
+
+
+_Use_decl_annotations_
+INT
+WINAPI
+GetEarningsStale(
+    LPCSTR Ticker
+    )
+/*++
+
+Abstract:
+
+    Returns 1 if the earnings data returned for the ticker is from an
+    earlier query and is due for a query or is being refreshed in
+    background, 0 if it is up to date
+
+--*/
+{
+    EnterFunc();
+    INT             retVal;
+    CEarningsData   snapshot;
+
+    {
+        CEpochGuard eg(gEarningsMain.m_EarningsRelease.GetEpochs());
+        retVal = EarningsStale(ReadRecord(GetEarningsData(Ticker), snapshot));
+    }
+
+    LeaveFunc();
+    return retVal;
+}
+
+
+_Use_decl_annotations_
+INT
+WINAPI
+PrefetchEarnings(
+    LPCSTR* Symbols,
+    INT Count
+    )
+/*++
+
+Abstract:
+
+    Queues the symbols that are not in the cache or are due for a query,
+    at a priority lower than the symbols the callers are waiting for. Does
+    not wait for the queries. Returns the number of symbols queued or -1
+    if the parameters are not valid or the dll could not be initialized.
+
+--*/
+{
+    EnterFunc();
+    INT retVal = -1;
+
+    if ((Symbols == NULL) || (Count < 0))
+    {
+        LogError("Invalid parameters passed to the function");
+        return retVal;
+    }
+
+    //
+    // The prefetch is usually the first call, it starts the fetch threads
+    //
+    __try
+    {
+        if (gEarningsMain.Initialize(GetModuleHandle(NULL)))
+        {
+            retVal = gEarningsMain.m_EarningsRelease.PrefetchEarnings(Symbols, Count);
+        }
+    }
+    __except(EXCEPTION_EXECUTE_HANDLER)
+    {
+        LogError("Exception code = %x", GetExceptionCode());
+        retVal = -1;
+    }
+
+    LeaveFunc();
+    return retVal;
+}
+
+
+//
+// The forex getters return a copy of the field in a buffer of the calling
+// thread, the same as the earnings getters
+//
+static __declspec(thread) CHAR  tlsFxDate[EARNINGS_FIELD_SIZE];
+static __declspec(thread) CHAR  tlsFxTime[EARNINGS_FIELD_SIZE];
+static __declspec(thread) CHAR  tlsFxDuration[EARNINGS_FIELD_SIZE];
+static __declspec(thread) CHAR  tlsFxDesc[EARNINGS_NOTES_SIZE];
+
+
 PFOREX_EVENT
 GetForexEvent(
-    LPCSTR CurrencyPair
+    LPCSTR CurrencyPair,
+    FOREX_EVENT& Event
     )
 /*
 
@@ -285,6 +993,9 @@ Abstract:
     The exception handling code will make sure even if the parsing fails, the app will
     not crash.
 
+    The event is copied into Event, the forex manager frees its events on
+    every refresh. Returns Event or NULL if there is no event.
+
 */
 {
     EnterFunc();
@@ -305,7 +1016,10 @@ Abstract:
 
     __try
     {
-        pForexEvent = gEarningsMain.m_ForexEvents.GetNextFxEvent(CurrencyPair);
+        if (gEarningsMain.m_ForexEvents.GetNextFxEvent(CurrencyPair, Event) == true)
+        {
+            pForexEvent = &Event;
+        }
     }
     __except(EXCEPTION_EXECUTE_HANDLER)
     {
@@ -314,6 +1028,7 @@ Abstract:
     }
 #else
     UNREFERENCED_PARAMETER(CurrencyPair);
+    UNREFERENCED_PARAMETER(Event);
 #endif
 
     LeaveFunc();
@@ -336,12 +1051,14 @@ Abstract:
 {
     EnterFunc();
 
-    LPSTR retVal = "";
-    PFOREX_EVENT pFxEvt = GetForexEvent(CurrencyPair);
+    LPSTR        retVal = "";
+    FOREX_EVENT  fxEvent;
+    PFOREX_EVENT pFxEvt = GetForexEvent(CurrencyPair, fxEvent);
 
     if (pFxEvt != NULL)
     {
-        retVal = pFxEvt->StrEventDate;
+        strncpy_s(tlsFxDate, pFxEvt->StrEventDate, _TRUNCATE);
+        retVal = tlsFxDate;
     }
 
     LeaveFunc();
@@ -364,12 +1081,14 @@ Abstract:
 {
     EnterFunc();
 
-    LPSTR retVal = "";
-    PFOREX_EVENT pFxEvt = GetForexEvent(CurrencyPair);
+    LPSTR        retVal = "";
+    FOREX_EVENT  fxEvent;
+    PFOREX_EVENT pFxEvt = GetForexEvent(CurrencyPair, fxEvent);
 
     if (pFxEvt != NULL)
     {
-        retVal = pFxEvt->StrEventTime;
+        strncpy_s(tlsFxTime, pFxEvt->StrEventTime, _TRUNCATE);
+        retVal = tlsFxTime;
     }
 
     LeaveFunc();
@@ -392,12 +1111,14 @@ Abstract:
 {
     EnterFunc();
 
-    LPSTR retVal = "";
-    PFOREX_EVENT pFxEvt = GetForexEvent(CurrencyPair);
+    LPSTR        retVal = "";
+    FOREX_EVENT  fxEvent;
+    PFOREX_EVENT pFxEvt = GetForexEvent(CurrencyPair, fxEvent);
     
     if (pFxEvt != NULL)
     {
-        retVal = pFxEvt->GetEventDuration();
+        strncpy_s(tlsFxDuration, pFxEvt->GetEventDuration(), _TRUNCATE);
+        retVal = tlsFxDuration;
     }
 
     LeaveFunc();
@@ -420,12 +1141,14 @@ Abstract:
 {
     EnterFunc();
 
-    LPSTR retVal = "";
-    PFOREX_EVENT pFxEvt = GetForexEvent(CurrencyPair);
+    LPSTR        retVal = "";
+    FOREX_EVENT  fxEvent;
+    PFOREX_EVENT pFxEvt = GetForexEvent(CurrencyPair, fxEvent);
     
     if (pFxEvt != NULL)
     {
-        retVal = pFxEvt->StrEventDesc;
+        strncpy_s(tlsFxDesc, pFxEvt->StrEventDesc, _TRUNCATE);
+        retVal = tlsFxDesc;
     }
     
     LeaveFunc();
@@ -448,8 +1171,9 @@ Abstract:
 {
     EnterFunc();
 
-    INT retVal = 0;
-    PFOREX_EVENT pFxEvt = GetForexEvent(CurrencyPair);
+    INT          retVal = 0;
+    FOREX_EVENT  fxEvent;
+    PFOREX_EVENT pFxEvt = GetForexEvent(CurrencyPair, fxEvent);
     
     if (pFxEvt != NULL)
     {
@@ -111,15 +111,142 @@ GetEarningsNotes(
     );
 
 //
-// Set the earnings notes
+// Set the earnings notes, returns 1 if the notes were set and 0 if not. The
+// notes are truncated to EARNINGS_NOTES_SIZE - 1 characters, and are not
+// set when the notes pool has no room for 65535 different notes
 //
-VOID 
+INT 
 WINAPI 
 SetEarningsNotes(
     _In_ LPCSTR Symbol, 
     _In_ LPCSTR Notes
     );
 
+//
+// Get the handle for the symbol to be used with the ByHandle functions
+//
+INT 
+WINAPI 
+GetSymbolHandle(
+    _In_ LPCSTR Symbol
+    );
+
+//
+// The earnings getters for the symbol handle
+//
+LPCSTR 
+WINAPI 
+GetEarningsReleaseDateByHandle(
+    _In_ INT Handle
+    );
+
+LPCSTR 
+WINAPI 
+GetEarningsReleaseTimeByHandle(
+    _In_ INT Handle
+    );
+
+LPCSTR 
+WINAPI 
+GetDaysToEarningsReleaseByHandle(
+    _In_ INT Handle
+    );
+
+INT 
+WINAPI 
+GetEarningsConfirmationByHandle(
+    _In_ INT Handle
+    );
+
+LPCSTR 
+WINAPI 
+GetEarningsNotesByHandle(
+    _In_ INT Handle
+    );
+
+//
+// Get the value of a cache or query counter
+//
+INT 
+WINAPI 
+GetEarningsCounter(
+    _In_ LPCSTR CounterName
+    );
+
+//
+// Stop the background queries and save the earnings data, before unloading the dll
+//
+INT 
+WINAPI 
+ShutdownEarnings(
+    void
+    );
+
+//
+// Get the state of the circuit breaker and of the fetch limits as Name=Value pairs
+//
+LPCSTR 
+WINAPI 
+GetEarningsDiagnostics(
+    void
+    );
+
+//
+// Diagnostic only, for the test tools. Returns the queries the refresh policy
+// would send for the cache file in the days, 0 for the fixed policy and 1 for
+// the adaptive policy. Reads the whole cache file, not for the indicators
+//
+INT 
+WINAPI 
+SimulateRefreshPolicy(
+    _In_ INT Policy,
+    _In_ INT Days
+    );
+
+//
+// Returns the tickers reporting in the range of days from today
+//
+INT 
+WINAPI 
+GetSymbolsReportingBetween(
+    _In_ INT FromDays,
+    _In_ INT ToDays,
+    _Out_writes_(BufferSize) LPSTR Buffer,
+    _In_ INT BufferSize
+    );
+
+//
+// Returns the tickers reporting on a day at the release time, 1 before the
+// open, 2 during the market, 3 after the close and 0 if not known
+//
+INT 
+WINAPI 
+GetEarningsCalendar(
+    _In_ INT Days,
+    _In_ INT ReleaseTime,
+    _Out_writes_(BufferSize) LPSTR Buffer,
+    _In_ INT BufferSize
+    );
+
+//
+// Returns 1 if the earnings data is from an earlier query and is being refreshed
+//
+INT 
+WINAPI 
+GetEarningsStale(
+    _In_ LPCSTR Symbol
+    );
+
+//
+// Queue the symbols to warm up the cache, returns the number queued
+//
+INT 
+WINAPI 
+PrefetchEarnings(
+    _In_reads_(Count) LPCSTR* Symbols,
+    _In_ INT Count
+    );
+
 
 //
 // Exported function for Forex from DailyFx.com
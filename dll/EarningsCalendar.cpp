@@ -0,0 +1,220 @@
+/*++
+
+    Copyright (c) Pai Financials LLC.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    EarningsCalendar.cpp
+
+Abstract:
+
+    Implements the calendar of the earnings releases
+
+Author:
+
+    nabieasaurus
+
+--*/
+#include "StdAfx.h"
+#include "EarningsCalendar.h"
+
+
+//
+// Orders the tickers in a day list
+//
+static
+inline
+bool
+TickerLess(
+    _In_ const TICKER_KEY& Left,
+    _In_ const TICKER_KEY& Right
+    )
+{
+    return strncmp(Left.Chars, Right.Chars, TICKER_KEY_SIZE) < 0;
+}
+
+
+_Use_decl_annotations_
+void
+CEarningsCalendar::AddToDay(
+    const TICKER_KEY& Ticker,
+    UINT32 Slot
+    )
+/*++
+
+Routine Description:
+
+    Inserts the ticker into the sorted list of the slot, creating the
+    bucket of the day if required. Called with the lock held
+
+--*/
+{
+    std::vector<TICKER_KEY>& tickers =
+        m_Days[Slot >> CALENDAR_SLOT_SHIFT].Tickers[Slot & CALENDAR_RELEASE_MASK];
+
+    tickers.insert(std::lower_bound(tickers.begin(), tickers.end(), Ticker, TickerLess), Ticker);
+}
+
+
+_Use_decl_annotations_
+void
+CEarningsCalendar::RemoveFromDay(
+    const TICKER_KEY& Ticker,
+    UINT32 Slot
+    )
+/*++
+
+Routine Description:
+
+    Removes the ticker from the list of the slot and the bucket of the
+    day once it has no tickers. Called with the lock held
+
+--*/
+{
+    CALENDAR_DAYS::iterator itDay = m_Days.find(Slot >> CALENDAR_SLOT_SHIFT);
+    if (itDay == m_Days.end()) { return; }
+
+    std::vector<TICKER_KEY>& tickers = itDay->second.Tickers[Slot & CALENDAR_RELEASE_MASK];
+    std::vector<TICKER_KEY>::iterator it =
+        std::lower_bound(tickers.begin(), tickers.end(), Ticker, TickerLess);
+
+    if ((it != tickers.end()) && (*it == Ticker))
+    {
+        tickers.erase(it);
+    }
+
+    for (int nCtr = 0; nCtr < CALENDAR_RELEASE_TIMES; nCtr++)
+    {
+        if (itDay->second.Tickers[nCtr].empty() == false) { return; }
+    }
+
+    m_Days.erase(itDay);
+}
+
+
+_Use_decl_annotations_
+void
+CEarningsCalendar::Update(
+    const TICKER_KEY& Ticker,
+    UINT32 EarningsDate,
+    EReleaseTime ReleaseTime
+    )
+/*++
+
+Routine Description:
+
+    Moves the ticker from its previous day and release time to the new
+    ones. The earnings dates are eastern midnight, so the utc day index
+    of the date is the eastern day.
+
+Parameters:
+
+    Ticker - The ticker symbol in upper case
+
+    EarningsDate - The earnings date, 0 if the ticker has no date
+
+    ReleaseTime - The time of the release on that day
+
+--*/
+{
+    CAutoLock   al(m_Lock);
+    UINT32*     pSlot = m_Slots.Find(Ticker);
+    UINT32      slot = ((EarningsDate / (24 * 60 * 60)) << CALENDAR_SLOT_SHIFT) | (UINT32)ReleaseTime;
+
+    if (pSlot != NULL)
+    {
+        if ((EarningsDate != 0) && (*pSlot == slot)) { return; }
+
+        RemoveFromDay(Ticker, *pSlot);
+        m_Slots.Erase(Ticker);
+    }
+
+    if (EarningsDate == 0) { return; }
+
+    AddToDay(Ticker, slot);
+    m_Slots.Insert(Ticker, slot);
+}
+
+
+void
+CEarningsCalendar::Clear(
+    void
+    )
+/*++
+
+Routine Description:
+
+    Removes all of the days, called when the cache is reloaded
+
+--*/
+{
+    CAutoLock al(m_Lock);
+
+    m_Days.clear();
+    m_Slots.Clear();
+}
+
+
+_Use_decl_annotations_
+INT
+CEarningsCalendar::GetDay(
+    UINT32 DayIndex,
+    EReleaseTime ReleaseTime,
+    LPSTR Buffer,
+    INT BufferSize
+    )
+/*++
+
+Routine Description:
+
+    Copies the tickers of one release time from the bucket of the day
+
+Parameters:
+
+    DayIndex - The eastern day index
+
+    ReleaseTime - The time of the release on that day
+
+    Buffer - Returns the tickers separated by commas
+
+    BufferSize - The size of the buffer including the terminating null
+
+Return Value:
+
+    The number of tickers copied
+
+--*/
+{
+    CAutoLock   al(m_Lock);
+    CTickerList list(Buffer, BufferSize);
+
+    CALENDAR_DAYS::const_iterator itDay = m_Days.find(DayIndex);
+    if (itDay == m_Days.end()) { return 0; }
+
+    const std::vector<TICKER_KEY>& tickers = itDay->second.Tickers[ReleaseTime];
+
+    for (std::vector<TICKER_KEY>::const_iterator it = tickers.begin(); it != tickers.end(); it++)
+    {
+        if (list.Append(*it) == false) { break; }
+    }
+
+    return list.Count();
+}
@@ -0,0 +1,131 @@
+/*++
+
+    Copyright (c) Pai Financials LLC.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    EarningsCalendar.h
+
+Abstract:
+
+    The tickers reporting on each day, grouped by the release time
+
+Author:
+
+    nabieasaurus
+
+--*/
+#pragma once
+
+#include "Lock.h"
+#include "TickerMap.h"
+#include "EarningsColumns.h"
+
+#define CALENDAR_RELEASE_TIMES      (ReleaseAfterClose + 1)
+#define CALENDAR_SLOT_SHIFT         2           // Slot of a ticker is day << 2 | release time
+#define CALENDAR_RELEASE_MASK       ((1 << CALENDAR_SLOT_SHIFT) - 1)
+
+
+/*++
+
+Class Name:
+
+    CEarningsCalendar
+
+Class Description:
+
+    Keeps a bucket for every eastern day that has an earnings release,
+    in a hash keyed by the day index. The bucket has a sorted list of
+    the tickers for each release time, so the tickers reporting on a
+    day before the open, during the market or after the close are read
+    from one bucket.
+
+    The day and release time of each ticker is kept in a ticker map to
+    move it when a query changes them. A bucket is removed when its last
+    ticker leaves.
+
+--*/
+class CEarningsCalendar
+{
+protected:
+    struct CALENDAR_DAY
+    {
+        std::vector<TICKER_KEY> Tickers[CALENDAR_RELEASE_TIMES];
+    };
+
+    typedef std::unordered_map<UINT32, CALENDAR_DAY>    CALENDAR_DAYS;
+
+    CALENDAR_DAYS               m_Days;             // Eastern day index to the bucket
+    CTickerMap<UINT32>          m_Slots;            // Ticker to its day and release time
+    CLock                       m_Lock;
+
+    //
+    // Adds or removes the ticker from its list in the bucket
+    //
+    void AddToDay(
+        _In_ const TICKER_KEY& Ticker,
+        _In_ UINT32 Slot
+        );
+
+    void RemoveFromDay(
+        _In_ const TICKER_KEY& Ticker,
+        _In_ UINT32 Slot
+        );
+
+    // Not copyable
+    CEarningsCalendar(const CEarningsCalendar&);
+    CEarningsCalendar& operator = (const CEarningsCalendar&);
+
+    // C'tor/D'tor
+public:
+    CEarningsCalendar(void) { }
+    ~CEarningsCalendar(void) { }
+
+    // Properties
+public:
+    inline UINT32 Days(void) { CAutoLock al(m_Lock); return (UINT32)m_Days.size(); }
+
+    // Operations
+public:
+    //
+    // Moves the ticker to the day of the earnings date and the release
+    // time. A date of 0 removes the ticker from the calendar
+    //
+    void Update(
+        _In_ const TICKER_KEY& Ticker,
+        _In_ UINT32 EarningsDate,
+        _In_ EReleaseTime ReleaseTime
+        );
+
+    void Clear(void);
+
+    //
+    // Copies the tickers reporting on the eastern day at the release time
+    // into the buffer separated by commas, ordered by the ticker. Returns
+    // the number of tickers copied, stops at the last ticker that fits
+    //
+    INT GetDay(
+        _In_ UINT32 DayIndex,
+        _In_ EReleaseTime ReleaseTime,
+        _Out_writes_(BufferSize) LPSTR Buffer,
+        _In_ INT BufferSize
+        );
+};
@@ -0,0 +1,335 @@
+/*++
+
+    Copyright (c) Pai Financials LLC.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    EarningsColumns.cpp
+
+Abstract:
+
+    Implements the columnar copy of the earnings cache and the batch
+    computation of the days to earnings
+
+Author:
+
+    nabieasaurus
+
+--*/
+#include "StdAfx.h"
+#include "FeedTime.h"
+#include "EarningsColumns.h"
+
+
+CEarningsColumns::CEarningsColumns(
+    void
+    )
+/*++
+
+Routine Description:
+
+    This is the default constructor for the CEarningsColumns
+
+--*/
+{
+    m_nRows = 0;
+    m_nToday = 0;
+    m_nNextRollover = 0;
+    ZeroMemory(m_pChunks, sizeof(m_pChunks));
+}
+
+
+CEarningsColumns::~CEarningsColumns(
+    void
+    )
+/*++
+
+Routine Description:
+
+    This is the default destructor for the CEarningsColumns
+
+--*/
+{
+    for (int nCtr = 0; nCtr < _countof(m_pChunks); nCtr++)
+    {
+        delete m_pChunks[nCtr];
+    }
+}
+
+
+void
+CEarningsColumns::CheckRollover(
+    void
+    )
+/*++
+
+Routine Description:
+
+    Recomputes the days to earnings if the eastern day changed since
+    the last computation and sets the time of the next rollover. The
+    next rollover is published last so the readers do not come in here
+    till the column is computed.
+
+--*/
+{
+    CFeedTime   ftNow(FT_CURRENT);
+    UINT32      nowUtc = ftNow.GetUtcTime();
+
+    if (nowUtc < m_nNextRollover) { return; }
+
+    UINT32      nowEastern = ftNow.GetNyseTime();
+    INT32       today = (INT32)(nowEastern / SECONDS_PER_DAY);
+
+    if (today != m_nToday)
+    {
+        ComputeDaysToEarnings(today);
+    }
+
+    m_nNextRollover = nowUtc + (SECONDS_PER_DAY - (nowEastern % SECONDS_PER_DAY));
+}
+
+
+_Use_decl_annotations_
+void
+CEarningsColumns::ComputeDaysToEarnings(
+    INT32 Today
+    )
+/*++
+
+Routine Description:
+
+    Subtracts today from the earnings day of every row, four rows at a
+    time. The rows without earnings data are computed too, their value
+    is ignored because of the flags. Called with the column lock held.
+
+Parameters:
+
+    Today - The eastern day index
+
+--*/
+{
+    __m128i     today = _mm_set1_epi32(Today);
+    INT         nChunks = (m_nRows + SYMBOL_CHUNK_SIZE - 1) / SYMBOL_CHUNK_SIZE;
+
+    for (INT nChunk = 0; nChunk < nChunks; nChunk++)
+    {
+        COLUMN_CHUNK* pChunk = m_pChunks[nChunk];
+        if (pChunk == NULL) { continue; }
+
+        for (INT nRow = 0; nRow < SYMBOL_CHUNK_SIZE; nRow += 4)
+        {
+            __m128i days = _mm_loadu_si128((const __m128i*)&pChunk->EarningsDay[nRow]);
+            _mm_storeu_si128((__m128i*)&pChunk->DaysToEarnings[nRow], _mm_sub_epi32(days, today));
+        }
+    }
+
+    m_nToday = Today;
+
+    LogInfo("Days to earnings computed for %d rows, day %d", m_nRows, Today);
+}
+
+
+_Use_decl_annotations_
+void
+CEarningsColumns::Update(
+    INT Handle,
+    bool Available,
+    bool Confirmed,
+    UINT32 EarningsTime,
+    UINT32 QueryTime,
+    EReleaseTime ReleaseTime
+    )
+/*++
+
+Routine Description:
+
+    Stores the fields of the cached record in the row for the handle,
+    allocating the chunk if required. The flags are written last.
+
+Parameters:
+
+    Handle - The symbol handle
+
+    Available - If the earnings data is available
+
+    Confirmed - If the earnings date is confirmed
+
+    EarningsTime - The utc time of the earnings date
+
+    QueryTime - The utc time of the last query
+
+    ReleaseTime - When the earnings are released
+
+--*/
+{
+    if (Handle <= SYMBOL_INVALID_HANDLE) { return; }
+
+    CAutoLock   al(m_Lock);
+    UINT32      index = (UINT32)(Handle - 1);
+    UINT32      chunk = index / SYMBOL_CHUNK_SIZE;
+    UINT32      row = index % SYMBOL_CHUNK_SIZE;
+
+    if (chunk >= SYMBOL_MAX_CHUNKS) { return; }
+
+    CheckRollover();
+
+    if (m_pChunks[chunk] == NULL)
+    {
+        m_pChunks[chunk] = new COLUMN_CHUNK();
+    }
+
+    COLUMN_CHUNK* pChunk = m_pChunks[chunk];
+    INT32 earningsDay = (INT32)(EarningsTime / SECONDS_PER_DAY);
+
+    pChunk->EarningsDay[row] = earningsDay;
+    pChunk->DaysToEarnings[row] = earningsDay - m_nToday;
+    pChunk->QueryTime[row] = QueryTime;
+    pChunk->TimeCode[row] = (BYTE)ReleaseTime;
+    pChunk->Flags[row] = (Available ? COLUMN_FLAG_AVAILABLE : 0) |
+        (Confirmed ? COLUMN_FLAG_CONFIRMED : 0);
+
+    //
+    // Publish the row
+    //
+    if (Handle > m_nRows)
+    {
+        InterlockedExchange(&m_nRows, Handle);
+    }
+}
+
+
+void
+CEarningsColumns::Clear(
+    void
+    )
+/*++
+
+Routine Description:
+
+    Marks all of the rows as not available. The chunks are kept since
+    the handles stay valid across the reloads.
+
+--*/
+{
+    CAutoLock al(m_Lock);
+
+    for (int nCtr = 0; nCtr < _countof(m_pChunks); nCtr++)
+    {
+        if (m_pChunks[nCtr] != NULL)
+        {
+            ZeroMemory(m_pChunks[nCtr]->Flags, sizeof(m_pChunks[nCtr]->Flags));
+        }
+    }
+}
+
+
+_Use_decl_annotations_
+bool
+CEarningsColumns::GetDaysToEarnings(
+    INT Handle,
+    INT& Days
+    )
+/*++
+
+Routine Description:
+
+    Returns the days to earnings for the handle from the days column.
+    The first reader after the eastern midnight recomputes the column.
+
+Parameters:
+
+    Handle - The symbol handle
+
+    Days - Returns the days to the earnings release
+
+Return Value:
+
+    true - if the row has the earnings data
+    false - otherwise
+
+--*/
+{
+    if ((UINT32)_time32(NULL) >= m_nNextRollover)
+    {
+        CAutoLock al(m_Lock);
+        CheckRollover();
+    }
+
+    UINT32          row;
+    COLUMN_CHUNK*   pChunk = GetChunk(Handle, row);
+
+    if ((pChunk == NULL) || ((pChunk->Flags[row] & COLUMN_FLAG_AVAILABLE) == 0))
+    {
+        return false;
+    }
+
+    Days = pChunk->DaysToEarnings[row];
+    return true;
+}
+
+
+_Use_decl_annotations_
+EReleaseTime
+CEarningsColumns::GetReleaseTime(
+    INT Handle
+    )
+/*++
+
+Routine Description:
+
+    Returns when the earnings are released for the handle
+
+--*/
+{
+    UINT32          row;
+    COLUMN_CHUNK*   pChunk = GetChunk(Handle, row);
+
+    if ((pChunk == NULL) || ((pChunk->Flags[row] & COLUMN_FLAG_AVAILABLE) == 0))
+    {
+        return ReleaseUnknown;
+    }
+
+    return (EReleaseTime)pChunk->TimeCode[row];
+}
+
+
+_Use_decl_annotations_
+EReleaseTime
+CEarningsColumns::ClassifyReleaseTime(
+    LPCSTR ReleaseTime
+    )
+/*++
+
+Routine Description:
+
+    Classifies the release time text from the website, e.g. "Before Open",
+    "After Close"
+
+--*/
+{
+    if (ReleaseTime == NULL) { return ReleaseUnknown; }
+
+    if (StrStrIA(ReleaseTime, "before") != NULL) { return ReleaseBeforeOpen; }
+    if (StrStrIA(ReleaseTime, "during") != NULL) { return ReleaseDuringMarket; }
+    if (StrStrIA(ReleaseTime, "after") != NULL) { return ReleaseAfterClose; }
+
+    return ReleaseUnknown;
+}
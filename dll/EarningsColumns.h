@@ -0,0 +1,168 @@
+/*++
+
+    Copyright (c) Pai Financials LLC.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    EarningsColumns.h
+
+Abstract:
+
+    The columnar copy of the earnings cache indexed by the symbol handle
+
+Author:
+
+    nabieasaurus
+
+--*/
+#pragma once
+
+#include "SymbolTable.h"
+
+#define SECONDS_PER_DAY             (24 * 60 * 60)
+
+//
+// Flags column
+//
+#define COLUMN_FLAG_AVAILABLE       0x01
+#define COLUMN_FLAG_CONFIRMED       0x02
+
+
+//
+// When the earnings are released with respect to the trading session
+//
+enum EReleaseTime
+{
+    ReleaseUnknown,
+    ReleaseBeforeOpen,
+    ReleaseDuringMarket,
+    ReleaseAfterClose,
+};
+
+
+
+/*++
+
+Class Name:
+
+    CEarningsColumns
+
+Class Description:
+
+    Keeps the numeric fields of the cached records in parallel arrays
+    indexed by the symbol handle. The rows are allocated in chunks of
+    SYMBOL_CHUNK_SIZE that are never moved, the same as the symbol table.
+
+    The days to earnings column is computed for the whole universe at
+    once when the eastern day rolls over, four rows per SSE2 subtract,
+    so the readers only index into the column. The earnings dates are
+    stored as eastern midnight so the utc day index of the earnings date
+    is also its eastern day index.
+
+    The writers take the column lock, the readers do not.
+
+--*/
+class CEarningsColumns
+{
+protected:
+    struct COLUMN_CHUNK
+    {
+        INT32       EarningsDay[SYMBOL_CHUNK_SIZE];     // Day index of the earnings release
+        INT32       DaysToEarnings[SYMBOL_CHUNK_SIZE];  // EarningsDay - today
+        UINT32      QueryTime[SYMBOL_CHUNK_SIZE];       // Utc time of the last query
+        BYTE        Flags[SYMBOL_CHUNK_SIZE];           // COLUMN_FLAG_*
+        BYTE        TimeCode[SYMBOL_CHUNK_SIZE];        // EReleaseTime
+    };
+
+    COLUMN_CHUNK*       m_pChunks[SYMBOL_MAX_CHUNKS];
+    LONG volatile       m_nRows;            // Rows 1..N are addressable
+    CLock               m_Lock;
+
+    INT32 volatile      m_nToday;           // Eastern day index the days column is computed for
+    UINT32 volatile     m_nNextRollover;    // Utc time of the next eastern midnight
+
+    //
+    // Recomputes the days column if the eastern day rolled over.
+    // Called with the column lock held
+    //
+    void CheckRollover(void);
+
+    inline COLUMN_CHUNK* GetChunk(_In_ INT Handle, _Out_ UINT32& Row) {
+        if ((Handle <= SYMBOL_INVALID_HANDLE) || (Handle > m_nRows)) return NULL;
+
+        UINT32 index = (UINT32)(Handle - 1);
+        Row = index % SYMBOL_CHUNK_SIZE;
+        return m_pChunks[index / SYMBOL_CHUNK_SIZE];
+    }
+
+    // C'tor/D'tor
+public:
+    CEarningsColumns(void);
+    ~CEarningsColumns(void);
+
+public:
+    //
+    // Stores the fields of the record in the row for the handle
+    //
+    void Update(
+        _In_ INT Handle,
+        _In_ bool Available,
+        _In_ bool Confirmed,
+        _In_ UINT32 EarningsTime,
+        _In_ UINT32 QueryTime,
+        _In_ EReleaseTime ReleaseTime
+        );
+
+    //
+    // Marks all of the rows as not available, called when the cache is reloaded
+    //
+    void Clear(void);
+
+    //
+    // Returns the days to earnings for the handle. Returns false if the
+    // row does not have the earnings data
+    //
+    bool GetDaysToEarnings(
+        _In_ INT Handle,
+        _Out_ INT& Days
+        );
+
+    //
+    // Returns when the earnings are released for the handle
+    //
+    EReleaseTime GetReleaseTime(
+        _In_ INT Handle
+        );
+
+    //
+    // Recomputes the days to earnings for all of the rows
+    //
+    void ComputeDaysToEarnings(
+        _In_ INT32 Today
+        );
+
+    //
+    // Classifies the release time text from the website
+    //
+    static EReleaseTime ClassifyReleaseTime(
+        _In_ LPCSTR ReleaseTime
+        );
+};
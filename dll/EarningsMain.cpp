@@ -162,15 +162,73 @@ Abstract:
     //
     // Read the settings from the registry or use the default settings
     //
-    m_nEarningsQueryDays = (int)gEarningsMain.ReadDWord("EarningsQueryDays", 5);
-    m_nEarningsRandDays = (int)gEarningsMain.ReadDWord("EarningsRandDays", 5);
-    m_nPostEarningsDays = (int)gEarningsMain.ReadDWord("PostEarningsDays", 3);
+    {
+        REFRESH_INTERVALS intervals;
+
+        intervals.NearDays = ReadDWord("RefreshNearDays", REFRESH_NEAR_DAYS);
+        intervals.NearUnconfirmedDays = ReadDWord("RefreshNearUnconfirmedDays", REFRESH_NEAR_UNCONFIRMED_DAYS);
+        intervals.NearConfirmedDays = ReadDWord("RefreshNearConfirmedDays", REFRESH_NEAR_CONFIRMED_DAYS);
+        intervals.FarUnconfirmedDays = ReadDWord("RefreshFarUnconfirmedDays", REFRESH_FAR_UNCONFIRMED_DAYS);
+        intervals.FarConfirmedDays = ReadDWord("RefreshFarConfirmedDays", REFRESH_FAR_CONFIRMED_DAYS);
+        intervals.ChangedDays = ReadDWord("RefreshChangedDays", REFRESH_CHANGED_DAYS);
+        intervals.PostEarningsDays = ReadDWord("RefreshPostEarningsDays", REFRESH_POST_EARNINGS_DAYS);
+
+        //
+        // The entries of the older releases set the fixed policy. If they
+        // are tuned and the policy is not set, the fixed policy is kept
+        //
+        DWORD   queryDays = ReadDWord("EarningsQueryDays", MAXDWORD);
+        DWORD   randDays = ReadDWord("EarningsRandDays", MAXDWORD);
+        DWORD   postDays = ReadDWord("PostEarningsDays", MAXDWORD);
+        DWORD   policy = ReadDWord("RefreshPolicy", MAXDWORD);
+
+        if (queryDays != MAXDWORD) { intervals.FixedQueryDays = queryDays; }
+        if (randDays != MAXDWORD) { intervals.FixedRandDays = randDays; }
+        if (postDays != MAXDWORD) { intervals.FixedPostDays = postDays; }
+
+        if ((queryDays != MAXDWORD) || (randDays != MAXDWORD) || (postDays != MAXDWORD))
+        {
+            if (policy == MAXDWORD) { policy = RefreshPolicyFixed; }
+
+            LogWarn("EarningsQueryDays, EarningsRandDays and PostEarningsDays are deprecated, "
+                "they only apply to the fixed refresh policy (RefreshPolicy=0). "
+                "The adaptive policy (RefreshPolicy=1) uses the Refresh* entries");
+        }
+
+        if (policy == MAXDWORD) { policy = RefreshPolicyAdaptive; }
+
+        m_EarningsRelease.SetRefreshPolicy((ERefreshPolicy)policy, intervals);
+    }
+
+    //
+    // The cache is split in shards before loading the earnings file
+    //
+    m_EarningsRelease.SetCacheShards(ReadDWord("CacheShards", EARNINGS_DEFAULT_SHARDS));
+
+    //
+    // The columnar store is filled while loading the earnings file
+    //
+    m_EarningsRelease.m_bColumnarStore = (ReadDWord("ColumnarStore", 0) != 0);
+
+    //
+    // The records kept in memory, the rest are read from the earnings file when asked for
+    //
+    m_EarningsRelease.SetCacheCapacity(ReadDWord("CacheCapacity", 0));
+
+    //
+    // Only index the earnings file at startup and parse the records when asked for
+    //
+    m_EarningsRelease.m_bLazyLoad = (ReadDWord("LazyLoad", 0) != 0);
+
+    //
+    // The refresh schedule is filled while loading the earnings file
+    //
+    m_EarningsRelease.m_bScheduledRefresh = (ReadDWord("ScheduledRefresh", 1) != 0);
 
     //
     // Load the earnings file
     //
-    if (!m_EarningsRelease.LoadEarningsData(m_sEarningsFile.c_str(), m_nEarningsQueryDays,
-        m_nPostEarningsDays, m_nEarningsRandDays))
+    if (!m_EarningsRelease.LoadEarningsData(m_sEarningsFile.c_str()))
     {
         LogError("Unable to load earnings Data file");
     }
@@ -205,9 +263,57 @@ Abstract:
 #endif
 
     //
-    // Connect to the websites for queries
+    // Connect to the websites for queries. The data source can be pointed
+    // to a local http server for testing
+    //
+    {
+        String  dataSource = ReadString("DataSource", WWW_DATASOURCE);
+        DWORD   dataSourcePort = ReadDWord("DataSourcePort", INTERNET_DEFAULT_HTTP_PORT);
+
+        m_bInitialized = m_EarningsRelease.Connect(dataSource.c_str(), 
+            (INTERNET_PORT)dataSourcePort);
+    }
+
+    //
+    // The fetch threads and the limits of the queries sent to the website
     //
-    m_bInitialized = m_EarningsRelease.Connect();
+    m_EarningsRelease.SetFetchLimits(ReadDWord("FetchWorkers", FETCH_DEFAULT_WORKERS),
+        ReadDWord("FetchRequestsPerSec", 0), ReadDWord("FetchMaxInFlight", 0),
+        ReadDWord("FetchAdaptiveInFlight", 1) != 0);
+
+    //
+    // Cache misses are queried in background unless disabled in ini file
+    //
+    if ((m_bInitialized == true) && (ReadDWord("AsyncQuery", 1) != 0))
+    {
+        if (!m_EarningsRelease.StartFetchThread())
+        {
+            LogError("Unable to start fetch thread. Cache misses will block.");
+        }
+    }
+
+    //
+    // Warm up the cache with the symbols of the watch list in background
+    //
+    {
+        String  watchlistFile = ReadString("WatchlistFile", "");
+
+        if ((watchlistFile.empty() == false) && (m_EarningsRelease.m_bAsyncQuery == true))
+        {
+            m_EarningsRelease.StartPrefetch(watchlistFile.c_str());
+        }
+    }
+
+    //
+    // Refresh the cached records outside the market hours
+    //
+    if ((m_EarningsRelease.m_bScheduledRefresh == true) && (m_EarningsRelease.m_bAsyncQuery == true))
+    {
+        if (!m_EarningsRelease.StartRefreshScheduler())
+        {
+            LogError("Unable to start refresh scheduler. Records are refreshed when asked for.");
+        }
+    }
 
 #ifdef NPFOREX
 #pragma message(__LOC__ "* * * * * * * * * FOREX ENABLED * * * * * * * *.")
@@ -291,8 +397,7 @@ Description:
             // Load the file from the disk and update the lastFileAttribs
             //
             LogDebugA("Loading the cache file : %s\n", m_sEarningsFile.c_str());
-            m_EarningsRelease.LoadEarningsData(m_sEarningsFile.c_str(), m_nDaysPreEarnings,
-                m_nDaysPastEarnings);
+            m_EarningsRelease.LoadEarningsData(m_sEarningsFile.c_str());
 
             lastFileAttribs = curFileAttribs;
         }
@@ -305,6 +410,43 @@ Description:
 #endif
 
 
+bool
+CEarningsMain::Shutdown(
+    void
+    )
+/*++
+
+Abstract:
+
+    This function is called by the application before it unloads the dll.
+    It waits for the background queries to finish, saves the earnings data
+    back to the file and disconnects. The next call to the dll initializes
+    it again.
+
+--*/
+{
+    bool bRet = true;
+
+    EnterFunc();
+
+    if (m_bInitialized == false) { goto Cleanup; }
+
+    //
+    // Stop the background queries before saving the earnings data back to the file
+    //
+    m_EarningsRelease.StopFetchThread();
+    m_EarningsRelease.SaveEarningsData(m_sEarningsFile.c_str());
+    m_EarningsRelease.LogCounters();
+
+    bRet = Uninitialize();
+
+Cleanup:
+
+    LeaveFunc();
+    return bRet;
+}
+
+
 bool
 CEarningsMain::Uninitialize(
     void
@@ -314,11 +456,15 @@ CEarningsMain::Uninitialize(
 Abstract:
 
     This function is called by the framework when the dll is getting
-    unloaded from memory.
+    unloaded from memory. The loader lock is held, so the background
+    threads are only signalled to exit, not waited for. The earnings
+    data is saved with the shard locks taken on a timeout, the threads
+    still running can only hold them for the time of a cache update.
 
 --*/
 {
     bool bRet = true;
+    bool bThreadsRunning = false;
 
     EnterFunc();
 
@@ -339,9 +485,20 @@ Abstract:
 #endif
 
     //
-    // Save the earnings data back to the file
+    // Save the earnings data back to the file. After a Shutdown there is
+    // nothing left to write
     //
-    m_EarningsRelease.SaveEarningsData(m_sEarningsFile.c_str());
+    bThreadsRunning = m_EarningsRelease.SignalFetchThreads();
+    m_EarningsRelease.SaveEarningsData(m_sEarningsFile.c_str(), SAVE_UNLOAD_LOCK_TIMEOUT);
+
+    //
+    // The threads still running use the connection, it is closed with the process
+    //
+    if (bThreadsRunning == true)
+    {
+        LogInfo("Unloaded without shutdown, the background threads are not waited for");
+        goto Cleanup;
+    }
 
     // Disconnect from the internet
 #ifdef NPFOREX
@@ -350,6 +507,7 @@ Abstract:
 #endif
 
     bRet = m_EarningsRelease.Disconnect();
+    m_bInitialized = false;
 
 Cleanup:
 
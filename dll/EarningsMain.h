@@ -58,10 +58,6 @@ protected:
     String  m_sEarningsFile;                // This string stores the name of earnings csv file
     String  m_sIniFile;                     // This string stores the name of ini file.
 
-    int     m_nPostEarningsDays = 0;        // days past earnings
-    int     m_nEarningsQueryDays = 0;       // days pre earnings 
-    int     m_nEarningsRandDays = 0;        // randomly distribute
-
 
 protected:
     String ReadString(LPCSTR KeyName, LPCSTR Default);
@@ -98,6 +94,7 @@ public:
     }
 
     bool Initialize(HMODULE hModule);
+    bool Shutdown(void);
     bool Uninitialize(void);
 };
 
@@ -40,16 +40,22 @@ Author:
 #pragma comment(lib, "Shlwapi.lib")
 
 //
-// The user agent string and the website we are collecting data from
+// The user agent string
 //
 #define USER_AGENT_STRING           "UserAgent:  Mozilla/4.0 (compatible; MSIE 8.0)"
-#define WWW_DATASOURCE              "www.earningswhispers.com"
 
 //
-// The earning file cache header and CSV header 
+// The earning file cache header and CSV header. The dlls before version 8
+// do not load this file, they start with an empty cache
 //
-#define EARNINGS_DATAFILE_HDR       "Earnings Data File Ver 7.0 Copyright (c) Pai Financials LLC (Do not remove this line)\n"
-#define EARNINGS_DATAFILE_ROW       "Available,Ticker,QueryDate,EarningsDate,EarningsTime,Confirmed,Notes\n"
+#define EARNINGS_DATAFILE_HDR       "Earnings Data File Ver 8.0 Copyright (c) Pai Financials LLC (Do not remove this line)\n"
+#define EARNINGS_DATAFILE_ROW       "Available,Ticker,QueryDate,EarningsDate,EarningsTime,Confirmed,Failures,Notes\n"
+
+//
+// The version 7 file does not have the failures column, it is still loaded
+//
+#define EARNINGS_DATAFILE_HDR_V7    "Earnings Data File Ver 7.0 Copyright (c) Pai Financials LLC (Do not remove this line)\n"
+#define EARNINGS_DATAFILE_ROW_V7    "Available,Ticker,QueryDate,EarningsDate,EarningsTime,Confirmed,Notes\n"
 
 //
 // The constants required for the form submission 
@@ -57,6 +63,11 @@ Author:
 #define WEBSITE_FORM_HEADER         "Content-Type: application/x-www-form-urlencoded"
 #define WEBSITE_EARNING_URL         "stocks.asp?symbol=%s"
 
+//
+// Time to wait for the fetch thread to finish the current query on exit
+//
+#define FETCH_THREAD_EXIT_TIMEOUT   (5 * 1000)
+
 //
 // The indexes of the csv line
 //
@@ -68,15 +79,92 @@ enum EarningsIndex
     E_EARNINGDATE       = 3,
     E_EARNINGTIME       = 4,
     E_EARNINGCONFIRMED  = 5,
-    E_EARNINGNOTES      = 6,
-    E_MAXCOLUMNS        = 7,
+    E_FAILURES          = 6,
+    E_EARNINGNOTES      = 7,
+    E_MAXCOLUMNS        = 8,
+};
+
+//
+// The names of the counters as passed to GetEarningsCounter
+//
+static
+LPCSTR  StrCounters[CtrMaxCounters] = {
+    "CacheHits",
+    "CacheMisses",
+    "Fetches",
+    "FetchesCoalesced",
+    "FetchFailures",
+    "RecordAllocations",
+    "SlabBlocks",
+    "LoadTimeMs",
+    "NegativeHits",
+    "NegativeHitsToday",
+    "Evictions",
+    "DiskRecoveries",
+    "RateLimited",
+    "Prefetches",
+    "StaleServed",
+    "RefreshesScheduled",
+    "RefreshesDeferred",
+    "Throttled",
+    "ParseFailures",
+    "Retries",
 };
 
+//
+// The names of the per shard counters, followed by :N for the shard N
+//
+#define SHARD_CONTENTION            "ShardContention"
+#define SHARD_ACQUISITIONS          "ShardAcquisitions"
+
+//
+// The per priority counters of the fetch queue. FetchQueueDepth:P is the
+// tickers waiting in the priority P, FetchWait:P:B the tickers of the
+// priority P that waited less than the limit of the histogram bucket B
+//
+#define FETCH_QUEUE_DEPTH           "FetchQueueDepth"
+#define FETCH_WAIT                  "FetchWait"
+
+//
+// The percentage of the lookups found in memory
+//
+#define CACHE_HIT_RATIO             "HitRatio"
+
+//
+// The current limit of the queries in flight
+//
+#define FETCH_LIMIT                 "FetchLimit"
+
+//
+// The state of the circuit breaker, as in EBreakerState, and its trips
+//
+#define BREAKER_STATE               "BreakerState"
+#define BREAKER_TRIPS               "BreakerTrips"
+
+//
+// The status code the data source throttles with, besides 503
+//
+#define HTTP_STATUS_TOO_MANY_REQUESTS   429
+
+//
+// The world the refresh policies are simulated in. A query past the
+// earnings date finds the date of the next quarter, not confirmed, and
+// the dates are confirmed the days before the release
+//
+#define SIMULATION_QUARTER_DAYS     91
+#define SIMULATION_CONFIRM_DAYS     14
+
+//
+// The notes and the memoized date text of all the cached records
+//
+CStringPool CEarningsData::NotesPool;
+CFieldCache CEarningsData::FieldCache;
+
 
 
 CEarningsMgr::CEarningsMgr(
     void
-    )
+    ) : m_Symbols(m_Epochs)
 /*++
 
 Routine Description:
@@ -87,6 +175,31 @@ Routine Description:
 {
     m_bCacheDirty = false;
     m_bConnected = false;
+    m_bAsyncQuery = false;
+    m_bColumnarStore = false;
+    m_bLazyLoad = false;
+    m_bScheduledRefresh = false;
+    m_nShards = EARNINGS_DEFAULT_SHARDS;
+    m_pShards = new EARNINGS_SHARD[m_nShards];
+    m_pRecords = new RECORD_SLAB();
+    m_nDataSourcePort = INTERNET_DEFAULT_HTTP_PORT;
+
+    m_nCapacity = 0;
+    m_nRecords = 0;
+    m_nClockHand = 0;
+    m_nCacheColumns = E_MAXCOLUMNS;
+    m_bIndexesBuilt = TRUE;
+
+    ZeroMemory(m_hFetchThreads, sizeof(m_hFetchThreads));
+    m_nFetchWorkers = FETCH_DEFAULT_WORKERS;
+    m_hFetchSemaphore = NULL;
+    m_hFetchExitEvent = NULL;
+    m_hPrefetchThread = NULL;
+    m_hRefreshThread = NULL;
+    m_bMarketOpen = FALSE;
+
+    ZeroMemory((PVOID)m_Counters, sizeof(m_Counters));
+    m_nNegativeDay = 0;
 }
 
 
@@ -101,19 +214,24 @@ Routine Description:
 
 --*/
 {
-    CAutoLock al(m_EarningsCacheLock);
-
     //
-    // Delete all of the entries
+    // The destructor runs under the loader lock, the threads can not exit
+    // while it is held. If they were not stopped before, the records are
+    // left to them and freed with the process
     //
-    for (EARNINGS_MAP::iterator itEarn = m_EarningsCache.begin();
-        itEarn != m_EarningsCache.end();
-        itEarn++)
+    if (SignalFetchThreads() == true)
     {
-        CEarningsDataPtr_t pData = itEarn->second;
-        delete pData;
+        LogWarn("Background threads still running, the cache is not freed");
+        return;
     }
 
+    //
+    // The records are freed with the slab in one step. The slab is retired
+    // so the evicted records still waiting to be released go first
+    //
+    delete [] m_pShards;
+    m_Epochs.Retire(m_pRecords);
+
     //
     // Disconnect the http connection
     //
@@ -121,9 +239,150 @@ Routine Description:
 }
 
 
+_Use_decl_annotations_
+bool
+CEarningsMgr::SetCacheShards(
+    UINT32 Shards
+    )
+/*++
+
+Routine Description:
+
+    Sets the number of shards the cache is split into. The count is
+    rounded up to power of 2 and limited to EARNINGS_MAX_SHARDS. The
+    shards can only be changed while the cache is empty.
+
+Parameters:
+
+    Shards - The number of shards
+
+Return Value:
+
+    true - if the shards were changed
+    false - if the cache is not empty
+
+--*/
+{
+    UINT32 nShards = 1;
+
+    while ((nShards < Shards) && (nShards < EARNINGS_MAX_SHARDS)) { nShards *= 2; }
+
+    if (nShards == m_nShards) { return true; }
+
+    for (UINT32 nShard = 0; nShard < m_nShards; nShard++)
+    {
+        if (!m_pShards[nShard].Cache.Empty())
+        {
+            LogError("Cache shards can not be changed after the cache is loaded");
+            return false;
+        }
+    }
+
+    delete [] m_pShards;
+    m_nShards = nShards;
+    m_pShards = new EARNINGS_SHARD[m_nShards];
+
+    LogInfo("Cache split in %d shards", m_nShards);
+    return true;
+}
+
+
+void
+CEarningsMgr::LockAllShards(
+    void
+    )
+/*++
+
+Routine Description:
+
+    Locks all of the shards in the same order, for loading and saving
+    the whole cache
+
+--*/
+{
+    for (UINT32 nShard = 0; nShard < m_nShards; nShard++)
+    {
+        m_pShards[nShard].Lock.Lock();
+    }
+}
+
+
+void
+CEarningsMgr::UnlockAllShards(
+    void
+    )
+/*++
+
+Routine Description:
+
+    Unlocks all of the shards locked by LockAllShards
+
+--*/
+{
+    for (UINT32 nShard = m_nShards; nShard > 0; nShard--)
+    {
+        m_pShards[nShard - 1].Lock.Unlock();
+    }
+}
+
+
+_Use_decl_annotations_
+bool
+CEarningsMgr::TryLockAllShards(
+    DWORD Milliseconds
+    )
+/*++
+
+Routine Description:
+
+    Locks all of the shards in the same order as LockAllShards, giving up
+    if a shard stays locked for the timeout. It is used when the dll is
+    unloaded, the threads still running cannot be waited for and the ones
+    terminated at the process exit can have left a shard locked.
+
+Parameters:
+
+    Milliseconds - The time to wait for all of the shards
+
+Return Value:
+
+    true - if all of the shards are locked
+    false - if the timeout expired, no shard is left locked
+
+--*/
+{
+    DWORD   dwStart = GetTickCount();
+    UINT32  nLocked = 0;
+
+    while (nLocked < m_nShards)
+    {
+        if (m_pShards[nLocked].Lock.TryLock() == true)
+        {
+            nLocked++;
+            continue;
+        }
+
+        if (GetTickCount() - dwStart >= Milliseconds)
+        {
+            while (nLocked > 0)
+            {
+                m_pShards[--nLocked].Lock.Unlock();
+            }
+            return false;
+        }
+
+        Sleep(1);
+    }
+
+    return true;
+}
+
+
+_Use_decl_annotations_
 bool 
 CEarningsMgr::Connect(
-    void
+    LPCSTR DataSource,
+    INTERNET_PORT DataSourcePort
     ) 
 /*++
 
@@ -131,6 +390,13 @@ Routine Description:
 
     This function connects to website for sending queries
 
+Parameters:
+
+    DataSource - The host name of the website. The default is WWW_DATASOURCE,
+        a local http server can be used for testing.
+
+    DataSourcePort - The http port of the website
+
 Return Value:
 
     true - if file load was successful
@@ -150,7 +416,12 @@ Return Value:
 
     if (m_bConnected == true) { goto Cleanup; }
     
-    m_bConnected = m_EarningsSite.InitializeA(USER_AGENT_STRING, WWW_DATASOURCE);
+    m_sDataSource.assign(DataSource);
+    m_Breaker.SetHost(DataSource);
+    m_nDataSourcePort = DataSourcePort;
+    
+    m_bConnected = m_EarningsSite.InitializeA(USER_AGENT_STRING, 
+        m_sDataSource.c_str(), m_nDataSourcePort);
 
 Cleanup:
 
@@ -160,383 +431,2926 @@ Cleanup:
 
 
 _Use_decl_annotations_
-bool
-CEarningsMgr::LoadEarningsData(
-    LPCSTR FileName,
-    INT EarningsQueryDays,
-    INT PostEarningsDays,
-    INT EarningsRandDays
+void
+CEarningsMgr::SetFetchLimits(
+    UINT32 Workers,
+    UINT32 RequestsPerSec,
+    UINT32 MaxInFlight,
+    bool AdaptiveInFlight
     )
 /*++
 
 Routine Description:
 
-    This function loads the earnings data from the cache file into 
-    the memory for faster processing. It opens the file and reads
-    the header information to verify we are reading the correct file
-    and creates an archive object to pass it on for further reading.
+    This function sets up the limits of the queries sent to the data
+    source. The rate is shared by the fetch threads and the callers that
+    query on a cache miss, so the website never sees more than the rate
+    whatever number of threads are querying.
 
 Parameters:
 
-    FileName - The name of the file from which to load the file.
+    Workers - The number of fetch threads, between 1 and FETCH_MAX_WORKERS
+
+    RequestsPerSec - The queries per second sent to the data source, 0 for
+        no limit
+
+    MaxInFlight - The queries sent and not yet answered, 0 for no limit
+        or AIMD_DEFAULT_MAX for the adaptive limit
+
+    AdaptiveInFlight - If the limit of the queries in flight follows the
+        latency and the throttling of the data source, see CConcurrencyLimit
+
+--*/
+{
+    EnterFunc();
+
+    m_nFetchWorkers = (Workers == 0) ? 1 : ((Workers > FETCH_MAX_WORKERS) ? FETCH_MAX_WORKERS : Workers);
+    m_RateLimit.SetRate(RequestsPerSec);
+    m_InFlight.SetLimits(MaxInFlight, AdaptiveInFlight);
+
+    LogInfo("Fetch threads = %d, requests per sec = %d, max in flight = %d, adaptive = %d",
+        m_nFetchWorkers, RequestsPerSec, MaxInFlight, AdaptiveInFlight);
+
+    LeaveFunc();
+}
+
 
-    EarningsQueryDays - The number of days before earnings to query again
+bool
+CEarningsMgr::StartFetchThread(
+    void
+    )
+/*++
 
-    PostEarningsDays - Number of days past earnings to query again
+Routine Description:
 
-    EarningsRandDays - Number of days since last query query again
+    This function starts the threads that query the website for the
+    symbols that are not in the cache. Once the threads are running the
+    cache misses do not block the caller, a pending record is returned
+    and the data is filled in by a fetch thread.
 
 Return Value:
 
-    true - if file load was successful
+    true - if the fetch threads were started
     false - if anything went wrong
 
 --*/
 {
-    using namespace std;
-    bool    bRet = false;
-    int     lineCtr = 0;
-    CHAR    szLine[1024];
-    LPSTR   szHeaders[] = { EARNINGS_DATAFILE_HDR, EARNINGS_DATAFILE_ROW };
+    bool retVal = false;
 
     EnterFunc();
 
-    //
-    // Use the lock function wide
-    //
-    CAutoLock al(m_EarningsCacheLock);
+    if (m_hFetchThreads[0] != NULL) 
+    {
+        retVal = true;
+        goto Cleanup;
+    }
 
-    LogInfo("Loading data file : %s", FileName);
+    m_hFetchSemaphore = CreateSemaphore(NULL, 0, MAXLONG, NULL);
+    CHK_EXP_ERR(m_hFetchSemaphore == NULL, "CreateSemaphore");
 
-    fstream inFile(FileName, ios::in);
-    if (inFile.fail())
+    m_hFetchExitEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    CHK_EXP_ERR(m_hFetchExitEvent == NULL, "CreateEvent");
+
+    for (UINT32 nCtr = 0; nCtr < m_nFetchWorkers; nCtr++)
     {
-        LogError("Unable to open the file : %s", FileName);
-        goto Cleanup;
+        m_hFetchThreads[nCtr] = CreateThread(NULL, 0, CEarningsMgr::FetchThreadProc, this, 0, NULL);
+        CHK_EXP_ERR(m_hFetchThreads[nCtr] == NULL, "CreateThread");
     }
 
-    //
-    // Read the file header and compare
-    //
-    for (int nCtr = 0; nCtr < _countof(szHeaders); nCtr++)
+    m_bAsyncQuery = true;
+    retVal = true;
+
+Cleanup:
+
+    if (retVal == false)
     {
-        inFile.getline(szLine, _countof(szLine));
-        if (inFile.fail())
+        StopFetchThread();
+    }
+
+    LeaveFunc();
+    return retVal;
+}
+
+
+void
+CEarningsMgr::StopFetchThread(
+    void
+    )
+/*++
+
+Routine Description:
+
+    This function signals the fetch threads to exit and waits for them to
+    finish the queries in progress. The tickers still in the queue are
+    left as pending and will be queried again in the next session. The
+    threads waiting for a slot of the queries in flight give up, the
+    slots are opened again once the threads are gone.
+
+--*/
+{
+    DWORD   nThreads = 0;
+
+    EnterFunc();
+
+    m_bAsyncQuery = false;
+    m_InFlight.Stop();
+
+    if (m_hPrefetchThread != NULL)
+    {
+        SetEvent(m_hFetchExitEvent);
+
+        if (WaitForSingleObject(m_hPrefetchThread, FETCH_THREAD_EXIT_TIMEOUT) != WAIT_OBJECT_0)
         {
-            LogError("Unable to read the file : %s", FileName);
-            goto Cleanup;
+            LogWarn("Prefetch thread did not exit in time");
         }
 
-        if (strncmp(szLine, szHeaders[nCtr], strlen(szHeaders[nCtr]) - 1) != 0)
+        CloseHandle(m_hPrefetchThread);
+        m_hPrefetchThread = NULL;
+    }
+
+    if (m_hRefreshThread != NULL)
+    {
+        SetEvent(m_hFetchExitEvent);
+
+        if (WaitForSingleObject(m_hRefreshThread, FETCH_THREAD_EXIT_TIMEOUT) != WAIT_OBJECT_0)
         {
-            LogError("Header mismatch : %s", FileName);
-            goto Cleanup;
+            LogWarn("Refresh scheduler did not exit in time");
         }
 
-        LogTrace("Header row match: %d", nCtr);
+        CloseHandle(m_hRefreshThread);
+        m_hRefreshThread = NULL;
     }
 
-    //
-    // Read the file data and Load the data into temp cache and remove
-    // stale ones before moving to the cache
-    //
-    m_EarningsCache.clear();
+    InterlockedExchange(&m_bMarketOpen, FALSE);
 
-    while (true)
-    {
-        LPSTR           szValue[E_MAXCOLUMNS];
-        CFeedTime       ftQuery, ftEarnings;
-        bool            bIsAvailable = true;
+    while ((nThreads < FETCH_MAX_WORKERS) && (m_hFetchThreads[nThreads] != NULL)) { nThreads++; }
 
-        //
-        // Read a line and exit if there were no more lines to read
-        //
-        inFile.getline(szLine, _countof(szLine));
-        if (inFile.fail()) { break; }
-        lineCtr++;
+    if (nThreads != 0)
+    {
+        SetEvent(m_hFetchExitEvent);
 
-        //
-        // If the line was a blank, continue reading till we reach EOF
-        //
-        if (strlen(szLine) == 0) { continue; }
+        if (WaitForMultipleObjects(nThreads, m_hFetchThreads, TRUE, FETCH_THREAD_EXIT_TIMEOUT) == 
+            WAIT_TIMEOUT)
+        {
+            LogWarn("Fetch threads did not exit in time");
+        }
 
-        //
-        // Parse the line
-        //
-        szValue[E_AVAILABLE] = szLine;
-        for (int nCtr = 1; nCtr < _countof(szValue); nCtr++)
+        for (DWORD nCtr = 0; nCtr < nThreads; nCtr++)
         {
-            LPSTR pNext = (LPSTR) strchr(szValue[nCtr - 1], L',');
-            if (pNext == NULL) 
-            {
-                LogError("Unable to parse input line");
-                continue;
-            }
+            CloseHandle(m_hFetchThreads[nCtr]);
+            m_hFetchThreads[nCtr] = NULL;
+        }
+    }
 
-            *pNext++ = L'\0';
+    if (m_hFetchExitEvent != NULL)
+    {
+        CloseHandle(m_hFetchExitEvent);
+        m_hFetchExitEvent = NULL;
+    }
 
-            //
-            // Trim white-spaces around all the values that we read
-            //
-            StrTrimA(pNext, " \t\r\n");
-            szValue[nCtr] = pNext;
-        }
+    if (m_hFetchSemaphore != NULL)
+    {
+        CloseHandle(m_hFetchSemaphore);
+        m_hFetchSemaphore = NULL;
+    }
+
+    m_InFlight.Resume();
+
+    LeaveFunc();
+}
+
+
+bool
+CEarningsMgr::SignalFetchThreads(
+    void
+    )
+/*++
+
+Routine Description:
+
+    This function signals the fetch threads, the prefetch thread and the
+    refresh scheduler to exit and returns without waiting for them. The
+    threads need the loader lock to exit, so the dll unload can not wait
+    for them. The handles are closed by StopFetchThread.
+
+Return Value:
+
+    true - if any of the threads is still running
+    false - if the threads were stopped or never started
+
+--*/
+{
+    bool bRunning = (m_hFetchThreads[0] != NULL) || (m_hPrefetchThread != NULL) ||
+                    (m_hRefreshThread != NULL);
+
+    m_bAsyncQuery = false;
+    m_InFlight.Stop();
+
+    if (m_hFetchExitEvent != NULL)
+    {
+        SetEvent(m_hFetchExitEvent);
+    }
+
+    return bRunning;
+}
+
+
+_Use_decl_annotations_
+bool
+CEarningsMgr::StartPrefetch(
+    LPCSTR WatchlistFile
+    )
+/*++
+
+Routine Description:
+
+    This function starts the thread that queues the tickers of the watch
+    list file, so the cache is warm by the time the callers ask for them.
+    The tickers are queued at the lowest priority, the callers go first.
+
+Parameters:
+
+    WatchlistFile - The file with one ticker per line
+
+Return Value:
+
+    true - if the thread was started
+    false - if anything went wrong
+
+--*/
+{
+    bool retVal = false;
+
+    EnterFunc();
+
+    if ((m_bAsyncQuery == false) || (m_hPrefetchThread != NULL))
+    {
+        LogError("The fetch threads are not running or the prefetch was started");
+        goto Cleanup;
+    }
+
+    m_sWatchlistFile.assign(WatchlistFile);
+
+    m_hPrefetchThread = CreateThread(NULL, 0, CEarningsMgr::PrefetchThreadProc, this, 0, NULL);
+    CHK_EXP_ERR(m_hPrefetchThread == NULL, "CreateThread");
+
+    retVal = true;
+
+Cleanup:
+
+    LeaveFunc();
+    return retVal;
+}
+
+
+bool
+CEarningsMgr::StartRefreshScheduler(
+    void
+    )
+/*++
+
+Routine Description:
+
+    This function starts the thread that refreshes the cached records
+    outside the market hours. While it runs, the callers get the records
+    they already have without a query during the regular hours, only the
+    symbols never queried go to the website.
+
+Return Value:
+
+    true - if the thread was started
+    false - if anything went wrong
+
+--*/
+{
+    bool retVal = false;
+
+    EnterFunc();
+
+    if ((m_bAsyncQuery == false) || (m_bScheduledRefresh == false) || (m_hRefreshThread != NULL))
+    {
+        LogError("The fetch threads are not running or the refresh scheduler was started");
+        goto Cleanup;
+    }
+
+    m_hRefreshThread = CreateThread(NULL, 0, CEarningsMgr::RefreshThreadProc, this, 0, NULL);
+    CHK_EXP_ERR(m_hRefreshThread == NULL, "CreateThread");
+
+    retVal = true;
+
+Cleanup:
+
+    LeaveFunc();
+    return retVal;
+}
+
+
+_Use_decl_annotations_
+bool
+CEarningsMgr::LoadEarningsData(
+    LPCSTR FileName
+    )
+/*++
+
+Routine Description:
+
+    This function loads the earnings data from the cache file into 
+    the memory for faster processing. It opens the file and reads
+    the header information to verify we are reading the correct file
+    and creates an archive object to pass it on for further reading.
+
+    The offset of every line is kept in the disk index of the shard. If
+    the cache has a capacity, the records beyond it are not loaded and
+    are read from the file when they are asked for.
+
+    In the lazy mode only the tickers and the offsets are read, none of
+    the records is loaded. Each record is parsed from the file the first
+    time it is asked for, and the date index and the calendar are filled
+    the first time they are asked for.
+
+Parameters:
+
+    FileName - The name of the file from which to load the file.
+
+Return Value:
+
+    true - if file load was successful
+    false - if anything went wrong
+
+--*/
+{
+    using namespace std;
+    bool    bRet = false;
+    int     lineCtr = 0;
+    CHAR    szLine[1024];
+    LPSTR   szHeaders[][2] = {
+        { EARNINGS_DATAFILE_HDR, EARNINGS_DATAFILE_ROW },
+        { EARNINGS_DATAFILE_HDR_V7, EARNINGS_DATAFILE_ROW_V7 } };
+    int     nVersion = 0;
+    int     nColumns = E_MAXCOLUMNS;
+    DWORD   dwStart = GetTickCount();
+
+    EnterFunc();
+
+    //
+    // Use the lock function wide
+    //
+    LockAllShards();
+
+    LogInfo("Loading data file : %s", FileName);
+
+    fstream inFile(FileName, ios::in);
+    if (inFile.fail())
+    {
+        LogError("Unable to open the file : %s", FileName);
+        goto Cleanup;
+    }
+
+    //
+    // Read the file header and compare. The version is picked by the
+    // first line
+    //
+    for (int nCtr = 0; nCtr < _countof(szHeaders[0]); nCtr++)
+    {
+        inFile.getline(szLine, _countof(szLine));
+        if (inFile.fail())
+        {
+            LogError("Unable to read the file : %s", FileName);
+            goto Cleanup;
+        }
+
+        if (nCtr == 0)
+        {
+            for (nVersion = 0; nVersion < _countof(szHeaders); nVersion++)
+            {
+                LPSTR szHeader = szHeaders[nVersion][nCtr];
+                if (strncmp(szLine, szHeader, strlen(szHeader) - 1) == 0) { break; }
+            }
+
+            if (nVersion == _countof(szHeaders))
+            {
+                LogError("Header mismatch : %s", FileName);
+                goto Cleanup;
+            }
+        }
+        else if (strncmp(szLine, szHeaders[nVersion][nCtr], strlen(szHeaders[nVersion][nCtr]) - 1) != 0)
+        {
+            LogError("Header mismatch : %s", FileName);
+            goto Cleanup;
+        }
+
+        LogTrace("Header row match: %d, version: %d", nCtr, nVersion);
+    }
+
+    //
+    // The older version does not have the failures column
+    //
+    if (nVersion != 0) { nColumns = E_MAXCOLUMNS - 1; }
+
+    //
+    // Read the file data and Load the data into temp cache and remove
+    // stale ones before moving to the cache
+    //
+    m_Symbols.UnbindAll();
+    m_Columns.Clear();
+    m_DateIndex.Clear();
+    m_Calendar.Clear();
+    m_RefreshSchedule.Clear();
+
+    for (UINT32 nShard = 0; nShard < m_nShards; nShard++)
+    {
+        m_pShards[nShard].Cache.Clear();
+        m_pShards[nShard].OnDisk.Clear();
+    }
+
+    //
+    // The old records go with their slab once the readers are done with them
+    //
+    m_Epochs.Retire(m_pRecords);
+    m_pRecords = new RECORD_SLAB();
+    m_nRecords = 0;
+
+    m_sCacheFile.assign(FileName);
+    m_nCacheColumns = nColumns;
+    InterlockedExchange(&m_bIndexesBuilt, (m_bLazyLoad == true) ? FALSE : TRUE);
+
+    if ((m_bLazyLoad == true) &&
+        (IndexEarningsFile(FileName, (UINT32)inFile.tellg(), lineCtr) == false))
+    {
+        goto Cleanup;
+    }
+
+    while (m_bLazyLoad == false)
+    {
+        TICKER_KEY      key;
+        CEarningsData   loaded;
+        UINT32          offset = (UINT32)inFile.tellg();
+
+        //
+        // Read a line and exit if there were no more lines to read
+        //
+        inFile.getline(szLine, _countof(szLine));
+        if (inFile.fail()) { break; }
+        lineCtr++;
+
+        //
+        // If the line was a blank, continue reading till we reach EOF
+        //
+        if (strlen(szLine) == 0) { continue; }
+
+        if (ParseEarningsLine(szLine, nColumns, key, loaded) == false) { continue; }
+
+        EARNINGS_SHARD& shard = GetShard(key);
+
+        if (shard.OnDisk.Insert(key, offset) == false)
+        {
+            LogError("Duplicate ticker in the file: %s", key.Chars);
+            continue;
+        }
+
+        CheckLoadedRecord(&loaded);
+        IndexRecord(key, loaded);
+
+        //
+        // Over the capacity the record stays in the file till it is asked for
+        //
+        if ((m_nCapacity != 0) && ((UINT32)m_nRecords >= m_nCapacity)) { continue; }
+
+        //
+        // If all fields were successfully read then allocate an entry and add it to the cache
+        //
+        PVOID pRecord = AllocateRecord();
+        if (pRecord == NULL)
+        {
+            //
+            // allocation failed, continue with next iteration and see if that succeeds
+            //
+            LogError("Allocation failed for %s", key.Chars);
+            continue;
+        }
+
+        CEarningsDataPtr_t pData = new (pRecord) CEarningsData(loaded);
+
+        if (shard.Cache.Insert(key, pData) == false)
+        {
+            //
+            // insertion failed, continue with next iteration and see if that succeeds
+            //
+            LogError("Insertion failed for %s", pData->GetTicker());
+            m_pRecords->Free(pData);
+            continue;
+        }
+
+        m_nRecords++;
+        LogTrace("Loaded earnings for %s", pData->GetTicker());
+
+        BindRecord(m_Symbols.Intern(key), pData);
+    }
+
+    m_bCacheDirty = false;
+    bRet = true;
+
+    //
+    // The notes of the records that were replaced are not referred to anymore
+    //
+    SweepNotes();
+
+    InterlockedExchange(&m_Counters[CtrLoadTimeMs], (LONG)(GetTickCount() - dwStart));
+    if (m_bLazyLoad == true)
+    {
+        LogInfo("Indexed %d lines in %d ms, records are loaded when asked for", lineCtr,
+            m_Counters[CtrLoadTimeMs]);
+    }
+    LogInfo("Loaded %d records in %d ms, slab blocks = %d, lines = %d", m_pRecords->Objects(),
+        m_Counters[CtrLoadTimeMs], m_pRecords->Blocks(), lineCtr);
+    LogInfo("Record size = %d bytes, notes pool = %d strings, %d bytes",
+        (INT)sizeof(CEarningsData), CEarningsData::NotesPool.Count(), CEarningsData::NotesPool.Bytes());
+
+Cleanup:
+
+    UnlockAllShards();
+    inFile.close();
+    
+    LeaveFunc();
+    return bRet;
+}
+
+
+_Use_decl_annotations_
+bool
+CEarningsMgr::IndexEarningsFile(
+    LPCSTR FileName,
+    UINT32 Offset,
+    INT& Lines
+    )
+/*++
+
+Routine Description:
+
+    This function scans the cache file from the offset of the first line
+    and adds the ticker and the offset of every line to the disk index of
+    its shard. Only the ticker column is looked at, the lines are parsed
+    by ReadEarningsLine when the record is asked for.
+
+    The file is read in binary in large blocks so the offsets are the
+    byte offsets in the file, same as the ones returned by tellg.
+
+Parameters:
+
+    FileName - The cache file
+
+    Offset - The offset of the first line after the headers
+
+    Lines - Returns the number of lines scanned
+
+Return Value:
+
+    true - if the file was scanned
+    false - if the file could not be read
+
+--*/
+{
+    using namespace std;
+    const INT   nBlockSize = 256 * 1024;
+    LPSTR       pBlock = NULL;
+    INT         nCarry = 0;             // Bytes of the partial line at the start of the block
+    UINT32      lineOffset = Offset;
+    bool        bRet = false;
+
+    Lines = 0;
+
+    fstream inFile(FileName, ios::in | ios::binary);
+    if (inFile.fail())
+    {
+        LogError("Unable to open the file : %s", FileName);
+        goto Cleanup;
+    }
+
+    inFile.seekg(Offset);
+    pBlock = new CHAR[nBlockSize + 1];
+
+    while (true)
+    {
+        inFile.read(pBlock + nCarry, nBlockSize - nCarry);
+        INT nRead = (INT)inFile.gcount();
+        INT nEnd = nCarry + nRead;
+        bool bLast = (nRead == 0) || inFile.eof();
+
+        if ((nEnd == 0) && bLast) { break; }
+
+        //
+        // The partial line at the end of the file does not have a new line
+        //
+        if (bLast && (pBlock[nEnd - 1] != '\n')) { pBlock[nEnd++] = '\n'; }
+
+        LPSTR pLine = pBlock;
+        LPSTR pEnd = pBlock + nEnd;
+        LPSTR pNewLine;
+
+        while ((pNewLine = (LPSTR)memchr(pLine, '\n', pEnd - pLine)) != NULL)
+        {
+            TICKER_KEY  key;
+            LPSTR       pTicker = (LPSTR)memchr(pLine, ',', pNewLine - pLine);
+            LPSTR       pTickerEnd = (pTicker != NULL) ?
+                            (LPSTR)memchr(pTicker + 1, ',', pNewLine - pTicker - 1) : NULL;
+
+            Lines++;
+
+            if (pTickerEnd != NULL)
+            {
+                *pTickerEnd = '\0';
+                pTicker++;
+                StrTrimA(pTicker, " \t");
+
+                if (key.Set(pTicker) == false)
+                {
+                    LogError("Invalid ticker symbol: %s", pTicker);
+                }
+                else if (GetShard(key).OnDisk.Insert(key, lineOffset) == false)
+                {
+                    LogError("Duplicate ticker in the file: %s", key.Chars);
+                }
+            }
+
+            lineOffset += (UINT32)(pNewLine + 1 - pLine);
+            pLine = pNewLine + 1;
+        }
+
+        if (bLast) { break; }
+
+        //
+        // Move the partial line to the start of the block. A line longer
+        // than the block is dropped
+        //
+        nCarry = (INT)(pEnd - pLine);
+        if (nCarry == nBlockSize)
+        {
+            LogError("Line too long in the file : %s", FileName);
+            lineOffset += nCarry;
+            nCarry = 0;
+        }
+
+        memmove(pBlock, pLine, nCarry);
+    }
+
+    bRet = true;
+
+Cleanup:
+
+    delete [] pBlock;
+    return bRet;
+}
+
+
+void
+CEarningsMgr::BuildIndexes(
+    void
+    )
+/*++
+
+Routine Description:
+
+    This function reads the cache file once and adds the lines that are
+    still in the disk indexes to the date index and the calendar. The
+    records queried since the load are already in both.
+
+--*/
+{
+    using namespace std;
+    CHAR    szLine[1024];
+    INT     nIndexed = 0;
+    INT     lineCtr = 0;
+
+    LockAllShards();
+
+    if (m_bIndexesBuilt == TRUE) { goto Cleanup; }
+
+    {
+        fstream inFile(m_sCacheFile.c_str(), ios::in);
+        if (inFile.fail())
+        {
+            LogError("Unable to open the file : %s", m_sCacheFile.c_str());
+            goto Cleanup;
+        }
+
+        while (true)
+        {
+            TICKER_KEY      key;
+            CEarningsData   loaded;
+            UINT32          offset = (UINT32)inFile.tellg();
+
+            inFile.getline(szLine, _countof(szLine));
+            if (inFile.fail()) { break; }
+
+            //
+            // Skip the headers and the blank lines
+            //
+            if ((++lineCtr <= 2) || (strlen(szLine) == 0)) { continue; }
+
+            if (ParseEarningsLine(szLine, m_nCacheColumns, key, loaded) == false) { continue; }
+
+            UINT32* pOffset = GetShard(key).OnDisk.Find(key);
+            if ((pOffset == NULL) || (*pOffset != offset)) { continue; }
+
+            CheckLoadedRecord(&loaded);
+            IndexRecord(key, loaded);
+            nIndexed++;
+        }
+    }
+
+    LogInfo("Date index built from the cache file, records = %d", nIndexed);
+
+Cleanup:
+
+    InterlockedExchange(&m_bIndexesBuilt, TRUE);
+    UnlockAllShards();
+}
+
+
+_Use_decl_annotations_
+bool
+CEarningsMgr::ParseEarningsLine(
+    LPSTR Line,
+    INT Columns,
+    TICKER_KEY& Ticker,
+    CEarningsData& Record
+    )
+/*++
+
+Routine Description:
+
+    This function parses a line of the cache file into the record. The
+    line is split in place.
+
+Parameters:
+
+    Line - The line from the cache file
+
+    Columns - The number of columns in the line, E_MAXCOLUMNS - 1 for
+        the version 7 file that does not have the failures
+
+    Ticker - Returns the ticker symbol in upper case
+
+    Record - Returns the record
+
+Return Value:
+
+    true - if the line was parsed
+    false - if the line is not valid
+
+--*/
+{
+    LPSTR           szValue[E_MAXCOLUMNS];
+    CFeedTime       ftQuery, ftEarnings;
+    bool            bIsAvailable = true;
+
+    //
+    // Parse the line
+    //
+    szValue[E_AVAILABLE] = Line;
+    for (int nCtr = 1; nCtr < Columns; nCtr++)
+    {
+        LPSTR pNext = (LPSTR) strchr(szValue[nCtr - 1], L',');
+        if (pNext == NULL) 
+        {
+            LogError("Unable to parse input line");
+            return false;
+        }
+
+        *pNext++ = L'\0';
+
+        //
+        // Trim white-spaces around all the values that we read
+        //
+        StrTrimA(pNext, " \t\r\n");
+        szValue[nCtr] = pNext;
+    }
+
+    if (Columns < E_MAXCOLUMNS)
+    {
+        szValue[E_EARNINGNOTES] = szValue[E_FAILURES];
+        szValue[E_FAILURES] = "0";
+    }
+
+    //
+    // Check if the line we read represents a valid entry
+    //
+    bIsAvailable = atoi(szValue[E_AVAILABLE]) == 0 ? false : true;
+
+    if (ftQuery.FromStringStd(szValue[E_QUERYDATE]) == false)
+    {
+        LogError("Unable to parse the query date");
+        return false;
+    }
+
+    if ((bIsAvailable == true) && 
+        (ftEarnings.FromStringStd(szValue[E_EARNINGDATE]) == false))
+    {
+        LogError("Unable to parse the earnings date");
+        return false;
+    }
+
+    //
+    // Pack the symbol in uppercase
+    //
+    if (Ticker.Set(szValue[E_TICKER]) == false)
+    {
+        LogError("Invalid ticker symbol: %s", szValue[E_TICKER]);
+        return false;
+    }
+
+    Record = CEarningsData(Ticker, bIsAvailable, 
+        ftQuery.GetUtcTime(), ftEarnings.GetUtcTime(), 
+        CEarningsColumns::ClassifyReleaseTime(szValue[E_EARNINGTIME]), 
+        atoi(szValue[E_EARNINGCONFIRMED]) == 0 ? false : true, 
+        CEarningsData::InternNotes(szValue[E_EARNINGNOTES]));
+    Record.SetFailures((UINT)atoi(szValue[E_FAILURES]));
+
+    if ((Record.GetNotesId() == STRING_POOL_EMPTY_ID) && (szValue[E_EARNINGNOTES][0] != '\0'))
+    {
+        LogError("Notes pool is full, the notes of %s are not loaded", Ticker.Chars);
+    }
+
+    return true;
+}
+
+
+_Use_decl_annotations_
+bool
+CEarningsMgr::ReadEarningsLine(
+    std::fstream& InFile,
+    const TICKER_KEY& Ticker,
+    UINT32 Offset,
+    CEarningsData& Record
+    )
+/*++
+
+Routine Description:
+
+    This function reads the line at the offset from the cache file and
+    parses it into the record. The file is only rewritten with all the
+    shards locked, so the offset stays valid while the shard is locked.
+
+Parameters:
+
+    InFile - The cache file
+
+    Ticker - The ticker symbol the line is expected to have
+
+    Offset - The offset of the line in the cache file
+
+    Record - Returns the record
+
+Return Value:
+
+    true - if the record was read
+    false - if anything went wrong
+
+--*/
+{
+    CHAR        szLine[1024];
+    TICKER_KEY  key;
+
+    InFile.clear();
+    InFile.seekg(Offset);
+    InFile.getline(szLine, _countof(szLine));
+    if (InFile.fail())
+    {
+        LogError("Unable to read the file : %s", m_sCacheFile.c_str());
+        return false;
+    }
+
+    if ((ParseEarningsLine(szLine, m_nCacheColumns, key, Record) == false) ||
+        (key != Ticker))
+    {
+        LogError("The cache file does not have %s at %d", Ticker.Chars, Offset);
+        return false;
+    }
+
+    return true;
+}
+
+
+_Use_decl_annotations_
+bool
+CEarningsMgr::ReadEarningsLine(
+    const TICKER_KEY& Ticker,
+    UINT32 Offset,
+    CEarningsData& Record
+    )
+/*++
+
+Routine Description:
+
+    Same as above, opens the cache file for the one line
+
+--*/
+{
+    std::fstream inFile(m_sCacheFile.c_str(), std::ios::in);
+
+    if (inFile.fail())
+    {
+        LogError("Unable to open the file : %s", m_sCacheFile.c_str());
+        return false;
+    }
+
+    return ReadEarningsLine(inFile, Ticker, Offset, Record);
+}
+
+
+_Use_decl_annotations_
+void
+CEarningsMgr::CheckLoadedRecord(
+    CEarningsDataPtr_t PtrEarningsData
+    )
+/*++
+
+Routine Description:
+
+    This function marks the record loaded from the cache file for the
+    query if the data is stale, the time is decided by the refresh policy
+    from the state of the record at its last query.
+
+Parameters:
+
+    PtrEarningsData - The record loaded from the cache file
+
+--*/
+{
+    //
+    // A reset queries all of the records again
+    //
+    PtrEarningsData->SetReQuery(gResetData);
+    if (PtrEarningsData->IsReQuery() == true) { return; }
+
+    if (PtrEarningsData->IsAvailable() == false)
+    {
+        //
+        // The symbols without the earnings data are queried again on the
+        // negative cache ladder. The records that were never queried are
+        // queried the first time they are asked for
+        //
+        PtrEarningsData->SetReQuery((PtrEarningsData->GetQueryTime() == 0) ||
+            PtrEarningsData->IsNegativeExpired((UINT32)_time32(NULL)));
+        return;
+    }
+
+    //
+    // For available data, check if we have to trigger a query again
+    // to the server
+    //
+    if (((UINT32)_time32(NULL) >= m_RefreshPolicy.GetRefreshTime(PtrEarningsData->GetKey(),
+            PtrEarningsData->IsConfirmed(), PtrEarningsData->GetQueryTime(),
+            PtrEarningsData->GetEarningsTime())))
+    {
+        LogInfo("Stale data. Marked for requery: %s", PtrEarningsData->GetTicker());
+        PtrEarningsData->SetReQuery(true);
+    }
+}
+
+
+_Use_decl_annotations_
+bool
+CEarningsMgr::SaveEarningsData(
+    LPCSTR FileName,
+    DWORD LockTimeout
+    )
+/*++
+
+Routine Description:
+
+    This function saves the earnings data from the memory cache into 
+    the file for later sessions. It opens the file and writes
+    the header information and other earnings data.
+
+    The records that were evicted are copied over from the current cache
+    file, so the file is written to a temporary file first and moved over
+    the cache file once it is complete. The disk index is updated with
+    the offsets in the new file.
+
+Parameters:
+
+    FileName - The name of the file to which the data will be saved
+
+    LockTimeout - The time to wait for the shard locks, the data is not
+        saved if they are not all taken in time
+
+Return Value:
+
+    true - if file load was successful
+    false - if anything went wrong
+
+--*/
+{
+    using namespace std;
+
+    bool        bRet = false;
+    fstream     outFile;
+    fstream     inFile;
+    String      tempFile(FileName);
+    DISK_INDEX* pIndexes = NULL;
+
+    //
+    // Use the lock function wide
+    //
+    if (LockTimeout == INFINITE)
+    {
+        LockAllShards();
+    }
+    else if (TryLockAllShards(LockTimeout) == false)
+    {
+        LogError("Unable to lock the cache, the earnings data is not saved");
+        return false;
+    }
+
+    //
+    // If no modification then we have nothing to write
+    //
+    if (m_bCacheDirty == false)
+    {
+        LogTrace("Cache is not dirty. Nothing to write.");
+        bRet = true;
+        goto Cleanup;
+    }
+
+    LogInfo("Saving data to file : %s", FileName);
+
+    //
+    // Open the output file in write mode
+    //
+    tempFile += ".tmp";
+    outFile.open(tempFile.c_str(), ios::out | ios::trunc);
+
+    if (outFile.fail())
+    {
+        LogError("Unable to open the file : %s", tempFile.c_str());
+        goto Cleanup;
+    }
+
+    //
+    // Write the file header(s)
+    //
+    outFile.write(EARNINGS_DATAFILE_HDR, strlen(EARNINGS_DATAFILE_HDR));
+    outFile.write(EARNINGS_DATAFILE_ROW, strlen(EARNINGS_DATAFILE_ROW));
+
+
+    //
+    // We write both valid and invalid entries to the file. Both valid and invalid
+    // entries are queries every N days to make sure we have new data
+    //
+    pIndexes = new DISK_INDEX[m_nShards];
+
+    if (m_sCacheFile.empty() == false)
+    {
+        inFile.open(m_sCacheFile.c_str(), ios::in);
+    }
+
+    for (UINT32 nShard = 0; nShard < m_nShards; nShard++)
+    {
+        EARNINGS_MAP& cache = m_pShards[nShard].Cache;
+        DISK_INDEX& onDisk = m_pShards[nShard].OnDisk;
+
+        for (EARNINGS_MAP::iterator itEarn = cache.begin();
+            itEarn != cache.end(); itEarn++)
+        {
+            CHAR    szLine[1024];
+
+            //
+            // The symbols the website never answered for are not saved
+            //
+            if ((itEarn->Value->GetQueryTime() == 0) || (itEarn->Value->IsUnanswered() == true))
+            {
+                continue;
+            }
+
+            UINT    dwLen = itEarn->Value->ToString(szLine);
+
+            pIndexes[nShard].Insert(itEarn->Key, (UINT32)outFile.tellp());
+            outFile.write(szLine, dwLen);
+        }
+
+        //
+        // The evicted records are only in the current file
+        //
+        for (DISK_INDEX::iterator itDisk = onDisk.begin();
+            itDisk != onDisk.end(); itDisk++)
+        {
+            CHAR            szLine[1024];
+            CEarningsData   evicted;
+
+            if (cache.Find(itDisk->Key) != NULL) { continue; }
+            if (ReadEarningsLine(inFile, itDisk->Key, itDisk->Value, evicted) == false) { continue; }
+
+            UINT dwLen = evicted.ToString(szLine);
+
+            pIndexes[nShard].Insert(itDisk->Key, (UINT32)outFile.tellp());
+            outFile.write(szLine, dwLen);
+        }
+    }
+
+
+    //
+    // Close the file and move it over the cache file
+    //
+    inFile.close();
+    outFile.flush();
+    outFile.close();
+
+    if (outFile.fail())
+    {
+        LogError("Unable to write the file : %s", tempFile.c_str());
+        goto Cleanup;
+    }
+
+    if (MoveFileExA(tempFile.c_str(), FileName, MOVEFILE_REPLACE_EXISTING) == FALSE)
+    {
+        LogError("Unable to replace the file : %s, error = %d", FileName, GetLastError());
+        goto Cleanup;
+    }
+
+    for (UINT32 nShard = 0; nShard < m_nShards; nShard++)
+    {
+        m_pShards[nShard].OnDisk.Swap(pIndexes[nShard]);
+    }
+
+    m_sCacheFile.assign(FileName);
+    m_nCacheColumns = E_MAXCOLUMNS;
+
+    m_bCacheDirty = false;
+    bRet = true;
+    LogTrace("FileSaved");
+
+Cleanup:
+
+    UnlockAllShards();
+    delete [] pIndexes;
+    return bRet;
+}
+
+
+_Use_decl_annotations_
+CEarningsDataPtr_t
+CEarningsMgr::GetEarningsData(
+    LPCSTR Ticker
+    )
+/*++
+
+Routine Description:
+
+    This function returns the earnings data for the Ticker symbol
+    passed to the function. It first checks to see if the data is
+    in the cache and if not found then queries website for
+    data and puts it in the cache for future use.
+
+    Only one query per ticker is in flight at any time. A caller that
+    finds the ticker being queried either waits for that query to 
+    complete or, if the record is pending on the fetch thread, gets
+    the pending record back.
+
+    When the fetch threads are running, a record that is due for a query
+    is returned at once and refreshed on the fetch thread, so a refresh
+    never holds up the caller.
+
+Parameters:
+
+    Ticker - The ticker symbol
+
+Return Value:
+
+    Pointer to the earnings data if successful.
+    NULL if there was error retrieving data.
+
+--*/
+{
+    TICKER_KEY          key;
+    CEarningsDataPtr_t  pData = NULL;
+    CEarningsDataPtr_t* ppData = NULL;
+    bool                bQueried = false;
+
+    //
+    // Pack the ticker in upper case
+    //
+    if (key.Set(Ticker) == false) { return NULL; }
+
+    //
+    // The record bound to the symbol handle is read without the shard lock
+    // if it does not have to be queried
+    //
+    {
+        SYMBOL_ENTRY* pEntry = m_Symbols.GetEntry(m_Symbols.Find(key));
+
+        pData = (pEntry != NULL) ? pEntry->Data : NULL;
+        if ((pData != NULL) && UseCachedRecord(pData))
+        {
+            IncrementCounter(CtrCacheHits);
+            return pData;
+        }
+
+        pData = NULL;
+    }
+
+    //
+    // Make room for the record before locking the shard
+    //
+    EvictRecords();
+
+    EARNINGS_SHARD& shard = GetShard(key);
+    CShardLock lock(shard);
+
+    //
+    // Check to see if symbol is in cache
+    //
+    ppData = shard.Cache.Find(key);
+    if (ppData == NULL)
+    {
+        //
+        // The evicted records are read back from the cache file
+        //
+        UINT32*         pOffset = shard.OnDisk.Find(key);
+        CEarningsData   evicted;
+        bool            bRecovered = (pOffset != NULL) && ReadEarningsLine(key, *pOffset, evicted);
+
+        if (bRecovered == true)
+        {
+            LogTrace("Symbol read from the cache file : %s", key.Chars);
+            IncrementCounter(CtrDiskRecoveries);
+        }
+        else
+        {
+            LogWarn("Symbol not in cache : %s", key.Chars);
+            IncrementCounter(CtrCacheMisses);
+        }
+
+        pData = InsertRecord(key, bRecovered ? &evicted : NULL);
+        if (pData == NULL) { goto Cleanup; }
+
+        if (bRecovered == true)
+        {
+            if (UseCachedRecord(pData)) { goto Cleanup; }
+
+            LogInfo("Symbol set for query: %s", pData->GetTicker());
+            pData->SetReQuery(false);
+        }
+        else if (m_bAsyncQuery == true)
+        {
+            //
+            // Do not block the caller, the fetch thread fills up the record
+            //
+            pData->SetPending(true);
+            shard.InFlight[key] = 0;
+            QueueFetch(key, FetchMiss, NULL, true);
+            goto Cleanup;
+        }
+    }
+    else
+    {
+        //
+        // Found in cache. Check if we have to requery the symbol
+        //
+        LogInfo("Symbol found in cache: %s", key.Chars);
+        IncrementCounter(CtrCacheHits);
+
+        pData = *ppData;
+
+        LONG* pWaiters = shard.InFlight.Find(key);
+        if (pWaiters != NULL)
+        {
+            IncrementCounter(CtrFetchesCoalesced);
+
+            //
+            // Pending records are filled by the fetch thread, do not wait on
+            // them. The ticker was asked for again, it goes up the queue
+            //
+            if (pData->IsPending())
+            {
+                m_FetchQueue.Touch(key);
+                goto Cleanup;
+            }
+
+            LogInfo("Waiting on query in flight: %s", key.Chars);
+
+            (*pWaiters)++;
+            while (shard.InFlight.Find(key) != NULL)
+            {
+                shard.FetchDone.Wait(shard.Lock);
+            }
+
+            //
+            // The cache could have been reloaded while we were waiting
+            //
+            ppData = shard.Cache.Find(key);
+            pData = (ppData != NULL) ? *ppData : NULL;
+            goto Cleanup;
+        }
+
+        if (UseCachedRecord(pData)) { goto Cleanup; }
+
+        LogInfo("Symbol set for query: %s", pData->GetTicker());
+        pData->SetReQuery(false);
+    }
+
+    //
+    // The record from an earlier query is returned as is and refreshed on
+    // the fetch thread, once. The callers see it as stale till then
+    //
+    if ((m_bAsyncQuery == true) && (pData->GetQueryTime() != 0))
+    {
+        LogInfo("Symbol set for refresh: %s", pData->GetTicker());
+        IncrementCounter(CtrStaleServed);
+
+        pData->SetPending(true);
+        shard.InFlight[key] = 0;
+        QueueFetch(key, FetchRefresh, pData, true);
+        goto Cleanup;
+    }
+
+    //
+    // Query the website without holding the shard lock. The other callers
+    // for this ticker wait on the query in flight
+    //
+    {
+        CEarningsData   fetched(key);
+        EFetchOutcome   outcome;
+
+        shard.InFlight[key] = 0;
+
+        shard.Lock.Unlock();
+        bQueried = QueryEarningsFromWebsite(&fetched, outcome);
+        shard.Lock.Lock();
+
+        CompleteFetch(key, fetched, bQueried, outcome);
+
+        ppData = shard.Cache.Find(key);
+        pData = (ppData != NULL) ? *ppData : NULL;
+    }
+
+Cleanup:
+
+    return pData;
+}
+
+
+_Use_decl_annotations_
+bool
+CEarningsMgr::SetEarningsNotes(
+    LPCSTR Ticker,
+    LPCSTR Notes
+    )
+/*++
+
+Routine Description:
+
+    Sets the notes of the cached record for the ticker. The notes are
+    interned in the notes pool and the record keeps their id. The notes
+    longer than EARNINGS_NOTES_SIZE are truncated. If the pool is full the
+    notes no record refers to are reclaimed first, and if it is still
+    full the notes are not set.
+
+    The record could have been evicted since the caller looked it up, it
+    is read back from the cache file the same as in GetEarningsData.
+
+Parameters:
+
+    Ticker - The ticker symbol
+
+    Notes - The notes for the ticker
+
+Return Value:
+
+    true - if the notes were set
+    false - if the ticker is not in the cache or the notes pool is full
+
+--*/
+{
+    TICKER_KEY  key;
+
+    if (key.Set(Ticker) == false) { return false; }
+
+    if (CEarningsData::NotesPool.IsFull() == true) { ReclaimNotes(); }
+
+    EvictRecords();
+
+    EARNINGS_SHARD& shard = GetShard(key);
+    CShardLock lock(shard);
+
+    CEarningsDataPtr_t  pData = NULL;
+    CEarningsDataPtr_t* ppData = shard.Cache.Find(key);
+
+    if (ppData != NULL)
+    {
+        pData = *ppData;
+    }
+    else
+    {
+        UINT32*         pOffset = shard.OnDisk.Find(key);
+        CEarningsData   evicted;
+
+        if ((pOffset == NULL) || (ReadEarningsLine(key, *pOffset, evicted) == false))
+        {
+            LogWarn("Symbol not in cache, the notes are not set : %s", key.Chars);
+            return false;
+        }
+
+        pData = InsertRecord(key, &evicted);
+        if (pData == NULL) { return false; }
+
+        LogTrace("Symbol read from the cache file : %s", key.Chars);
+        IncrementCounter(CtrDiskRecoveries);
+    }
+
+    //
+    // The notes are interned under the shard lock so a sweep does not
+    // reclaim them before the record refers to them
+    //
+    UINT16 notesId = CEarningsData::InternNotes(Notes);
+
+    if ((notesId == STRING_POOL_EMPTY_ID) && (Notes[0] != '\0'))
+    {
+        LogError("Notes pool is full, unable to set the notes of %s", key.Chars);
+        return false;
+    }
+
+    pData->BeginWrite();
+    pData->SetNotesId(notesId);
+    pData->EndWrite();
+
+    shard.OnDisk.Erase(key);
+
+    m_bCacheDirty = true;
+
+    LogTrace("SetEarningsNotes Setting[%s]: %s", key.Chars, Notes);
+    return true;
+}
+
+
+void
+CEarningsMgr::SweepNotes(
+    void
+    )
+/*++
+
+Routine Description:
+
+    Marks the notes the cached records refer to and sweeps the rest from
+    the notes pool. The readers could still hold the ids of the swept
+    notes in their copies of the records, so the notes are freed and the
+    ids reused through the epoch manager. Called with all of the shards
+    locked, the notes are only interned into the cached records under a
+    shard lock.
+
+--*/
+{
+    std::vector<bool>       used(STRING_POOL_MAX_ID + 1, false);
+    std::vector<UINT16>*    pSwept = new std::vector<UINT16>();
+
+    for (UINT32 nShard = 0; nShard < m_nShards; nShard++)
+    {
+        EARNINGS_MAP& cache = m_pShards[nShard].Cache;
+
+        for (EARNINGS_MAP::iterator it = cache.begin(); it != cache.end(); it++)
+        {
+            used[it->Value->GetNotesId()] = true;
+        }
+    }
+
+    CEarningsData::NotesPool.Sweep(used, *pSwept);
+
+    LogInfo("Notes pool swept, %d notes reclaimed, %d in use", (INT)pSwept->size(),
+        CEarningsData::NotesPool.Live());
+
+    if (pSwept->empty() == true)
+    {
+        delete pSwept;
+        return;
+    }
+
+    m_Epochs.Retire(pSwept, &CEarningsMgr::FreeNotes);
+}
+
+
+void
+CEarningsMgr::ReclaimNotes(
+    void
+    )
+/*++
+
+Routine Description:
+
+    Same as SweepNotes, locks all of the shards
+
+--*/
+{
+    LockAllShards();
+    SweepNotes();
+    UnlockAllShards();
+}
+
+
+_Use_decl_annotations_
+void
+CEarningsMgr::FreeNotes(
+    PVOID Swept
+    )
+/*++
+
+Routine Description:
+
+    Frees the notes swept by SweepNotes, called by the epoch manager once
+    none of the readers can hold their ids
+
+Parameters:
+
+    Swept - The ids of the swept notes, deleted here
+
+--*/
+{
+    std::vector<UINT16>* pSwept = (std::vector<UINT16>*)Swept;
+
+    CEarningsData::NotesPool.Free(*pSwept);
+    delete pSwept;
+}
+
+
+_Use_decl_annotations_
+INT
+CEarningsMgr::GetSymbolHandle(
+    LPCSTR Ticker
+    )
+/*++
+
+Routine Description:
+
+    Returns the handle for the ticker symbol. The handle stays valid for
+    the life of the process, so the caller can look it up once per symbol
+    and use the ByHandle functions after that.
+
+Parameters:
+
+    Ticker - The ticker symbol
+
+Return Value:
+
+    The handle, SYMBOL_INVALID_HANDLE if the ticker is not valid
+
+--*/
+{
+    TICKER_KEY  key;
+
+    if (key.Set(Ticker) == false) { return SYMBOL_INVALID_HANDLE; }
+
+    return m_Symbols.Intern(key);
+}
+
+
+_Use_decl_annotations_
+CEarningsDataPtr_t
+CEarningsMgr::GetEarningsDataByHandle(
+    INT Handle
+    )
+/*++
+
+Routine Description:
+
+    Returns the earnings data for the handle. If the record bound to the
+    handle does not have to be queried it is returned without packing the
+    ticker or taking the shard lock. Otherwise the ticker goes through
+    GetEarningsData which binds the record to the handle.
+
+Parameters:
+
+    Handle - The handle from GetSymbolHandle
+
+Return Value:
+
+    Pointer to the earnings data if successful.
+    NULL if the handle is not valid or there was error retrieving data.
+
+--*/
+{
+    SYMBOL_ENTRY*       pEntry = m_Symbols.GetEntry(Handle);
+    CEarningsDataPtr_t  pData;
+
+    if (pEntry == NULL) { return NULL; }
+
+    pData = pEntry->Data;
+    if ((pData != NULL) && UseCachedRecord(pData))
+    {
+        IncrementCounter(CtrCacheHits);
+        return pData;
+    }
+
+    return GetEarningsData(pEntry->Key.Chars);
+}
+
+
+_Use_decl_annotations_
+bool
+CEarningsMgr::GetDaysToEarningsByHandle(
+    INT Handle,
+    INT& Days
+    )
+/*++
+
+Routine Description:
+
+    Returns the days to earnings for the handle from the columnar store.
+    The days are computed for all the symbols at the eastern day rollover
+    so this is an index into the days column.
+
+Parameters:
+
+    Handle - The handle from GetSymbolHandle
+
+    Days - Returns the days to the earnings release
+
+Return Value:
+
+    true - if the days were returned
+    false - if the columnar store is disabled or does not have the data
+
+--*/
+{
+    if (m_bColumnarStore == false) { return false; }
+
+    return m_Columns.GetDaysToEarnings(Handle, Days);
+}
+
+
+_Use_decl_annotations_
+bool
+CEarningsMgr::UseCachedRecord(
+    CEarningsDataPtr_t PtrEarningsData
+    )
+/*++
+
+Routine Description:
+
+    Returns true if the cached record is returned to the caller without
+    a query. The records marked for requery are queried. The records
+    without the earnings data stay in the negative cache for the time on
+    the ladder for their failures, so the symbols that never report do
+    not cost a query on every call and the newly listed ones are still
+    picked up. Called with or without the shard lock.
+
+Parameters:
+
+    PtrEarningsData - The cached record
+
+Return Value:
+
+    true - if the record is returned as is
+    false - if the symbol has to be queried
+
+--*/
+{
+    //
+    // During the market hours the refresh scheduler holds the queries of
+    // the symbols that have data, they are refreshed after the close
+    //
+    if ((m_bMarketOpen != FALSE) && (PtrEarningsData->GetQueryTime() != 0) &&
+        (PtrEarningsData->IsUnanswered() == false))
+    {
+        PtrEarningsData->Touch();
+        return true;
+    }
+
+    if (PtrEarningsData->IsReQuery()) { return false; }
+
+    PtrEarningsData->Touch();
+    if (PtrEarningsData->IsAvailable() || (PtrEarningsData->GetQueryTime() == 0)) { return true; }
+
+    if (PtrEarningsData->IsNegativeExpired((UINT32)_time32(NULL))) { return false; }
+
+    //
+    // Count the queries saved by the negative cache, per eastern day
+    //
+    LONG today = CEarningsData::FieldCache.GetToday();
+    LONG lastDay = InterlockedExchange(&m_nNegativeDay, today);
+
+    if (lastDay != today)
+    {
+        LONG saved = InterlockedExchange(&m_Counters[CtrNegativeHitsToday], 0);
+        if (lastDay != 0)
+        {
+            LogInfo("Queries saved by the negative cache on day %d = %d", lastDay, saved);
+        }
+    }
+
+    IncrementCounter(CtrNegativeHits);
+    IncrementCounter(CtrNegativeHitsToday);
+    return true;
+}
+
+
+void
+CEarningsMgr::EvictRecords(
+    void
+    )
+/*++
+
+Routine Description:
+
+    Evicts the cold records while the cache is over the capacity. The
+    clock hand goes over the symbol handles, a record used since the hand
+    last passed it gets a second chance. Only the records that are up to
+    date in the cache file are evicted, so they are read back from the
+    file instead of the website. The records changed since the last save
+    stay till the next save.
+
+    The shard of each record is locked on its own, so it is called
+    without any shard lock held. The evicted record goes back to the
+    slab once the readers are done with it.
+
+--*/
+{
+    if ((m_nCapacity == 0) || ((UINT32)m_nRecords <= m_nCapacity)) { return; }
+
+    //
+    // One thread evicts for all
+    //
+    if (m_EvictLock.TryLock() == false) { return; }
+
+    INT nHandles = m_Symbols.Count();
+
+    for (INT nScanned = 0; 
+        (nScanned < 2 * nHandles) && ((UINT32)m_nRecords > m_nCapacity);
+        nScanned++)
+    {
+        INT             handle = (m_nClockHand++ % nHandles) + 1;
+        SYMBOL_ENTRY*   pEntry = m_Symbols.GetEntry(handle);
+
+        if ((pEntry == NULL) || (pEntry->Data == NULL)) { continue; }
+
+        EARNINGS_SHARD& shard = GetShard(pEntry->Key);
+        CShardLock lock(shard);
+
+        CEarningsDataPtr_t pData = pEntry->Data;
+        if (pData == NULL) { continue; }
+
+        if (pData->ClearReferenced()) { continue; }
+
+        if (pData->IsPending() || 
+            (shard.InFlight.Find(pEntry->Key) != NULL) ||
+            (shard.OnDisk.Find(pEntry->Key) == NULL))
+        {
+            continue;
+        }
+
+        shard.Cache.Erase(pEntry->Key);
+        m_Symbols.Bind(handle, NULL);
+        m_Epochs.Retire(new RECORD_RELEASE(m_pRecords, pData));
+
+        InterlockedDecrement(&m_nRecords);
+        IncrementCounter(CtrEvictions);
+
+        LogTrace("Evicted %s", pEntry->Key.Chars);
+    }
+
+    m_nClockHand %= (nHandles > 0) ? nHandles : 1;
+    m_EvictLock.Unlock();
+}
+
+
+LONG
+CEarningsMgr::GetHitRatio(
+    void
+    )
+/*++
+
+Routine Description:
+
+    Returns the percentage of the lookups that found the record in memory
+
+--*/
+{
+    LONG hits = m_Counters[CtrCacheHits];
+    LONG lookups = hits + m_Counters[CtrCacheMisses] + m_Counters[CtrDiskRecoveries];
+
+    return (lookups > 0) ? (LONG)(((LONGLONG)hits * 100) / lookups) : 0;
+}
+
+
+PVOID
+CEarningsMgr::AllocateRecord(
+    void
+    )
+/*++
+
+Routine Description:
+
+    Returns the memory for a new record from the current slab. The caller
+    constructs the record in it. Called with the shard lock held.
+
+Return Value:
+
+    The memory for the record, NULL if the allocation failed
+
+--*/
+{
+    PVOID pRecord = m_pRecords->Allocate();
+
+    if (pRecord != NULL)
+    {
+        IncrementCounter(CtrRecordAllocations);
+        InterlockedExchange(&m_Counters[CtrSlabBlocks], m_pRecords->Blocks());
+    }
+
+    return pRecord;
+}
+
+
+_Use_decl_annotations_
+CEarningsDataPtr_t
+CEarningsMgr::InsertRecord(
+    const TICKER_KEY& Ticker,
+    const CEarningsData* Evicted
+    )
+/*++
+
+Routine Description:
+
+    Adds the record for the ticker to the cache and binds it to the symbol
+    handle. Called with the shard lock held.
+
+    The record read back from the cache file is checked for a requery and
+    added to the date index and the calendar, as on a load. With the lazy
+    load the indexes can still be built from the file, and they skip the
+    records that are not up to date in the file once the record changes.
+
+Parameters:
+
+    Ticker - The ticker symbol in upper case
+
+    Evicted - The record read back from the cache file, NULL for a new
+        empty record
+
+Return Value:
+
+    The cached record, NULL if the allocation failed
+
+--*/
+{
+    EARNINGS_SHARD& shard = GetShard(Ticker);
+
+    PVOID pRecord = AllocateRecord();
+    if (pRecord == NULL) { return NULL; }
+
+    CEarningsDataPtr_t pData = (Evicted != NULL) ? new (pRecord) CEarningsData(*Evicted) :
+                                                   new (pRecord) CEarningsData(Ticker);
+
+    if (shard.Cache.Insert(Ticker, pData) == false)
+    {
+        m_pRecords->Free(pData);
+        return NULL;
+    }
+
+    InterlockedIncrement(&m_nRecords);
+    BindRecord(m_Symbols.Intern(Ticker), pData);
+
+    if (Evicted != NULL)
+    {
+        CheckLoadedRecord(pData);
+        IndexRecord(Ticker, *pData);
+    }
+
+    return pData;
+}
+
+
+_Use_decl_annotations_
+void
+CEarningsMgr::BindRecord(
+    INT Handle,
+    CEarningsDataPtr_t PtrEarningsData
+    )
+/*++
+
+Routine Description:
+
+    Binds the cached record to the symbol handle and if the columnar store
+    is enabled, copies the fields of the record into the columns. Called
+    with the shard lock held whenever the record is added or updated.
+
+Parameters:
+
+    Handle - The symbol handle
+
+    PtrEarningsData - The cached record
+
+--*/
+{
+    m_Symbols.Bind(Handle, PtrEarningsData);
+
+    if (m_bColumnarStore == true)
+    {
+        m_Columns.Update(Handle,
+            PtrEarningsData->IsAvailable(),
+            PtrEarningsData->IsConfirmed(),
+            PtrEarningsData->GetEarningsTime(),
+            PtrEarningsData->GetQueryTime(),
+            PtrEarningsData->GetReleaseTime());
+    }
+}
+
+
+_Use_decl_annotations_
+void
+CEarningsMgr::IndexRecord(
+    const TICKER_KEY& Ticker,
+    const CEarningsData& Record
+    )
+/*++
+
+Routine Description:
+
+    Updates the date index and the calendar for the record. Both are
+    keyed by the ticker, so they keep the records that are evicted from
+    the memory.
+
+Parameters:
+
+    Ticker - The ticker symbol in upper case
+
+    Record - The loaded or queried record
+
+--*/
+{
+    UINT32 earningsDate = Record.IsAvailable() ? Record.GetEarningsTime() : 0;
+
+    m_DateIndex.Update(Ticker, earningsDate);
+    m_Calendar.Update(Ticker, earningsDate, Record.GetReleaseTime());
+
+    ScheduleRefresh(Ticker, Record);
+}
+
+
+_Use_decl_annotations_
+void
+CEarningsMgr::ScheduleRefresh(
+    const TICKER_KEY& Ticker,
+    const CEarningsData& Record
+    )
+/*++
+
+Routine Description:
+
+    Puts the ticker in the refresh schedule at the time its record is due
+    for a query, the same time the record would be marked for requery on
+    a load. The records marked for requery are due at once and the ones
+    without the earnings data are due at the end of their negative ttl.
+
+Parameters:
+
+    Ticker - The ticker symbol in upper case
+
+    Record - The loaded or queried record
+
+--*/
+{
+    UINT32 due = 0;
+
+    if ((m_bScheduledRefresh == false) || (Record.GetQueryTime() == 0)) { return; }
+
+    if (Record.IsReQuery() == true)
+    {
+        due = Record.GetQueryTime();
+    }
+    else if (Record.IsAvailable() == true)
+    {
+        due = m_RefreshPolicy.GetRefreshTime(Ticker, Record.IsConfirmed(), Record.GetQueryTime(),
+            Record.GetEarningsTime());
+    }
+    else
+    {
+        due = Record.GetRetryTime();
+    }
+
+    m_RefreshSchedule.Update(Ticker, due);
+}
+
+
+_Use_decl_annotations_
+INT
+CEarningsMgr::GetSymbolsReportingBetween(
+    INT FromDays,
+    INT ToDays,
+    LPSTR Buffer,
+    INT BufferSize
+    )
+/*++
+
+Routine Description:
+
+    Copies the tickers with the earnings release in the range of days
+    from the date index. The earnings dates are eastern midnight, so the
+    days are converted to the eastern midnight of the first day and of
+    the day after the last day.
+
+Parameters:
+
+    FromDays - The first day of the range, 0 is today
+
+    ToDays - The last day of the range
+
+    Buffer - Returns the tickers separated by commas
+
+    BufferSize - The size of the buffer including the terminating null
+
+Return Value:
+
+    The number of tickers copied
+
+--*/
+{
+    INT64   today = CEarningsData::FieldCache.GetToday();
+    INT64   from = (today + FromDays) * (24 * 60 * 60);
+    INT64   to = (today + ToDays + 1) * (24 * 60 * 60);
+
+    //
+    // The earnings dates are unsigned 32 bit times
+    //
+    if (from < 0) { from = 0; }
+    if (to > MAXUINT32) { to = MAXUINT32; }
+
+    if (from >= to)
+    {
+        Buffer[0] = '\0';
+        return 0;
+    }
+
+    if (m_bIndexesBuilt == FALSE) { BuildIndexes(); }
+
+    return m_DateIndex.GetRange((UINT32)from, (UINT32)to, Buffer, BufferSize);
+}
+
+
+_Use_decl_annotations_
+INT
+CEarningsMgr::GetEarningsCalendar(
+    INT Days,
+    EReleaseTime ReleaseTime,
+    LPSTR Buffer,
+    INT BufferSize
+    )
+/*++
+
+Routine Description:
+
+    Copies the tickers reporting on the day at the release time from the
+    bucket of the day in the calendar
+
+Parameters:
+
+    Days - The day from today, 0 is today
+
+    ReleaseTime - The time of the release on that day
+
+    Buffer - Returns the tickers separated by commas
+
+    BufferSize - The size of the buffer including the terminating null
+
+Return Value:
+
+    The number of tickers copied
+
+--*/
+{
+    INT64 day = (INT64)CEarningsData::FieldCache.GetToday() + Days;
+
+    if (m_bIndexesBuilt == FALSE) { BuildIndexes(); }
+
+    if (day < 0)
+    {
+        Buffer[0] = '\0';
+        return 0;
+    }
+
+    return m_Calendar.GetDay((UINT32)day, ReleaseTime, Buffer, BufferSize);
+}
+
+
+_Use_decl_annotations_
+void
+CEarningsMgr::CompleteFetch(
+    const TICKER_KEY& Ticker,
+    CEarningsData& Fetched,
+    bool Queried,
+    EFetchOutcome Outcome
+    )
+/*++
+
+Routine Description:
+
+    This function copies the result of the query into the cached record,
+    removes the ticker from the in flight queries and wakes up the callers
+    waiting on it. It is called with the shard lock held.
+
+Parameters:
+
+    Ticker - The ticker symbol in upper case
+
+    Fetched - The record filled up by the query
+
+    Queried - If the website responded to the query
+
+    Outcome - The result of the query. The rejected, throttled,
+        unavailable and unparsed ones are tried again after a short delay
+
+--*/
+{
+    EARNINGS_SHARD& shard = GetShard(Ticker);
+    UINT32          now = (UINT32)_time32(NULL);
+    bool            bTransient = (Outcome == FetchOutcomeRejected) ||
+                                 (Outcome == FetchOutcomeThrottled) ||
+                                 (Outcome == FetchOutcomeUnavailable) ||
+                                 (Outcome == FetchOutcomeParseFailed);
+
+    //
+    // The cache could have been reloaded while we were querying
+    //
+    CEarningsDataPtr_t* ppData = shard.Cache.Find(Ticker);
+    if (ppData != NULL)
+    {
+        CEarningsDataPtr_t pData = *ppData;
+
+        if (Queried == true)
+        {
+            m_RefreshPolicy.OnQueried(Ticker, Fetched.IsAvailable(),
+                pData->IsAvailable() ? pData->GetEarningsTime() : 0,
+                Fetched.GetEarningsTime(), Fetched.GetQueryTime());
+
+            pData->BeginWrite();
+            pData->UpdateFromQuery(Fetched);
+            pData->SetFailures(Fetched.IsAvailable() ? 0 : pData->GetFailures() + 1);
+            pData->EndWrite();
+
+            IndexRecord(Ticker, *pData);
+
+            //
+            // The line in the cache file is out of date till the next save
+            //
+            shard.OnDisk.Erase(Ticker);
+
+            BindRecord(m_Symbols.Intern(Ticker), pData);
+            m_bCacheDirty = true;
+        }
+        else if (pData->IsAvailable() == false)
+        {
+            //
+            // The symbol stays in the negative cache. A miss the website never
+            // answered is marked so it is not saved, its query date is the
+            // time of this query and the failure moves it up the ladder.
+            //
+            // The data source did not get to answer a transient failure, the
+            // symbol is queried again after the short delay instead
+            //
+            bool bAnswered = (pData->GetQueryTime() != 0) && (pData->IsUnanswered() == false);
+
+            pData->BeginWrite();
+            if (bAnswered == false)
+            {
+                pData->SetQueryDate(CFeedTime(FT_CURRENT));
+                pData->SetUnanswered(true);
+
+                if (bTransient == false) { pData->SetFailures(pData->GetFailures() + 1); }
+            }
+            pData->SetRetryTime(now + (bTransient ? FETCH_TRANSIENT_RETRY_DELAY :
+                CEarningsData::NegativeTtl(pData->GetFailures())));
+            pData->EndWrite();
+
+            ScheduleRefresh(Ticker, *pData);
+        }
+        else if (m_bScheduledRefresh == true)
+        {
+            //
+            // Try the refresh again later, the cached data is kept
+            //
+            m_RefreshSchedule.Update(Ticker,
+                now + (bTransient ? FETCH_TRANSIENT_RETRY_DELAY : REFRESH_RETRY_DELAY));
+        }
+
+        pData->SetPending(false);
+    }
+
+    LONG* pWaiters = shard.InFlight.Find(Ticker);
+    if (pWaiters != NULL)
+    {
+        LogTrace("Query completed for %s, waiters = %d", Ticker.Chars, *pWaiters);
+        shard.InFlight.Erase(Ticker);
+    }
+
+    shard.FetchDone.WakeAll();
+}
+
+
+_Use_decl_annotations_
+INT
+CEarningsMgr::SimulateRefreshPolicy(
+    ERefreshPolicy Policy,
+    INT Days
+    )
+/*++
+
+Routine Description:
+
+    This function replays the records of the cache file for the days
+    from now under the policy and counts the queries it would send. Each
+    record is queried whenever the policy says it is due. The date moves
+    to the next quarter once it is past and is confirmed the days before
+    it, see SIMULATION_QUARTER_DAYS. The records without the earnings
+    data are queried on the negative cache ladder whatever the policy,
+    they are not counted.
+
+    The intervals are the ones of the running policy. The cache file is
+    read without the shard locks, it is meant for the test tools and not
+    to be run while the cache is saved.
+
+Parameters:
+
+    Policy - The policy to simulate
+
+    Days - The number of days to simulate, e.g. 91 for a quarter
+
+Return Value:
+
+    The number of queries, -1 if the cache file cannot be read
+
+--*/
+{
+    using namespace std;
+    CHAR            szLine[1024];
+    CRefreshPolicy  policy;
+    INT             lineCtr = 0;
+    INT             nRecords = 0;
+    INT             nQueries = 0;
+    UINT32          start = (UINT32)_time32(NULL);
+    UINT32          end = start + (UINT32)Days * TIME_IN_SECS(24, 0, 0);
+
+    EnterFunc();
+
+    policy.SetPolicy(Policy, m_RefreshPolicy.GetIntervals());
+
+    fstream inFile(m_sCacheFile.c_str(), ios::in);
+    if (inFile.fail())
+    {
+        LogError("Unable to open the file : %s", m_sCacheFile.c_str());
+        nQueries = -1;
+        goto Cleanup;
+    }
+
+    while (true)
+    {
+        TICKER_KEY      key;
+        CEarningsData   loaded;
+
+        inFile.getline(szLine, _countof(szLine));
+        if (inFile.fail()) { break; }
 
         //
-        // Check if the line we read represents a valid entry
-        //
-        bIsAvailable = atoi(szValue[E_AVAILABLE]) == 0 ? false : true;
+        // Skip the headers and the blank lines
+        //
+        if ((++lineCtr <= 2) || (strlen(szLine) == 0)) { continue; }
+
+        if (ParseEarningsLine(szLine, m_nCacheColumns, key, loaded) == false) { continue; }
+        if (loaded.IsAvailable() == false) { continue; }
+
+        bool    confirmed = loaded.IsConfirmed();
+        UINT32  queryDate = loaded.GetQueryTime();
+        UINT32  earningsDate = loaded.GetEarningsTime();
+        UINT32  now = start;
+
+        nRecords++;
+
+        while (true)
+        {
+            UINT32 due = policy.GetRefreshTime(key, confirmed, queryDate, earningsDate);
+
+            if (due < now) { due = now; }
+            if (due >= end) { break; }
+
+            now = due;
+            nQueries++;
+
+            while (earningsDate + TIME_IN_SECS(24, 0, 0) <= now)
+            {
+                earningsDate += SIMULATION_QUARTER_DAYS * TIME_IN_SECS(24, 0, 0);
+                confirmed = false;
+            }
+
+            confirmed = confirmed ||
+                (earningsDate <= now + SIMULATION_CONFIRM_DAYS * TIME_IN_SECS(24, 0, 0));
+            queryDate = now;
+        }
+    }
+
+    LogInfo("Refresh policy %s: records = %d, queries = %d in %d days",
+        CRefreshPolicy::PolicyName(Policy), nRecords, nQueries, Days);
+
+Cleanup:
+
+    LeaveFunc();
+    return nQueries;
+}
+
+
+_Use_decl_annotations_
+LONG
+CEarningsMgr::GetCounter(
+    LPCSTR CounterName
+    )
+/*++
+
+Routine Description:
+
+    Returns the value of the counter by name
+
+Parameters:
+
+    CounterName - The name of the counter, case insensitive
+
+Return Value:
+
+    The value of the counter, -1 if the name is not known
+
+--*/
+{
+    for (int nCtr = 0; nCtr < _countof(StrCounters); nCtr++)
+    {
+        if (_stricmp(CounterName, StrCounters[nCtr]) == 0)
+        {
+            return m_Counters[nCtr];
+        }
+    }
+
+    if (_stricmp(CounterName, CACHE_HIT_RATIO) == 0)
+    {
+        return GetHitRatio();
+    }
+
+    if (_stricmp(CounterName, FETCH_LIMIT) == 0)
+    {
+        return m_InFlight.IsLimited() ? m_InFlight.GetLimit() : 0;
+    }
+
+    if (_stricmp(CounterName, BREAKER_STATE) == 0)
+    {
+        return m_Breaker.GetState();
+    }
+
+    if (_stricmp(CounterName, BREAKER_TRIPS) == 0)
+    {
+        return m_Breaker.GetTrips();
+    }
+
+    //
+    // The shard counters are named ShardContention:N and ShardAcquisitions:N,
+    // without the shard number the total of all the shards is returned
+    //
+    bool bContention = (_strnicmp(CounterName, SHARD_CONTENTION, strlen(SHARD_CONTENTION)) == 0);
+    bool bAcquisitions = (_strnicmp(CounterName, SHARD_ACQUISITIONS, strlen(SHARD_ACQUISITIONS)) == 0);
+
+    if (bContention || bAcquisitions)
+    {
+        LPCSTR  szShard = strchr(CounterName, ':');
+        LONG    total = 0;
+
+        for (UINT32 nShard = 0; nShard < m_nShards; nShard++)
+        {
+            if ((szShard != NULL) && ((UINT32)atoi(szShard + 1) != nShard)) { continue; }
+
+            total += bContention ? m_pShards[nShard].Contentions : m_pShards[nShard].Acquisitions;
+        }
+
+        if ((szShard != NULL) && ((UINT32)atoi(szShard + 1) >= m_nShards)) { return -1; }
+
+        return total;
+    }
+
+    //
+    // Without the priority the depth is the total of the queue
+    //
+    if (_strnicmp(CounterName, FETCH_QUEUE_DEPTH, strlen(FETCH_QUEUE_DEPTH)) == 0)
+    {
+        LPCSTR  szPriority = strchr(CounterName, ':');
+        INT     nPriority = (szPriority != NULL) ? atoi(szPriority + 1) : -1;
+
+        if (szPriority == NULL) { return (LONG)m_FetchQueue.Size(); }
+        if ((nPriority < 0) || (nPriority >= FetchPriorityCount)) { return -1; }
+
+        return m_FetchQueue.GetDepth(nPriority);
+    }
+
+    if (_strnicmp(CounterName, FETCH_WAIT, strlen(FETCH_WAIT)) == 0)
+    {
+        INT nPriority = -1;
+        INT nBucket = -1;
+
+        if ((sscanf_s(CounterName + strlen(FETCH_WAIT), ":%d:%d", &nPriority, &nBucket) != 2) ||
+            (nPriority < 0) || (nPriority >= FetchPriorityCount) ||
+            (nBucket < 0) || (nBucket >= FETCH_WAIT_BUCKETS))
+        {
+            return -1;
+        }
+
+        return m_FetchQueue.GetWaits(nPriority, nBucket);
+    }
+
+    return -1;
+}
+
+
+_Use_decl_annotations_
+INT
+CEarningsMgr::GetDiagnostics(
+    LPSTR Buffer,
+    INT BufferSize
+    )
+/*++
+
+Routine Description:
+
+    Formats the state of the circuit breaker, of the limit of the queries
+    in flight and of the fetch queue as Name=Value pairs separated by ';'
+
+Parameters:
+
+    Buffer - Receives the text, truncated to the buffer
+
+    BufferSize - The size of the buffer in characters
+
+Return Value:
+
+    The number of characters written, -1 if the text was truncated
+
+--*/
+{
+    INT nWritten = m_Breaker.Format(Buffer, BufferSize);
+
+    if (nWritten < 0) { return -1; }
+
+    INT nCount = _snprintf_s(Buffer + nWritten, BufferSize - nWritten, _TRUNCATE,
+        ";%s=%d;LatencyMs=%d;Throttled=%d;Retries=%d;%s=%d;MarketOpen=%d",
+        FETCH_LIMIT, m_InFlight.IsLimited() ? m_InFlight.GetLimit() : 0, m_InFlight.GetLatency(),
+        m_Counters[CtrThrottled], m_Counters[CtrRetries],
+        FETCH_QUEUE_DEPTH, (LONG)m_FetchQueue.Size(), m_bMarketOpen);
+
+    return (nCount < 0) ? -1 : nWritten + nCount;
+}
+
+
+void
+CEarningsMgr::LogCounters(
+    void
+    )
+/*++
+
+Routine Description:
+
+    Logs the value of all the counters
+
+--*/
+{
+    for (int nCtr = 0; nCtr < _countof(StrCounters); nCtr++)
+    {
+        LogInfo("%s = %d", StrCounters[nCtr], m_Counters[nCtr]);
+    }
+
+    LogInfo("Fields formatted = %d", CEarningsData::FieldCache.Formatted());
+    LogInfo("%s = %d%%, records in memory = %d", CACHE_HIT_RATIO, GetHitRatio(), m_nRecords);
+    LogInfo("Refresh schedule = %d tickers, due = %d", m_RefreshSchedule.Size(),
+        m_RefreshSchedule.GetDueCount((UINT32)_time32(NULL)));
+    LogInfo("%s = %d, decreases = %d, latency = %d ms", FETCH_LIMIT, m_InFlight.GetLimit(),
+        m_InFlight.GetDecreases(), m_InFlight.GetLatency());
+    LogInfo("Circuit breaker = %s, trips = %d, rejected = %d",
+        CCircuitBreaker::StateName(m_Breaker.GetState()), m_Breaker.GetTrips(), m_Breaker.GetRejected());
+    LogInfo("Refresh policy = %s, dates moved = %d",
+        CRefreshPolicy::PolicyName(m_RefreshPolicy.GetPolicy()), m_RefreshPolicy.GetChangedCount());
+
+    for (UINT32 nShard = 0; nShard < m_nShards; nShard++)
+    {
+        LogInfo("%s:%d = %d, %s:%d = %d", 
+            SHARD_ACQUISITIONS, nShard, m_pShards[nShard].Acquisitions,
+            SHARD_CONTENTION, nShard, m_pShards[nShard].Contentions);
+    }
+
+    for (INT nPriority = 0; nPriority < FetchPriorityCount; nPriority++)
+    {
+        CHAR    szWaits[256];
+        INT     nUsed = 0;
+
+        szWaits[0] = '\0';
+        for (INT nBucket = 0; nBucket < FETCH_WAIT_BUCKETS; nBucket++)
+        {
+            INT nLength = _snprintf_s(szWaits + nUsed, _countof(szWaits) - nUsed, _TRUNCATE,
+                " <%ums:%d", CFetchQueue::WaitLimit(nBucket), m_FetchQueue.GetWaits(nPriority, nBucket));
+            if (nLength < 0) { break; }
+
+            nUsed += nLength;
+        }
+
+        LogInfo("%s:%d = %d, %s:%d =%s", FETCH_QUEUE_DEPTH, nPriority, m_FetchQueue.GetDepth(nPriority),
+            FETCH_WAIT, nPriority, szWaits);
+    }
+}
+
+
+_Use_decl_annotations_
+void
+CEarningsMgr::QueueFetch(
+    const TICKER_KEY& Ticker,
+    EFetchKind Kind,
+    const CEarningsData* Record,
+    bool Requested
+    )
+/*++
+
+Routine Description:
+
+    This function adds the ticker to the fetch queue and wakes up one of
+    the fetch threads. The tickers with the earnings date close by are
+    queried first, see CFetchQueue::Score.
+
+Parameters:
+
+    Ticker - The ticker symbol in upper case
+
+    Kind - Why the ticker is queried
+
+    Record - The cached record, NULL if there is none
+
+    Requested - If a caller asked for the ticker
+
+--*/
+{
+    FETCH_REQUEST request;
+
+    request.Ticker = Ticker;
+    request.Kind = Kind;
+    request.DaysToEarnings = FETCH_DAYS_UNKNOWN;
+    request.Confirmed = false;
+    request.Requested = Requested;
+
+    if ((Record != NULL) && (Record->IsAvailable() == true))
+    {
+        request.DaysToEarnings = CEarningsData::FieldCache.GetDaysTo(Record->GetEarningsTime());
+        request.Confirmed = Record->IsConfirmed();
+    }
+
+    //
+    // A ticker already in the queue only moves up, the thread is woken once
+    //
+    if (m_FetchQueue.Push(request) == true)
+    {
+        ReleaseSemaphore(m_hFetchSemaphore, 1, NULL);
+    }
+}
+
+
+DWORD
+CEarningsMgr::PrefetchWatchlist(
+    void
+    )
+/*++
+
+Routine Description:
+
+    This function is the body of the prefetch thread. It reads the watch
+    list file and queues the tickers that are not in the cache. The blank
+    lines and the lines starting with # are skipped. The thread exits with
+    the fetch threads.
+
+--*/
+{
+    using namespace std;
+    CHAR    szLine[256];
+    INT     nTickers = 0;
+    INT     nQueued = 0;
+
+    LogInfo("Prefetching the watch list : %s", m_sWatchlistFile.c_str());
+
+    fstream inFile(m_sWatchlistFile.c_str(), ios::in);
+    if (inFile.fail())
+    {
+        LogError("Unable to open the file : %s", m_sWatchlistFile.c_str());
+        return 0;
+    }
+
+    while (WaitForSingleObject(m_hFetchExitEvent, 0) == WAIT_TIMEOUT)
+    {
+        TICKER_KEY key;
+
+        inFile.getline(szLine, _countof(szLine));
+        if (inFile.fail()) { break; }
+
+        StrTrimA(szLine, " \t\r\n");
+        if ((szLine[0] == '\0') || (szLine[0] == '#')) { continue; }
 
-        if (ftQuery.FromStringStd(szValue[E_QUERYDATE]) == false)
+        nTickers++;
+        if (key.Set(szLine) == false)
         {
-            LogError("Unable to parse the query date");
+            LogError("Invalid ticker symbol: %s", szLine);
             continue;
         }
 
-        if ((bIsAvailable == true) && 
-            (ftEarnings.FromStringStd(szValue[E_EARNINGDATE]) == false))
-        {
-            LogError("Unable to parse the earnings date");
-            continue;
-        }
+        if (PrefetchTicker(key, FetchPrefetch) == true) { nQueued++; }
+    }
 
-        //
-        // Convert the symbol to uppercase
-        //
-        CHAR szSymbol[64];
-        strcpy_s(szSymbol, szValue[E_TICKER]);
-        _strupr_s(szSymbol);
+    LogInfo("Watch list prefetched, tickers = %d, queued = %d", nTickers, nQueued);
 
-        //
-        // If all fields were successfully read then allocate an entry and add it to the cache
-        //
-        CEarningsDataPtr_t pData = new CEarningsData(szSymbol, bIsAvailable, 
-            ftQuery.GetUtcTime(), ftEarnings.GetUtcTime(), szValue[E_EARNINGTIME], 
-            atoi(szValue[E_EARNINGCONFIRMED]) == 0 ? false : true, 
-            szValue[E_EARNINGNOTES]);
-        if (pData == NULL)
-        {
-            //
-            // allocation failed, continue with next iteration and see if that succeeds
-            //
-            LogError("Allocation failed for %s", pData->StrTicker.c_str());
-            continue;
-        }
+    return 0;
+}
 
-        auto inserted = m_EarningsCache.insert(
-            EARNINGS_MAP::value_type(pData->StrTicker, pData));
-            
-        _ASSERT(inserted.second == true);
-        if (inserted.second == false)
-        {
-            //
-            // insertion failed, continue with next iteration and see if that succeeds
-            //
-            LogError("Insertion failed for %s", pData->StrTicker.c_str());
-            delete pData;
-            continue;
-        }
 
-        LogTrace("Loaded earnings for %s", pData->StrTicker.c_str());
+_Use_decl_annotations_
+INT
+CEarningsMgr::PrefetchEarnings(
+    LPCSTR* Tickers,
+    INT Count
+    )
+/*++
+
+Routine Description:
 
-        //
-        // For available data, check if we have to trigger a query again
-        // to the server
-        //
-        pData->ReQuery = gResetData;
-        if (pData->ReQuery == false)
-        {
-            pData->CheckForRequery(lineCtr, EarningsQueryDays,
-                PostEarningsDays, EarningsRandDays);
-        }
+    This function queues the tickers that are not in the cache or are due
+    for a query on the fetch threads at the prefetch priority. It does
+    not wait for the queries.
+
+Parameters:
+
+    Tickers - The ticker symbols
+
+    Count - The number of tickers
+
+Return Value:
+
+    The number of tickers queued
+
+--*/
+{
+    INT nQueued = 0;
+
+    if (m_bAsyncQuery == false)
+    {
+        LogWarn("The fetch threads are not running, nothing is prefetched");
+        return 0;
     }
 
-    m_bCacheDirty = false;
-    bRet = true;
+    for (INT nCtr = 0; nCtr < Count; nCtr++)
+    {
+        TICKER_KEY key;
 
-Cleanup:
+        if ((Tickers[nCtr] == NULL) || (key.Set(Tickers[nCtr]) == false)) { continue; }
 
-    inFile.close();
-    
-    LeaveFunc();
-    return bRet;
+        if (PrefetchTicker(key, FetchPrefetch) == true) { nQueued++; }
+    }
+
+    return nQueued;
 }
 
 
 _Use_decl_annotations_
 bool
-CEarningsMgr::SaveEarningsData(
-    LPCSTR FileName
+CEarningsMgr::PrefetchTicker(
+    const TICKER_KEY& Ticker,
+    EFetchKind Kind
     )
 /*++
 
 Routine Description:
 
-    This function saves the earnings data from the memory cache into 
-    the file for later sessions. It opens the file and writes
-    the header information and other earnings data.
+    This function puts the record of the ticker in the cache as pending
+    and queues the ticker, unless it is cached and up to date or is being
+    queried already. The evicted records are read back from the cache
+    file and are only queued if they are due for a query.
+
+    The refresh scheduler queues the tickers it finds due in its schedule
+    as refreshes, they are queued whatever the state of the record.
 
 Parameters:
 
-    FileName - The name of the file to which the data will be saved
+    Ticker - The ticker symbol in upper case
+
+    Kind - FetchPrefetch or FetchRefresh
 
 Return Value:
 
-    true - if file load was successful
-    false - if anything went wrong
+    true - if the ticker was queued
+    false - if the ticker does not have to be queried
 
 --*/
 {
-    using namespace std;
-
-    //
-    // Use the lock function wide
-    //
-    CAutoLock al(m_EarningsCacheLock);
+    CEarningsDataPtr_t  pData = NULL;
+    CEarningsDataPtr_t* ppData = NULL;
+    bool                bQuery = true;
 
-    //
-    // If no modification then we have nothing to write
-    //
-    if (m_bCacheDirty == false)
-    {
-        LogTrace("Cache is not dirty. Nothing to write.");
-        return true;
-    }
+    EvictRecords();
 
-    LogInfo("Saving data to file : %s", FileName);
+    EARNINGS_SHARD& shard = GetShard(Ticker);
+    CShardLock lock(shard);
 
-    //
-    // Open the output file in write mode
-    //
-    fstream    outFile(FileName, ios::out | ios::trunc);
+    if (shard.InFlight.Find(Ticker) != NULL) { return false; }
 
-    if (outFile.fail())
+    ppData = shard.Cache.Find(Ticker);
+    if (ppData != NULL)
     {
-        LogError("Unable to open the file : %s", FileName);
-        return false;
+        pData = *ppData;
+        bQuery = (Kind == FetchRefresh) || IsQueryDue(pData);
     }
+    else
+    {
+        UINT32*         pOffset = shard.OnDisk.Find(Ticker);
+        CEarningsData   evicted;
+        bool            bRecovered = (pOffset != NULL) && ReadEarningsLine(Ticker, *pOffset, evicted);
 
-    //
-    // Write the file header(s)
-    //
-    outFile.write(EARNINGS_DATAFILE_HDR, strlen(EARNINGS_DATAFILE_HDR));
-    outFile.write(EARNINGS_DATAFILE_ROW, strlen(EARNINGS_DATAFILE_ROW));
-
+        pData = InsertRecord(Ticker, bRecovered ? &evicted : NULL);
+        if (pData == NULL) { return false; }
 
-    //
-    // We write both valid and invalid entries to the file. Both valid and invalid
-    // entries are queries every N days to make sure we have new data
-    //
-    for (EARNINGS_MAP::iterator itEarn = m_EarningsCache.begin();
-        itEarn != m_EarningsCache.end(); itEarn++)
-    {
-        CHAR    szLine[1024];
-        UINT    dwLen = itEarn->second->ToString(szLine);
-        
-        outFile.write(szLine, dwLen);
+        if (bRecovered == true)
+        {
+            IncrementCounter(CtrDiskRecoveries);
+            bQuery = (Kind == FetchRefresh) || IsQueryDue(pData);
+        }
     }
 
+    if (bQuery == false) { return false; }
 
-    //
-    // Close the file and reset the cache flag
-    //
-    outFile.flush();
-    outFile.close();
-
-    m_bCacheDirty = false;
-    LogTrace("FileSaved");
+    pData->SetReQuery(false);
+    pData->SetPending(true);
+    shard.InFlight[Ticker] = 0;
+    QueueFetch(Ticker, Kind, pData, false);
 
+    IncrementCounter((Kind == FetchRefresh) ? CtrRefreshesScheduled : CtrPrefetches);
     return true;
 }
 
 
-_Use_decl_annotations_
-CEarningsDataPtr_t
-CEarningsMgr::GetEarningsData(
-    LPCSTR Ticker
+DWORD
+CEarningsMgr::RefreshScheduler(
+    void
     )
 /*++
 
 Routine Description:
 
-    This function returns the earnings data for the Ticker symbol
-    passed to the function. It first checks to see if the data is
-    in the cache and if not found then queries website for
-    data and puts it in the cache for future use
-
-Parameters:
-
-    Ticker - The ticker symbol
+    This function is the body of the refresh scheduler. Every period it
+    checks if the market is open and publishes it for the callers. During
+    the regular hours nothing is queued, the callers are answered from
+    the cache. Outside of them the tickers that are due are taken from
+    the front of the schedule and queued as refreshes, keeping no more
+    than a batch in the fetch queue so the callers are not stuck behind
+    the bulk refresh and the refreshes stop as soon as the market opens.
 
-Return Value:
+    The due times are spread by the ticker hash, see ScheduleRefresh, so
+    the records loaded together do not all come due on the same night.
 
-    Pointer to the earnings data if successful.
-    NULL if there was error retrieving data.
+    The tickers that came due while the market was open are counted as
+    deferred when it closes, once per ticker.
 
 --*/
 {
-    CHAR            strSymbol[128];
-    CEarningsDataPtr_t  pData = NULL;
+    INT     nQueued = 0;
+    INT     nDueAtOpen = 0;
 
-    //
-    // Convert ticker to upper case
-    //
-    strcpy_s(strSymbol, Ticker);
-    _strupr_s(strSymbol);
-    String strTicker(strSymbol);
+    LogInfo("Entered refresh scheduler, tickers scheduled = %d", m_RefreshSchedule.Size());
 
     //
-    // Only one query active at any time
+    // After a lazy load the schedule is filled with the date index
     //
-    CAutoLock lock(m_EarningsCacheLock);
+    if (m_bIndexesBuilt == FALSE) { BuildIndexes(); }
 
-    //
-    // Check to see if symbol is in cache
-    //
-    EARNINGS_MAP::iterator earnIt = m_EarningsCache.find(strTicker);
-    if (earnIt == m_EarningsCache.end())
+    do
     {
-        LogWarn("Symbol not in cache : %s", strSymbol);
+        CFeedTime   now(FT_CURRENT);
+        bool        bOpen = (now.IsNyseClosed() == false) && now.IsNyseRegularHours(NULL);
 
-        pData = new CEarningsData(strSymbol);
-        if (pData != NULL)
+        if (InterlockedExchange(&m_bMarketOpen, bOpen ? TRUE : FALSE) != (bOpen ? TRUE : FALSE))
         {
-            auto inserted = m_EarningsCache.insert(
-                EARNINGS_MAP::value_type(strTicker, pData));
-            
-            _ASSERT(inserted.second == true);
-            if (inserted.second == false)
+            INT nDue = m_RefreshSchedule.GetDueCount(now.GetUtcTime());
+
+            if (bOpen == true)
             {
-                delete pData;
-                pData = NULL;
+                nDueAtOpen = nDue;
             }
-            else
+            else if (nDue > nDueAtOpen)
             {
-                QueryEarningsFromWebsite(pData);
-                m_bCacheDirty = true;
+                InterlockedExchangeAdd(&m_Counters[CtrRefreshesDeferred], nDue - nDueAtOpen);
             }
+
+            LogInfo("Market %s, refreshes queued = %d, due = %d", bOpen ? "open" : "closed",
+                nQueued, nDue);
+            nQueued = 0;
+        }
+
+        if (bOpen == true) { continue; }
+
+        while (m_FetchQueue.Size() < REFRESH_BATCH_SIZE)
+        {
+            TICKER_KEY key;
+
+            if (m_RefreshSchedule.PopDue(now.GetUtcTime(), key) == false) { break; }
+
+            if (PrefetchTicker(key, FetchRefresh) == true) { nQueued++; }
+        }
+
+    } while (WaitForSingleObject(m_hFetchExitEvent, REFRESH_SCHEDULER_PERIOD) == WAIT_TIMEOUT);
+
+    LogInfo("Exited refresh scheduler");
+
+    return 0;
+}
+
+
+DWORD
+CEarningsMgr::FetchWorker(
+    void
+    )
+/*++
+
+Routine Description:
+
+    This function is the body of the fetch threads. Each thread takes one
+    ticker from the fetch queue for every count of the semaphore and
+    queries the website without holding the shard lock, so the callers
+    are never blocked behind the network. The result is copied into the
+    cached record once the query completes.
+
+    Every thread has its own connection to the data source so the
+    threads query in parallel, up to the limits of the queries in flight
+    and of the rate.
+
+    A query the data source throttled or did not answer is sent again
+    after a jittered delay that doubles on every retry, so the threads
+    that failed together do not retry together. The retries stop once
+    the circuit breaker opens or the manager shuts down.
+
+--*/
+{
+    HANDLE  hEvents[] = { m_hFetchExitEvent, m_hFetchSemaphore };
+    CHttp   site;
+    bool    bSite = false;
+
+    LogInfo("Entered fetch thread");
+
+    srand(GetCurrentThreadId() ^ GetTickCount());
+
+    if (m_bConnected == true)
+    {
+        bSite = site.InitializeA(USER_AGENT_STRING, m_sDataSource.c_str(), m_nDataSourcePort);
+        if (bSite == false)
+        {
+            LogWarn("Fetch thread uses the shared connection");
         }
     }
-    else
+
+    while (WaitForMultipleObjects(_countof(hEvents), hEvents, FALSE, INFINITE) == 
+        WAIT_OBJECT_0 + 1)
     {
+        TICKER_KEY  key;
+
+        if (m_FetchQueue.Pop(key) == false) { continue; }
+
         //
-        // Found in cache. Check if we have to requery the symbol
+        // Query into a temporary record, the cache is not locked
         //
-        LogInfo("Symbol found in cache: %s", strSymbol);
+        CEarningsData   fetched(key);
+        EFetchOutcome   outcome = FetchOutcomeFailed;
+        bool            bQueried = false;
 
-        pData = earnIt->second;
-
-        if (pData->ReQuery)
+        for (UINT32 nRetry = 0; ; nRetry++)
         {
-            LogInfo("Symbol set for query: %s", pData->StrTicker.c_str());
+            if (bSite == true)
+            {
+                bQueried = QueryEarningsFromWebsite(site, &fetched, outcome);
+            }
+            else
+            {
+                bQueried = QueryEarningsFromWebsite(m_EarningsSite, &fetched, outcome,
+                    &m_EarningsSiteLock);
+            }
 
-            QueryEarningsFromWebsite(pData);
-            pData->ReQuery = false;
-            m_bCacheDirty = true;
+            if ((bQueried == true) || (nRetry >= FETCH_MAX_RETRIES) ||
+                ((outcome != FetchOutcomeThrottled) && (outcome != FetchOutcomeUnavailable)))
+            {
+                break;
+            }
+
+            DWORD dwDelay = RetryDelay(nRetry);
+
+            LogInfo("Retrying %s in %d ms, retry %d", key.Chars, dwDelay, nRetry + 1);
+            if (WaitForSingleObject(m_hFetchExitEvent, dwDelay) != WAIT_TIMEOUT) { break; }
+
+            IncrementCounter(CtrRetries);
         }
+
+        CShardLock lock(GetShard(key));
+        CompleteFetch(key, fetched, bQueried, outcome);
     }
 
-    return pData;
+    site.Uninitialize();
+
+    LogInfo("Exited fetch thread");
+
+    return 0;
 }
 
 
@@ -794,7 +3608,7 @@ Return Value:
     if (tableLoc == String::npos)
     {
         LogTrace("datebox tag not found.");
-        PtrEarningsData->IsAvailable = false;
+        PtrEarningsData->SetAvailable(false);
         goto Cleanup;
     }
 
@@ -810,7 +3624,7 @@ Return Value:
     
     if (szTemp.find("color-yes") != String::npos)
     {
-        PtrEarningsData->IsConfirmed = true;
+        PtrEarningsData->SetConfirmed(true);
     }
 
     //
@@ -825,7 +3639,8 @@ Return Value:
     // Get the time
     //
     CHK_RET(ExtractTag("div", HtmlPage, tableLoc, szTemp));
-    CHK_RET(ExtractValue(szTemp, PtrEarningsData->StrEarningsTime));
+    CHK_RET(ExtractValue(szTemp, szTemp));
+    PtrEarningsData->SetReleaseTime(CEarningsColumns::ClassifyReleaseTime(szTemp.c_str()));
 
     retVal = true;
 
@@ -837,9 +3652,10 @@ Cleanup:
 
 
 _Use_decl_annotations_
-void 
+bool 
 CEarningsMgr::QueryEarningsFromWebsite(
-    CEarningsDataPtr_t PtrEarningsData
+    CEarningsDataPtr_t PtrEarningsData,
+    EFetchOutcome& Outcome
     )
 /*++
 
@@ -850,17 +3666,77 @@ Routine Description:
 
 Parameters:
 
-    Ticker - The ticker symbol
+    PtrEarningsData - The record to fill up with the earnings data
+
+    Outcome - Receives the result of the query
 
 Return Value:
 
-    Pointer to the earnings data if successful.
-    NULL if there was error retrieving data.
+    true - if the website responded and the record was updated
+    false - if there was error retrieving data
+
+--*/
+{
+    //
+    // The http connection is shared between the callers
+    //
+    return QueryEarningsFromWebsite(m_EarningsSite, PtrEarningsData, Outcome, &m_EarningsSiteLock);
+}
+
+
+_Use_decl_annotations_
+bool 
+CEarningsMgr::QueryEarningsFromWebsite(
+    CHttp& Site,
+    CEarningsDataPtr_t PtrEarningsData,
+    EFetchOutcome& Outcome,
+    CLock* SiteLock
+    )
+/*++
+
+Routine Description:
+
+    Same as above, on the connection. The query waits for its turn in the
+    rate limit and then for a slot of the queries in flight, so a slot is
+    only held by a query that is about to be sent.
+
+    The result of the query adjusts the limit of the queries in flight.
+    A 429 or 503 is the data source throttling, a page with the date box
+    that does not parse is likely a partial or an error page, and the
+    latency from the send to the response tells if the data source is
+    keeping up.
+
+    While the circuit breaker is open the query is not sent at all, the
+    data source did not answer the last queries. The breaker is asked
+    after the slot and the rate limit token are taken, right before the
+    send. No answer, a 5xx or a 429 counts as a failure, any other answer
+    closes the breaker.
+
+Parameters:
+
+    Site - The connection to the data source, used by one thread at a time
+
+    PtrEarningsData - The record to fill up with the earnings data
+
+    Outcome - Receives the result of the query, the caller retries the
+        throttled and the unavailable ones
+
+    SiteLock - The lock of the connection if it is shared, held from the
+        send to the end of the response
 
 --*/
 {
-    String      httpString;
-    CHAR        chBuffer[1024];
+    String          httpString;
+    CHAR            chBuffer[1024];
+    bool            retVal = false;
+    bool            bInFlight = false;
+    bool            bAllowed = false;
+    bool            bSiteLocked = false;
+    bool            bReceived = false;
+    DWORD           dwStatusCode = 0;
+    DWORD           dwStart = 0;
+    DWORD           dwLatency = 0;
+    EFetchOutcome   outcome = FetchOutcomeFailed;
 
     EnterFunc();
 
@@ -869,27 +3745,87 @@ Return Value:
     //
     CHK_EXP(m_bConnected == false);
 
-    LogInfo("Query from website: %s", PtrEarningsData->StrTicker.c_str());
+    {
+        DWORD dwWait = m_RateLimit.Reserve();
+        if (dwWait != 0)
+        {
+            IncrementCounter(CtrRateLimited);
+            Sleep(dwWait);
+        }
+    }
+
+    //
+    // The manager is shutting down
+    //
+    CHK_EXP(m_InFlight.Acquire() == false);
+    bInFlight = true;
+
+    //
+    // The breaker is asked last, a half open breaker lets the probe through
+    // only when the probe is sent right away
+    //
+    if (m_Breaker.Allow() == false)
+    {
+        LogTrace("Circuit breaker open, not querying %s", PtrEarningsData->GetTicker());
+        outcome = FetchOutcomeRejected;
+        goto Cleanup;
+    }
+    bAllowed = true;
+
+    LogInfo("Query from website: %s", PtrEarningsData->GetTicker());
+    IncrementCounter(CtrFetches);
 
     //
     // Create the search query for the ticker and send the request
     //
-    sprintf_s(chBuffer, WEBSITE_EARNING_URL, PtrEarningsData->StrTicker.c_str());
+    sprintf_s(chBuffer, WEBSITE_EARNING_URL, PtrEarningsData->GetTicker());
+
+    LogInfo("Query URL = http://%s/%s", m_sDataSource.c_str(), chBuffer);
+
+    if (SiteLock != NULL)
+    {
+        SiteLock->Lock();
+        bSiteLocked = true;
+    }
 
-    LogInfo("Query URL = http://" WWW_DATASOURCE "/%s", chBuffer);
+    dwStart = GetTickCount();
 
-    if (m_EarningsSite.SendGetRequestA(chBuffer) == false)
+    if (Site.SendGetRequestA(chBuffer) == false)
     {
+        dwLatency = GetTickCount() - dwStart;
         LogError("Unable to send GET request");
+        IncrementCounter(CtrFetchFailures);
+        outcome = FetchOutcomeUnavailable;
         goto Cleanup;
     }
 
     //
     // Receive the response for our request
     //
-    if (m_EarningsSite.RecvResponse(httpString) == false)
+    bReceived = Site.RecvResponse(httpString, &dwStatusCode);
+
+    dwLatency = GetTickCount() - dwStart;
+
+    if (bSiteLocked == true)
+    {
+        SiteLock->Unlock();
+        bSiteLocked = false;
+    }
+
+    if (bReceived == false)
     {
-        LogError("Failed to receive response");
+        LogError("Failed to receive response, status = %d", dwStatusCode);
+        IncrementCounter(CtrFetchFailures);
+
+        if ((dwStatusCode == HTTP_STATUS_TOO_MANY_REQUESTS) || (dwStatusCode == HTTP_STATUS_SERVICE_UNAVAIL))
+        {
+            IncrementCounter(CtrThrottled);
+            outcome = FetchOutcomeThrottled;
+        }
+        else if ((dwStatusCode == 0) || (dwStatusCode >= HTTP_STATUS_SERVER_ERROR))
+        {
+            outcome = FetchOutcomeUnavailable;
+        }
         goto Cleanup;
     }
 
@@ -898,11 +3834,43 @@ Return Value:
     // was successful then query for the estimates page
     //
     PtrEarningsData->SetQueryDate(CFeedTime(FT_CURRENT));
-    PtrEarningsData->IsAvailable = ParseHtmlForEarningsDate(httpString, PtrEarningsData);
+    PtrEarningsData->SetAvailable(ParseHtmlForEarningsDate(httpString, PtrEarningsData));
+    retVal = true;
+    outcome = FetchOutcomeOk;
+
+    //
+    // The symbols without the earnings data do not have the date box. A
+    // page with the date box that does not parse is not an answer, the
+    // cached record is kept
+    //
+    if ((PtrEarningsData->IsAvailable() == false) && 
+        (httpString.find("id=\"datebox\"") != String::npos))
+    {
+        IncrementCounter(CtrParseFailures);
+        outcome = FetchOutcomeParseFailed;
+        retVal = false;
+    }
     
 Cleanup:
 
+    if (bSiteLocked == true)
+    {
+        SiteLock->Unlock();
+    }
+
+    if (bInFlight == true)
+    {
+        m_InFlight.Release(outcome, dwLatency);
+    }
+
+    if (bAllowed == true)
+    {
+        m_Breaker.OnResult((outcome != FetchOutcomeThrottled) && (outcome != FetchOutcomeUnavailable));
+    }
+
+    Outcome = outcome;
+
     LeaveFunc();
-    return;
+    return retVal;
 }
 
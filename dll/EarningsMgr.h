@@ -37,9 +37,59 @@ Author:
 #include "FeedTime.h"
 #include "HttpHelper.h"
 #include "Lock.h"
+#include "TickerMap.h"
+#include "Epoch.h"
+#include "SymbolTable.h"
+#include "EarningsColumns.h"
+#include "SlabAllocator.h"
+#include "StringPool.h"
+#include "FieldCache.h"
+#include "DateIndex.h"
+#include "EarningsCalendar.h"
+#include "TokenBucket.h"
+#include "FetchQueue.h"
+#include "RefreshSchedule.h"
+#include "RefreshPolicy.h"
+#include "ConcurrencyLimit.h"
+#include "CircuitBreaker.h"
 
 extern bool gResetData;
 
+//
+// The website we are collecting data from
+//
+#define WWW_DATASOURCE              "www.earningswhispers.com"
+
+//
+// The size of the text fields returned for the record
+//
+#define EARNINGS_DATE_SIZE          32
+#define EARNINGS_NOTES_SIZE         128
+
+//
+// The flags of the record
+//
+#define EARNINGS_FLAG_AVAILABLE     0x01    // The earnings data is available on the website
+#define EARNINGS_FLAG_CONFIRMED     0x02    // The earnings release time and date are confirmed as per website
+#define EARNINGS_FLAG_REQUERY       0x04    // We have to query for the data again
+#define EARNINGS_FLAG_PENDING       0x08    // The query is queued on the fetch thread and data is not retrieved yet
+#define EARNINGS_FAILURES_MASK      0x70    // Consecutive queries that did not find the earnings data
+#define EARNINGS_FAILURES_SHIFT     4
+#define EARNINGS_MAX_FAILURES       7
+#define EARNINGS_FLAG_REFERENCED    0x80    // The record was used since the clock hand passed it
+
+//
+// The time a symbol without the earnings data stays in the negative cache
+// after the last query, by the number of consecutive failures
+//
+#define NEGATIVE_TTL_LADDER         { 60 * 60, 6 * 60 * 60, 24 * 60 * 60, 7 * 24 * 60 * 60 }
+
+//
+// The longest delay the record keeps for the next query of a symbol
+// without the data, in minutes
+//
+#define EARNINGS_MAX_RETRY_MINUTES  0xFFFF
+
 /*++
 
 Class:
@@ -51,106 +101,292 @@ Description:
     This structure stores the earnings information about the ticker. An instance
     of this class represents one ticker symbol.
 
+    The record is kept to 32 bytes so that a universe of millions of
+    symbols fits in the cache. The dates are stored as utc times, the
+    release time as EReleaseTime and the date text is looked up in the
+    field cache when it is asked for. The notes are rarely used so they are kept in the notes
+    pool and the record only has their id.
+
+    The readers do not lock the record. The writers update the record in
+    place under the shard lock between BeginWrite and EndWrite, which make
+    the sequence odd while the write is in progress. The readers copy the
+    record with Read, which retries till it gets a copy with the same even
+    sequence before and after. Only the requery and pending flags are
+    changed outside of the sequence. A reader would have to miss 32768
+    writes of the record for the 16 bit sequence to wrap around.
+
+    A record without the earnings data keeps the time of its next query
+    as the minutes after its query date. The records that were not given
+    a time are queried again at the end of the negative ttl for their
+    failures.
+
 --*/
 class CEarningsData
 {
+private:
+    TICKER_KEY      Key;                // The ticker symbol
+    SHORT volatile  Sequence;           // Odd while the record is being written
+    UINT16          RetryMinutes;       // Minutes after the query date of the next query without the data, 0 for the negative ttl
+    UINT32          QueryDate;          // The utc time when we last retrieved the data from website
+    UINT32          EarningsDate;       // The utc time of the earnings release, eastern midnight
+    UINT16          NotesId;            // The notes in the notes pool
+    BYTE            ReleaseTime : 4;    // EReleaseTime
+    BYTE            Unanswered : 1;     // None of the queries for the symbol were answered, the record is not saved
+    BYTE volatile   Flags;              // EARNINGS_FLAG_*
+
 public:
-    bool        IsAvailable;            // If the earnings data is available on the website
-    bool        IsConfirmed;            // If the earnings release time and date are confirmed as per website
-    bool        ReQuery;                // If we have to query for the data again. By default we do not query again
+    static CStringPool  NotesPool;      // The notes of all the records
+    static CFieldCache  FieldCache;     // The text of the dates, shared by all the records
 
+    // Properties
 public:
-    String      StrTicker;              // The ticker symbol     
-    String      StrEarningsDate;        // The earnings date in string format
-    String      StrEarningsTime;        // The earnings time in string format
-    String      StrEarningsDays;        // Days to earnings release
-    String      StrEarningsNotes;       // The notes from the earnings file
+    inline LPCSTR GetTicker() const { return Key.Chars; }
+    inline const TICKER_KEY& GetKey() const { return Key; }
+    inline UINT32 GetEarningsTime() const { return EarningsDate; }
+    inline UINT32 GetQueryTime() const { return QueryDate; }
+    inline EReleaseTime GetReleaseTime() const { return (EReleaseTime)ReleaseTime; }
+    inline LPCSTR GetNotes() const { return NotesPool.Get(NotesId); }
+    inline UINT16 GetNotesId() const { return NotesId; }
 
-private:
-    CFeedTime   QueryDate;              // The date when we last retrieved the data from website
-    CFeedTime   EarningsDate;           // The actual date of earnings release
+    inline bool IsAvailable() const { return (Flags & EARNINGS_FLAG_AVAILABLE) != 0; }
+    inline bool IsConfirmed() const { return (Flags & EARNINGS_FLAG_CONFIRMED) != 0; }
+    inline bool IsReQuery() const { return (Flags & EARNINGS_FLAG_REQUERY) != 0; }
+    inline bool IsPending() const { return (Flags & EARNINGS_FLAG_PENDING) != 0; }
+    inline UINT GetFailures() const { return (Flags & EARNINGS_FAILURES_MASK) >> EARNINGS_FAILURES_SHIFT; }
+
+    //
+    // The record has data from an earlier query that is due for a query or
+    // is being refreshed in background
+    //
+    inline bool IsStale() const { return ((Flags & (EARNINGS_FLAG_REQUERY | EARNINGS_FLAG_PENDING)) != 0) && (QueryDate != 0) && !IsUnanswered(); }
+
+    //
+    // None of the queries for the symbol were answered, the query date is
+    // the time of the last query that failed. The record is kept in memory
+    // only
+    //
+    inline bool IsUnanswered() const { return Unanswered != 0; }
+
+    //
+    // Marks the record as used for the eviction. Called by the readers
+    // without the lock, so the bit is set with an interlocked or
+    //
+    inline void Touch() {
+        if ((Flags & EARNINGS_FLAG_REFERENCED) == 0)
+        {
+            InterlockedOr8((CHAR volatile*)&Flags, EARNINGS_FLAG_REFERENCED);
+        }
+    }
 
+    //
+    // Clears the referenced bit and returns if it was set
+    //
+    inline bool ClearReferenced() {
+        return (InterlockedAnd8((CHAR volatile*)&Flags, (CHAR)~EARNINGS_FLAG_REFERENCED) &
+            EARNINGS_FLAG_REFERENCED) != 0;
+    }
+
+    //
+    // The flags are changed with the shard lock held or on a record that is
+    // not in the cache. The readers set the referenced bit in the same byte
+    // without the lock, so every write is an interlocked or/and
+    //
+    inline void SetFlag(_In_ BYTE Flag, _In_ bool Value) {
+        if (Value)
+        {
+            InterlockedOr8((CHAR volatile*)&Flags, (CHAR)Flag);
+        }
+        else
+        {
+            InterlockedAnd8((CHAR volatile*)&Flags, (CHAR)~Flag);
+        }
+    }
+
+    inline void SetAvailable(_In_ bool Value) { SetFlag(EARNINGS_FLAG_AVAILABLE, Value); }
+    inline void SetConfirmed(_In_ bool Value) { SetFlag(EARNINGS_FLAG_CONFIRMED, Value); }
+    inline void SetReQuery(_In_ bool Value) { SetFlag(EARNINGS_FLAG_REQUERY, Value); }
+    inline void SetPending(_In_ bool Value) { SetFlag(EARNINGS_FLAG_PENDING, Value); }
+
+    inline void SetFailures(_In_ UINT Failures) {
+        if (Failures > EARNINGS_MAX_FAILURES) Failures = EARNINGS_MAX_FAILURES;
+
+        //
+        // Only the writers change the count, the clear and the set can not
+        // interleave with another count
+        //
+        InterlockedAnd8((CHAR volatile*)&Flags, (CHAR)~EARNINGS_FAILURES_MASK);
+        InterlockedOr8((CHAR volatile*)&Flags, (CHAR)(Failures << EARNINGS_FAILURES_SHIFT));
+    }
 
     // Constructors
 public:
 
-    CEarningsData(_In_ LPCSTR Ticker, 
+    CEarningsData() :
+        Sequence(0), RetryMinutes(0), QueryDate(0), EarningsDate(0), NotesId(STRING_POOL_EMPTY_ID),
+        ReleaseTime(ReleaseUnknown), Unanswered(0), Flags(0)
+    {
+        Key.Clear();
+    }
+
+    CEarningsData(_In_ const TICKER_KEY& Ticker,
         _In_ bool Available = false,
         _In_ UINT32 QueryDt = 0,
         _In_ UINT32 EarningsDt = 0,
-        _In_ LPCSTR EarningsTime = "",
+        _In_ EReleaseTime EarningsTime = ReleaseUnknown,
         _In_ bool Confirmed = false,
-        _In_ LPCSTR Note = "") :
-            StrTicker(Ticker), 
-            IsAvailable(Available), 
-            QueryDate(TzUtc, QueryDt), 
-            EarningsDate(TzUtc, EarningsDt), 
-            StrEarningsTime(EarningsTime), 
-            IsConfirmed(Confirmed), 
-            StrEarningsNotes(Note) 
+        _In_ UINT16 Notes = STRING_POOL_EMPTY_ID) :
+            Key(Ticker),
+            Sequence(0),
+            RetryMinutes(0),
+            QueryDate(QueryDt),
+            EarningsDate(EarningsDt),
+            NotesId(Notes),
+            ReleaseTime((BYTE)EarningsTime),
+            Unanswered(0),
+            Flags(0)
     {
-        CHAR szTemp[128];
-        ReQuery = false;
-        EarningsDate.ToStringLong(szTemp);
-        StrEarningsDate = szTemp;
+        SetAvailable(Available);
+        SetConfirmed(Confirmed);
     }
 
-    void UpdateStrEarningsDays() 
-    {
-        CHAR            strEarningsDays[64];
+    //
+    // Returns the id of the notes in the notes pool. The notes longer than
+    // EARNINGS_NOTES_SIZE are truncated
+    //
+    static UINT16 InternNotes(_In_ LPCSTR Notes) {
+        CHAR szNotes[EARNINGS_NOTES_SIZE];
 
-        // Get local time and convert it to eastern time (Assumption here is that what is in local time
-        // zone is also in the eastern timezone
-        CFeedTime       ltToday(FT_CURRENT);
-        CFeedTime       ltToday2(TzEastern, ltToday.GetLocalYear(), ltToday.GetLocalMonth(), ltToday.GetLocalDay());
-        CFeedTimeSpan   diff = EarningsDate - ltToday2;
+        strncpy_s(szNotes, Notes, _TRUNCATE);
+        return NotesPool.Intern(szNotes);
+    }
 
-        sprintf_s(strEarningsDays, "%02d Days", diff.GetDays());
-        StrEarningsDays = strEarningsDays;
+    //
+    // Returns the text for the release time, as shown on the website
+    //
+    static LPCSTR ReleaseTimeText(_In_ EReleaseTime Time) {
+        static LPCSTR StrReleaseTimes[] = { "", "Before Open", "During Market", "After Close" };
+
+        return ((UINT32)Time < _countof(StrReleaseTimes)) ? StrReleaseTimes[Time] : "";
     }
 
-    inline void SetQueryDate(_In_ CFeedTime QDate) {
-        QueryDate = QDate;
+    //
+    // The writer side of the sequence. Called with the shard lock held
+    //
+    inline void BeginWrite() {
+        InterlockedIncrement16(&Sequence);
     }
 
-    void SetEarningsDate(_In_ CFeedTime& EDate) {
-        CHAR szTemp[128];
-        EarningsDate = EDate;
-        EarningsDate.ToStringLong(szTemp);
-        StrEarningsDate = szTemp;
+    inline void EndWrite() {
+        InterlockedIncrement16(&Sequence);
     }
-    
-    void CheckForRequery(_In_ INT LineCtr, _In_ INT EarningsQueryDays,
-        _In_ INT PostEarningsDays, _In_ INT EarningsRandDays)
-    {
-        CFeedTime       todaysDate(FT_CURRENT);
-        CFeedTimeSpan   modDiff = todaysDate - QueryDate;
 
-        if (this->IsAvailable == false) { return; }
+    //
+    // Copies the record into the snapshot without a lock. Retries while
+    // a write is in progress or if a write happened during the copy
+    //
+    void Read(_Out_ CEarningsData& Snapshot) {
+        SHORT sequence;
 
-        //
-        // If it has been long time since the last query then query again
-        //
-        if (modDiff.GetDays() > EarningsQueryDays + LineCtr % EarningsRandDays)
+        do
         {
-            LogInfo("Stale data. Marked for requery: %s",
-                this->StrTicker.c_str());
-            this->ReQuery = true;
-            return;
-        }
+            while (((sequence = Sequence) & 1) != 0) { YieldProcessor(); }
+            MemoryBarrier();
 
-        CFeedTimeSpan   earnDiff = this->EarningsDate - todaysDate;
+            Snapshot = *this;
 
-        //
-        // If it is N days past earnings, re-query for new data
-        //
-        if (earnDiff.GetDays() < (-1 * PostEarningsDays))
-        {
-            LogInfo("Past Earnings. Marked for requery: %s",
-                this->StrTicker.c_str());
-            this->ReQuery = true;
-            return;
-        }
+            MemoryBarrier();
+        } while (sequence != Sequence);
+    }
+
+    //
+    // Copies the data retrieved from the website into this record. The notes
+    // are owned by the user and the requery and pending flags by the cache,
+    // they are not touched.
+    //
+    void UpdateFromQuery(_In_ CEarningsData& Src) {
+        SetAvailable(Src.IsAvailable());
+        SetConfirmed(Src.IsConfirmed());
+        QueryDate = Src.QueryDate;
+        EarningsDate = Src.EarningsDate;
+        ReleaseTime = Src.ReleaseTime;
+        RetryMinutes = 0;
+        Unanswered = 0;
+    }
+
+    //
+    // Returns the days to the earnings release from today. The record is
+    // not changed so it can be called by the readers
+    //
+    inline int GetDaysToEarnings() const {
+        return FieldCache.GetDaysTo(EarningsDate);
+    }
+
+    //
+    // Returns the earnings date in the long format
+    //
+    inline LPCSTR GetEarningsDateText() const {
+        return FieldCache.GetDateText(EarningsDate);
+    }
+
+    inline void SetQueryDate(_In_ CFeedTime QDate) {
+        QueryDate = QDate.GetUtcTime();
+    }
+
+    inline void SetUnanswered(_In_ bool Value) {
+        Unanswered = Value ? 1 : 0;
+    }
+
+    //
+    // Sets the time of the next query of the record without the data. The
+    // time is kept as the minutes after the query date, so it is set after
+    // the query date
+    //
+    inline void SetRetryTime(_In_ UINT32 Time) {
+        UINT32 minutes = (Time > QueryDate) ? (Time - QueryDate + 59) / 60 : 1;
+
+        RetryMinutes = (UINT16)((minutes < EARNINGS_MAX_RETRY_MINUTES) ? minutes : EARNINGS_MAX_RETRY_MINUTES);
+    }
+
+    //
+    // Returns the time of the next query of the record without the data
+    //
+    inline UINT32 GetRetryTime() const {
+        return QueryDate + ((RetryMinutes != 0) ? RetryMinutes * 60 : NegativeTtl(GetFailures()));
+    }
+
+    inline void SetEarningsDate(_In_ CFeedTime& EDate) {
+        EarningsDate = EDate.GetUtcTime();
+    }
+
+    inline void SetReleaseTime(_In_ EReleaseTime Time) {
+        ReleaseTime = (BYTE)Time;
+    }
+
+    inline void SetNotesId(_In_ UINT16 Notes) {
+        NotesId = Notes;
+    }
+    
+    //
+    // Returns the time the record stays in the negative cache. The records
+    // from the older cache files do not have the failures and get the
+    // first step of the ladder
+    //
+    static UINT32 NegativeTtl(_In_ UINT Failures) {
+        static const UINT32 Ttls[] = NEGATIVE_TTL_LADDER;
+
+        if (Failures == 0) Failures = 1;
+        if (Failures > _countof(Ttls)) Failures = _countof(Ttls);
+        return Ttls[Failures - 1];
+    }
+
+    //
+    // Returns true if the record does not have the earnings data and it
+    // is time to query for it again. The records that were never queried
+    // are not in the negative cache
+    //
+    inline bool IsNegativeExpired(_In_ UINT32 Now) const {
+        if (IsAvailable() || (QueryDate == 0)) return false;
+        return Now >= GetRetryTime();
     }
 
     template <size_t Size>
@@ -158,18 +394,142 @@ public:
     {
         CHAR szQDate[64], szEDate[64];
 
-        QueryDate.ToStringStd(szQDate);
-        EarningsDate.ToStringStd(szEDate);
+        CFeedTime(TzUtc, QueryDate).ToStringStd(szQDate);
+        CFeedTime(TzUtc, EarningsDate).ToStringStd(szEDate);
 
-        return sprintf_s(Buffer, "%d,%s,%s,%s,%s,%d,%s\n",
-            IsAvailable, StrTicker.c_str(), szQDate, szEDate,
-            StrEarningsTime.c_str(), IsConfirmed,
-            StrEarningsNotes.c_str());
+        return sprintf_s(Buffer, "%d,%s,%s,%s,%s,%d,%d,%s\n",
+            IsAvailable(), GetTicker(), szQDate, szEDate,
+            ReleaseTimeText(GetReleaseTime()), IsConfirmed(),
+            GetFailures(), GetNotes());
     }
 };
 
+static_assert(sizeof(CEarningsData) == 32, "The earnings record is expected to be 32 bytes");
+
 typedef CEarningsData*                      CEarningsDataPtr_t;
-typedef std::map<String, CEarningsDataPtr_t>    EARNINGS_MAP;
+typedef CTickerMap<CEarningsDataPtr_t>          EARNINGS_MAP;
+typedef CTickerMap<LONG>                        INFLIGHT_MAP;
+typedef CSlabAllocator<CEarningsData>           RECORD_SLAB;
+typedef CTickerMap<UINT32>                      DISK_INDEX;
+
+
+//
+// Returns an evicted record to its slab, retired through the epoch manager
+// so it is freed once the readers are done with it
+//
+struct RECORD_RELEASE
+{
+    RECORD_SLAB*        Slab;
+    CEarningsDataPtr_t  Record;
+
+    RECORD_RELEASE(RECORD_SLAB* pSlab, CEarningsDataPtr_t pRecord) : Slab(pSlab), Record(pRecord) { }
+    ~RECORD_RELEASE() { Slab->Free(Record); }
+};
+
+
+//
+// The cache is split in shards by the ticker hash
+//
+#define EARNINGS_DEFAULT_SHARDS     16
+#define EARNINGS_MAX_SHARDS         256
+
+//
+// The cache misses are queried by a pool of fetch threads
+//
+#define FETCH_DEFAULT_WORKERS       1
+#define FETCH_MAX_WORKERS           16
+
+//
+// The fetch threads retry the queries the data source did not answer or
+// throttled, after a delay doubled on every retry with half of it jittered
+//
+#define FETCH_MAX_RETRIES           3
+#define FETCH_RETRY_BASE_MS         500
+#define FETCH_RETRY_MAX_MS          (8 * 1000)
+
+//
+// The refresh scheduler wakes up every period and, outside the market
+// hours, keeps up to a batch of the due tickers in the fetch queue. A
+// refresh that fails is tried again after the delay
+//
+#define REFRESH_SCHEDULER_PERIOD    1000
+#define REFRESH_BATCH_SIZE          32
+#define REFRESH_RETRY_DELAY         (60 * 60)
+
+//
+// The queries the circuit breaker rejected, or that used up their retries
+// on a throttled or unavailable data source, are tried again after the
+// delay instead of the refresh or the negative cache delay
+//
+#define FETCH_TRANSIENT_RETRY_DELAY (5 * 60)
+
+//
+// The time the unload waits for the shard locks to save the cache, the
+// threads still running are not waited for
+//
+#define SAVE_UNLOAD_LOCK_TIMEOUT    2000
+
+struct EARNINGS_SHARD
+{
+    EARNINGS_MAP        Cache;
+    CLock               Lock;
+    INFLIGHT_MAP        InFlight;       // Tickers being queried and number of callers waiting on them
+    CCondition          FetchDone;      // Signalled when a query in flight completes
+    DISK_INDEX          OnDisk;         // Offset of the line in the cache file, only if the file is up to date
+    LONG volatile       Acquisitions;   // Times the shard lock was taken
+    LONG volatile       Contentions;    // Times the shard lock was held by another thread
+
+    EARNINGS_SHARD() : Acquisitions(0), Contentions(0) { }
+};
+
+
+// Lock management for the shard, counts the contention on the shard lock
+class CShardLock
+{
+private:
+    EARNINGS_SHARD& m_Shard;
+
+public:
+    CShardLock(EARNINGS_SHARD& Shard) : m_Shard(Shard) {
+        if (!m_Shard.Lock.TryLock())
+        {
+            InterlockedIncrement(&m_Shard.Contentions);
+            m_Shard.Lock.Lock();
+        }
+        m_Shard.Acquisitions++;
+    }
+
+    ~CShardLock() { m_Shard.Lock.Unlock(); }
+};
+
+
+//
+// The counters maintained by the earnings manager
+//
+enum EEarningsCounter
+{
+    CtrCacheHits,                       // Symbol was found in the cache
+    CtrCacheMisses,                     // Symbol was not in the cache
+    CtrFetches,                         // Queries sent to the website
+    CtrFetchesCoalesced,                // Callers that joined a query already in flight
+    CtrFetchFailures,                   // Queries that did not get a response
+    CtrRecordAllocations,               // Records allocated from the slab since startup
+    CtrSlabBlocks,                      // Blocks held by the current slab
+    CtrLoadTimeMs,                      // Time taken by the last load of the cache file
+    CtrNegativeHits,                    // Queries not sent because the symbol is in the negative cache
+    CtrNegativeHitsToday,               // Same as above since the eastern midnight
+    CtrEvictions,                       // Records evicted to stay in the cache capacity
+    CtrDiskRecoveries,                  // Records read back from the cache file after eviction
+    CtrRateLimited,                     // Queries that waited for the rate limit
+    CtrPrefetches,                      // Tickers queued to warm up the cache
+    CtrStaleServed,                     // Expired records returned while they are refreshed
+    CtrRefreshesScheduled,              // Tickers queued by the refresh scheduler
+    CtrRefreshesDeferred,               // Refreshes that came due during market hours and were held
+    CtrThrottled,                       // Queries answered with 429 or 503
+    CtrParseFailures,                   // Pages with the earnings data that did not parse
+    CtrRetries,                         // Queries sent again after a transient failure
+    CtrMaxCounters,
+};
 
 
 /*++
@@ -189,13 +549,55 @@ class CEarningsMgr
 {
 protected:
     CHttp               m_EarningsSite;
+    String              m_sDataSource;      // The host name of the website we query
+    INTERNET_PORT       m_nDataSourcePort;  // The http port of the website we query
     
-    EARNINGS_MAP        m_EarningsCache;
-    CLock               m_EarningsCacheLock;
+    EARNINGS_SHARD*     m_pShards;          // The cache shards, each with its own lock
+    UINT32              m_nShards;          // Always power of 2
+    CEpochManager       m_Epochs;           // Reclaims the records replaced under the readers
+    CSymbolTable        m_Symbols;          // Ticker handles handed out to the callers
+    CEarningsColumns    m_Columns;          // Columnar copy of the cache indexed by handle
+    CDateIndex          m_DateIndex;        // Tickers ordered by the earnings date
+    CEarningsCalendar   m_Calendar;         // Tickers reporting on each day by release time
+    RECORD_SLAB*        m_pRecords;         // Owns the cached records, replaced on every load
+
+    UINT32              m_nCapacity;        // Records kept in memory, 0 for no limit
+    LONG volatile       m_nRecords;         // Records in memory
+    INT                 m_nClockHand;       // The handle the eviction looks at next
+    CLock               m_EvictLock;        // One thread evicts at a time
+
+    String              m_sCacheFile;       // The cache file the evicted records are read from
+    INT                 m_nCacheColumns;    // The columns in the lines of the cache file
+    CRefreshPolicy      m_RefreshPolicy;    // Decides when the records are queried again
+    LONG volatile       m_bIndexesBuilt;    // If the date index and the calendar have the cache file
+
+    CLock               m_EarningsSiteLock; // Only one request on the http connection at a time
+
+    LONG volatile       m_Counters[CtrMaxCounters];
+    LONG volatile       m_nNegativeDay;     // The eastern day CtrNegativeHitsToday is counted for
+
+    CFetchQueue         m_FetchQueue;       // Tickers waiting to be queried by the fetch threads
+    HANDLE              m_hFetchThreads[FETCH_MAX_WORKERS]; // Query the website for cache misses
+    UINT32              m_nFetchWorkers;
+    HANDLE              m_hFetchSemaphore;  // Counts the tickers in the fetch queue
+    HANDLE              m_hFetchExitEvent;  // Signalled when the fetch threads have to exit
+    HANDLE              m_hPrefetchThread;  // Prefetches the watch list at startup
+    String              m_sWatchlistFile;
+    HANDLE              m_hRefreshThread;   // Refreshes the due tickers outside the market hours
+    CRefreshSchedule    m_RefreshSchedule;  // Tickers of the cache by the time they are due for a query
+    LONG volatile       m_bMarketOpen;      // Set by the refresh scheduler during the regular hours
+
+    CConcurrencyLimit   m_InFlight;         // Limits the queries in flight, adapts to the data source
+    CCircuitBreaker     m_Breaker;          // Fails the queries at once while the data source is down
+    CTokenBucket        m_RateLimit;        // Limits the queries per second to the data source
 
 public:
     bool                m_bConnected;
     bool                m_bCacheDirty;      // If true then we have to write the cache on exit
+    bool                m_bAsyncQuery;      // If true then cache misses are queried on the fetch thread
+    bool                m_bColumnarStore;   // If true then the cache is mirrored into m_Columns
+    bool                m_bLazyLoad;        // If true then the records are parsed when first asked for
+    bool                m_bScheduledRefresh;// If true then the cached records are refreshed off market hours
 
     // Internet functions
 protected:
@@ -252,26 +654,355 @@ protected:
         );
 
     //
-    // Query the earnings data from datasource
+    // Query the earnings data from datasource. The first one uses the shared
+    // connection, the fetch threads have a connection each. The site lock
+    // of a shared connection is only held while the request is on the wire
     //
-    void QueryEarningsFromWebsite(
-        _Inout_ CEarningsDataPtr_t PtrEarningsData
+    bool QueryEarningsFromWebsite(
+        _Inout_ CEarningsDataPtr_t PtrEarningsData,
+        _Out_ EFetchOutcome& Outcome
+        );
+
+    bool QueryEarningsFromWebsite(
+        _In_ CHttp& Site,
+        _Inout_ CEarningsDataPtr_t PtrEarningsData,
+        _Out_ EFetchOutcome& Outcome,
+        _In_opt_ CLock* SiteLock = NULL
+        );
+
+    //
+    // Returns the delay of the retry, jittered
+    //
+    static DWORD RetryDelay(_In_ UINT32 Retry) {
+        DWORD dwDelay = FETCH_RETRY_BASE_MS << ((Retry < 8) ? Retry : 8);
+
+        if (dwDelay > FETCH_RETRY_MAX_MS) dwDelay = FETCH_RETRY_MAX_MS;
+        return dwDelay / 2 + (DWORD)rand() % (dwDelay / 2 + 1);
+    }
+
+    //
+    // Queue the ticker to be queried on the fetch thread, ranked by why it
+    // is queried and by the record if there is one
+    //
+    void QueueFetch(
+        _In_ const TICKER_KEY& Ticker,
+        _In_ EFetchKind Kind,
+        _In_opt_ const CEarningsData* Record,
+        _In_ bool Requested
         );
 
+    //
+    // The fetch threads that drain the fetch queue
+    //
+    static DWORD WINAPI FetchThreadProc(LPVOID This)
+    {
+        CEarningsMgr *pMgr = (CEarningsMgr*)This;
+        return pMgr->FetchWorker();
+    }
+
+    DWORD FetchWorker(void);
+
+    //
+    // The thread that prefetches the tickers of the watch list file
+    //
+    static DWORD WINAPI PrefetchThreadProc(LPVOID This)
+    {
+        CEarningsMgr *pMgr = (CEarningsMgr*)This;
+        return pMgr->PrefetchWatchlist();
+    }
+
+    DWORD PrefetchWatchlist(void);
+
+    //
+    // The thread that queues the tickers due for a refresh outside the
+    // market hours
+    //
+    static DWORD WINAPI RefreshThreadProc(LPVOID This)
+    {
+        CEarningsMgr *pMgr = (CEarningsMgr*)This;
+        return pMgr->RefreshScheduler();
+    }
+
+    DWORD RefreshScheduler(void);
+
+    //
+    // Queues the ticker as a prefetch if it is not in the cache or is due
+    // for a query, or as a refresh whatever the state of the record.
+    // Returns true if the ticker was queued
+    //
+    bool PrefetchTicker(
+        _In_ const TICKER_KEY& Ticker,
+        _In_ EFetchKind Kind
+        );
+
+    //
+    // Puts the ticker in the refresh schedule at the time the record is due
+    // for a query. The records never queried are not scheduled
+    //
+    void ScheduleRefresh(
+        _In_ const TICKER_KEY& Ticker,
+        _In_ const CEarningsData& Record
+        );
+
+    //
+    // Copies the query result into the cache and releases the waiters.
+    // Called with the shard lock held
+    //
+    void CompleteFetch(
+        _In_ const TICKER_KEY& Ticker,
+        _In_ CEarningsData& Fetched,
+        _In_ bool Queried,
+        _In_ EFetchOutcome Outcome
+        );
+
+    //
+    // Binds the record to the handle and mirrors it into the columns.
+    // Called with the shard lock held
+    //
+    void BindRecord(
+        _In_ INT Handle,
+        _In_ CEarningsDataPtr_t PtrEarningsData
+        );
+
+    //
+    // Moves the ticker to its earnings date in the date index and the
+    // calendar, whenever the record is loaded or queried. The records
+    // without a date are not in either
+    //
+    void IndexRecord(
+        _In_ const TICKER_KEY& Ticker,
+        _In_ const CEarningsData& Record
+        );
+
+    //
+    // Returns the shard that caches the ticker. The low bits of the hash
+    // pick the slot in the shard so the shard is picked by the high bits
+    //
+    inline EARNINGS_SHARD& GetShard(_In_ const TICKER_KEY& Ticker) {
+        return m_pShards[(Ticker.Hash() >> 24) & (m_nShards - 1)];
+    }
+
+    //
+    // Locks all of the shards in order, for the operations on the whole cache
+    //
+    void LockAllShards(void);
+    void UnlockAllShards(void);
+
+    //
+    // Same as LockAllShards, gives up after the timeout. A thread that is
+    // gone at the process exit can still own a shard lock
+    //
+    bool TryLockAllShards(_In_ DWORD Milliseconds);
+
+    //
+    // Reclaims the notes no cached record refers to. SweepNotes is called
+    // with all of the shards locked, ReclaimNotes locks them
+    //
+    void SweepNotes(void);
+    void ReclaimNotes(void);
+
+    //
+    // Frees the swept notes once the readers are done with them
+    //
+    static void FreeNotes(_In_ PVOID Swept);
+
+    //
+    // Returns the memory for a new record from the slab. Called with a
+    // shard lock held, the slab is only replaced with all of them held
+    //
+    PVOID AllocateRecord(void);
+
+    //
+    // Adds the record for the ticker to the cache, the one read back from
+    // the cache file or an empty one. The record read back is checked and
+    // indexed as on a load. Called with the shard lock held
+    //
+    CEarningsDataPtr_t InsertRecord(
+        _In_ const TICKER_KEY& Ticker,
+        _In_opt_ const CEarningsData* Evicted
+        );
+
+    //
+    // Parses a line of the cache file into the record
+    //
+    bool ParseEarningsLine(
+        _Inout_ LPSTR Line,
+        _In_ INT Columns,
+        _Out_ TICKER_KEY& Ticker,
+        _Out_ CEarningsData& Record
+        );
+
+    //
+    // Reads the line of the ticker from the cache file into the record.
+    // Called with the shard lock held
+    //
+    bool ReadEarningsLine(
+        _In_ const TICKER_KEY& Ticker,
+        _In_ UINT32 Offset,
+        _Out_ CEarningsData& Record
+        );
+
+    bool ReadEarningsLine(
+        _Inout_ std::fstream& InFile,
+        _In_ const TICKER_KEY& Ticker,
+        _In_ UINT32 Offset,
+        _Out_ CEarningsData& Record
+        );
+
+    //
+    // Reads the tickers and the offsets of the lines of the cache file into
+    // the disk indexes without parsing the lines. Called with all the
+    // shards locked
+    //
+    bool IndexEarningsFile(
+        _In_ LPCSTR FileName,
+        _In_ UINT32 Offset,
+        _Out_ INT& Lines
+        );
+
+    //
+    // Fills the date index and the calendar from the cache file, the first
+    // time they are asked for after a lazy load
+    //
+    void BuildIndexes(void);
+
+    //
+    // Marks the record loaded from the cache file for requery if required
+    //
+    void CheckLoadedRecord(
+        _In_ CEarningsDataPtr_t PtrEarningsData
+        );
+
+    //
+    // Evicts the cold records while the cache is over the capacity.
+    // Called without any shard lock held
+    //
+    void EvictRecords(void);
+
+    //
+    // Returns the percentage of the lookups found in memory
+    //
+    LONG GetHitRatio(void);
+
+    //
+    // Returns true if the cached record is returned without a query. The
+    // records without the earnings data are queried again on the negative
+    // cache ladder
+    //
+    bool UseCachedRecord(
+        _In_ CEarningsDataPtr_t PtrEarningsData
+        );
+
+    //
+    // Returns true if the record has to be queried, same as UseCachedRecord
+    // without counting the record as used
+    //
+    inline bool IsQueryDue(_In_ CEarningsDataPtr_t PtrEarningsData) {
+        if (PtrEarningsData->IsReQuery()) return true;
+        if (PtrEarningsData->IsAvailable() || (PtrEarningsData->GetQueryTime() == 0)) return false;
+        return PtrEarningsData->IsNegativeExpired((UINT32)_time32(NULL));
+    }
+
+    inline void IncrementCounter(_In_ EEarningsCounter Counter) {
+        InterlockedIncrement(&m_Counters[Counter]);
+    }
+
     // C'tor/D'tor
 public:
     CEarningsMgr(void);
     ~CEarningsMgr(void);
 
+    //
+    // The readers of the cached records enter the epoch of the manager
+    //
+    inline CEpochManager& GetEpochs(void) { return m_Epochs; }
+
     // Connection management
 public:
-    bool Connect(void);
+    bool Connect(
+        _In_ LPCSTR DataSource,
+        _In_ INTERNET_PORT DataSourcePort
+        );
 
     bool Disconnect(void) {
         m_EarningsSite.Uninitialize();
+        m_bConnected = false;
         return true;
     }
 
+    //
+    // Sets the number of cache shards, rounded up to power of 2. Called
+    // before the cache is loaded
+    //
+    bool SetCacheShards(
+        _In_ UINT32 Shards
+        );
+
+    //
+    // Sets the number of records kept in memory, 0 for no limit
+    //
+    inline void SetCacheCapacity(_In_ UINT32 Capacity) {
+        m_nCapacity = Capacity;
+    }
+
+    //
+    // Sets the number of fetch threads, the queries per second sent to the
+    // data source and the queries in flight at a time. 0 is no limit for
+    // the last two. The adaptive limit of the queries in flight grows up
+    // to the maximum while the data source keeps up. Called before the
+    // fetch threads are started
+    //
+    void SetFetchLimits(
+        _In_ UINT32 Workers,
+        _In_ UINT32 RequestsPerSec,
+        _In_ UINT32 MaxInFlight,
+        _In_ bool AdaptiveInFlight
+        );
+
+    //
+    // Sets the policy that decides when the records are queried again.
+    // Called before the cache is loaded
+    //
+    inline void SetRefreshPolicy(_In_ ERefreshPolicy Policy, _In_ const REFRESH_INTERVALS& Intervals) {
+        m_RefreshPolicy.SetPolicy(Policy, Intervals);
+    }
+
+    //
+    // Start/Stop the threads that query the cache misses in background
+    //
+    bool StartFetchThread(void);
+    void StopFetchThread(void);
+
+    //
+    // Signals the background threads to exit without waiting for them, for
+    // the dll unload where the loader lock is held. Returns true if any of
+    // the threads is still running
+    //
+    bool SignalFetchThreads(void);
+
+    //
+    // Prefetches the tickers of the watch list file on a background thread.
+    // Called once the fetch threads are running
+    //
+    bool StartPrefetch(
+        _In_ LPCSTR WatchlistFile
+        );
+
+    //
+    // Starts the thread that refreshes the cached records outside the market
+    // hours. Called once the fetch threads are running
+    //
+    bool StartRefreshScheduler(void);
+
+    //
+    // Queues the tickers that are not in the cache at the prefetch priority.
+    // Returns the number of tickers queued
+    //
+    INT PrefetchEarnings(
+        _In_reads_(Count) LPCSTR* Tickers,
+        _In_ INT Count
+        );
+
 
 public:
 
@@ -279,26 +1010,110 @@ public:
     // Load data from the cache file
     //
     bool LoadEarningsData(
-        _In_ LPCSTR FileName,
-        _In_ INT EarningsQueryDays,
-        _In_ INT PostEarningsDays,
-        _In_ INT EarningsRandDays
+        _In_ LPCSTR FileName
         );
 
     //
     // Save data to the cache file
     //
     bool SaveEarningsData(
-        _In_ LPCSTR FileName
+        _In_ LPCSTR FileName,
+        _In_ DWORD LockTimeout = INFINITE
         );
 
     //
-    // Retrieve the earnings data for the ticker
+    // Retrieve the earnings data for the ticker. The record can be replaced
+    // anytime, the caller reads it inside CEpochGuard(m_Epochs)
     //
     CEarningsDataPtr_t GetEarningsData(
         _In_ LPCSTR Ticker
         );
 
+    //
+    // Set the notes for the ticker
+    //
+    bool SetEarningsNotes(
+        _In_ LPCSTR Ticker,
+        _In_ LPCSTR Notes
+        );
+
+    //
+    // Returns the handle for the ticker or SYMBOL_INVALID_HANDLE
+    //
+    INT GetSymbolHandle(
+        _In_ LPCSTR Ticker
+        );
+
+    //
+    // Retrieve the earnings data for the handle. Same as GetEarningsData
+    //
+    CEarningsDataPtr_t GetEarningsDataByHandle(
+        _In_ INT Handle
+        );
+
+    //
+    // Returns the days to earnings for the handle from the columnar store.
+    // Returns false if the columnar store is disabled or has no data
+    //
+    bool GetDaysToEarningsByHandle(
+        _In_ INT Handle,
+        _Out_ INT& Days
+        );
+
+    //
+    // Copies the tickers reporting in [FromDays, ToDays] days from today
+    // into the buffer, separated by commas and ordered by the date.
+    // Returns the number of tickers copied
+    //
+    INT GetSymbolsReportingBetween(
+        _In_ INT FromDays,
+        _In_ INT ToDays,
+        _Out_writes_(BufferSize) LPSTR Buffer,
+        _In_ INT BufferSize
+        );
+
+    //
+    // Copies the tickers reporting Days days from today at the release time
+    // into the buffer, separated by commas. Returns the number of tickers
+    // copied
+    //
+    INT GetEarningsCalendar(
+        _In_ INT Days,
+        _In_ EReleaseTime ReleaseTime,
+        _Out_writes_(BufferSize) LPSTR Buffer,
+        _In_ INT BufferSize
+        );
+
+    //
+    // Replays the cache file for the days under the policy and returns the
+    // number of queries it would send, -1 if the file cannot be read
+    //
+    INT SimulateRefreshPolicy(
+        _In_ ERefreshPolicy Policy,
+        _In_ INT Days
+        );
+
+    //
+    // Formats the state of the circuit breaker and of the fetch limits into
+    // the buffer. Returns the characters written, -1 if truncated
+    //
+    INT GetDiagnostics(
+        _Out_writes_(BufferSize) LPSTR Buffer,
+        _In_ INT BufferSize
+        );
+
+    //
+    // Returns the value of the named counter or -1 if there is no such counter
+    //
+    LONG GetCounter(
+        _In_ LPCSTR CounterName
+        );
+
+    //
+    // Logs all the counters
+    //
+    void LogCounters(void);
+
 };
 
 
@@ -0,0 +1,344 @@
+/*++
+
+    Copyright (c) Pai Financials LLC.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    Epoch.cpp
+
+Abstract:
+
+    Implements the epoch based reclamation
+
+Author:
+
+    nabieasaurus
+
+--*/
+#include "StdAfx.h"
+#include "Epoch.h"
+
+//
+// The tls value of a thread without a slot is EPOCH_OVERFLOW with the nest
+// count and the index of the overflow counter it is counted in
+//
+#define EPOCH_OVERFLOW              0x40000000
+#define EPOCH_NEST_SHIFT            8
+#define EPOCH_INDEX_MASK            0xFF
+
+
+CEpochManager::CEpochManager(
+    void
+    )
+/*++
+
+Routine Description:
+
+    This is the default constructor for the CEpochManager
+
+--*/
+{
+    ZeroMemory(m_Slots, sizeof(m_Slots));
+    m_nSlots = 0;
+    m_nEpoch = 0;
+    ZeroMemory((PVOID)m_nOverflow, sizeof(m_nOverflow));
+
+    m_dwTlsIndex = TlsAlloc();
+    if (m_dwTlsIndex == TLS_OUT_OF_INDEXES)
+    {
+        LogError("Unable to allocate tls index, retired objects are freed on exit");
+    }
+}
+
+
+CEpochManager::~CEpochManager(
+    void
+    )
+/*++
+
+Routine Description:
+
+    This is the default destructor for the CEpochManager. There are no
+    readers left at this point so all of the retired objects are freed,
+    oldest epoch first, the same order as TryAdvance frees them.
+
+--*/
+{
+    CAutoLock al(m_RetireLock);
+
+    for (int nCtr = 1; nCtr <= EPOCH_COUNT; nCtr++)
+    {
+        std::deque<RETIRED>& retired = m_Retired[(m_nEpoch + nCtr) % EPOCH_COUNT];
+
+        for (std::deque<RETIRED>::iterator it = retired.begin(); it != retired.end(); it++)
+        {
+            it->Reclaim(it->Object);
+        }
+        retired.clear();
+    }
+
+    if (m_dwTlsIndex != TLS_OUT_OF_INDEXES)
+    {
+        TlsFree(m_dwTlsIndex);
+    }
+}
+
+
+CEpochManager::EPOCH_SLOT*
+CEpochManager::GetSlot(
+    void
+    )
+/*++
+
+Routine Description:
+
+    Returns the slot of the calling thread. The slot is claimed the first
+    time the thread reads and is kept for the life of the thread.
+
+--*/
+{
+    if (m_dwTlsIndex == TLS_OUT_OF_INDEXES) { return NULL; }
+
+    LPVOID pValue = TlsGetValue(m_dwTlsIndex);
+    if (((LONG_PTR)pValue & EPOCH_OVERFLOW) != 0) { return NULL; }
+
+    if (pValue == NULL)
+    {
+        LONG nSlot = InterlockedIncrement(&m_nSlots) - 1;
+        if (nSlot >= EPOCH_MAX_SLOTS)
+        {
+            LogWarn("Epoch slots exhausted, thread %d uses the overflow counters",
+                GetCurrentThreadId());
+            TlsSetValue(m_dwTlsIndex, (LPVOID)(LONG_PTR)EPOCH_OVERFLOW);
+            return NULL;
+        }
+
+        pValue = (LPVOID)(LONG_PTR)(nSlot + 1);
+        TlsSetValue(m_dwTlsIndex, pValue);
+    }
+
+    return &m_Slots[(LONG_PTR)pValue - 1];
+}
+
+
+void
+CEpochManager::Enter(
+    void
+    )
+/*++
+
+Routine Description:
+
+    Enters the epoch. The epoch is published to the slot and read back
+    to make sure the global epoch did not move in between, otherwise a
+    writer could have missed this reader.
+
+--*/
+{
+    EPOCH_SLOT* pSlot = GetSlot();
+
+    if (pSlot == NULL)
+    {
+        EnterOverflow();
+        return;
+    }
+
+    if (pSlot->Nest++ > 0) { return; }
+
+    LONG epoch;
+    do
+    {
+        epoch = m_nEpoch;
+        InterlockedExchange(&pSlot->State, (epoch << 1) | 1);
+    } while (epoch != m_nEpoch);
+}
+
+
+void
+CEpochManager::Leave(
+    void
+    )
+/*++
+
+Routine Description:
+
+    Leaves the epoch
+
+--*/
+{
+    EPOCH_SLOT* pSlot = GetSlot();
+
+    if (pSlot == NULL)
+    {
+        LeaveOverflow();
+        return;
+    }
+
+    if (--pSlot->Nest > 0) { return; }
+
+    InterlockedExchange(&pSlot->State, 0);
+}
+
+
+void
+CEpochManager::EnterOverflow(
+    void
+    )
+/*++
+
+Routine Description:
+
+    Counts the thread in the overflow counter of the current epoch. The
+    counter is kept in the tls value so Leave decrements the same one.
+    If the thread has no tls index, it is counted for every enter.
+
+--*/
+{
+    LONG_PTR value = (m_dwTlsIndex != TLS_OUT_OF_INDEXES) ?
+        (LONG_PTR)TlsGetValue(m_dwTlsIndex) : EPOCH_OVERFLOW;
+    LONG_PTR nest = (value & ~EPOCH_OVERFLOW) >> EPOCH_NEST_SHIFT;
+
+    if (nest == 0)
+    {
+        LONG epoch;
+        while (true)
+        {
+            epoch = m_nEpoch;
+            InterlockedIncrement(&m_nOverflow[epoch % EPOCH_COUNT]);
+            if (epoch == m_nEpoch) { break; }
+            InterlockedDecrement(&m_nOverflow[epoch % EPOCH_COUNT]);
+        }
+
+        value = EPOCH_OVERFLOW | (epoch % EPOCH_COUNT);
+    }
+
+    value += ((LONG_PTR)1 << EPOCH_NEST_SHIFT);
+
+    if (m_dwTlsIndex != TLS_OUT_OF_INDEXES)
+    {
+        TlsSetValue(m_dwTlsIndex, (LPVOID)value);
+    }
+}
+
+
+void
+CEpochManager::LeaveOverflow(
+    void
+    )
+/*++
+
+Routine Description:
+
+    Removes the thread from the overflow counter it was counted in
+
+--*/
+{
+    if (m_dwTlsIndex == TLS_OUT_OF_INDEXES)
+    {
+        //
+        // Without the tls the epoch of the enter is not known. Hold off the
+        // reclamation for this epoch, which is the worst case
+        //
+        LogError("Epoch leave without tls index");
+        return;
+    }
+
+    LONG_PTR value = (LONG_PTR)TlsGetValue(m_dwTlsIndex);
+
+    value -= ((LONG_PTR)1 << EPOCH_NEST_SHIFT);
+    if (((value & ~EPOCH_OVERFLOW) >> EPOCH_NEST_SHIFT) == 0)
+    {
+        InterlockedDecrement(&m_nOverflow[value & EPOCH_INDEX_MASK]);
+        value = EPOCH_OVERFLOW;
+    }
+
+    TlsSetValue(m_dwTlsIndex, (LPVOID)value);
+}
+
+
+_Use_decl_annotations_
+void
+CEpochManager::Retire(
+    PVOID Object,
+    PFN_RECLAIM Reclaim
+    )
+/*++
+
+Routine Description:
+
+    Adds the object to the list of the current epoch and tries to move
+    the epoch forward
+
+Parameters:
+
+    Object - The object that is no longer reachable by the new readers
+
+    Reclaim - The function that frees the object
+
+--*/
+{
+    RETIRED retired = { Object, Reclaim };
+
+    CAutoLock al(m_RetireLock);
+
+    m_Retired[m_nEpoch % EPOCH_COUNT].push_back(retired);
+    TryAdvance();
+}
+
+
+void
+CEpochManager::TryAdvance(
+    void
+    )
+/*++
+
+Routine Description:
+
+    Advances the global epoch if none of the readers is in an older epoch.
+    The list that is reused for the new epoch holds the objects retired
+    two epochs back, they are freed here.
+
+--*/
+{
+    LONG epoch = m_nEpoch;
+    LONG nSlots = (m_nSlots < EPOCH_MAX_SLOTS) ? m_nSlots : EPOCH_MAX_SLOTS;
+
+    for (LONG nCtr = 0; nCtr < nSlots; nCtr++)
+    {
+        LONG state = m_Slots[nCtr].State;
+        if (((state & 1) != 0) && ((state >> 1) != epoch)) { return; }
+    }
+
+    if ((m_nOverflow[(epoch + 1) % EPOCH_COUNT] != 0) ||
+        (m_nOverflow[(epoch + 2) % EPOCH_COUNT] != 0))
+    {
+        return;
+    }
+
+    InterlockedExchange(&m_nEpoch, epoch + 1);
+
+    std::deque<RETIRED>& retired = m_Retired[(epoch + 1) % EPOCH_COUNT];
+    for (std::deque<RETIRED>::iterator it = retired.begin(); it != retired.end(); it++)
+    {
+        it->Reclaim(it->Object);
+    }
+    retired.clear();
+}
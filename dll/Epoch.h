@@ -0,0 +1,158 @@
+/*++
+
+    Copyright (c) Pai Financials LLC.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    Epoch.h
+
+Abstract:
+
+    Epoch based reclamation for the objects read without a lock
+
+Author:
+
+    nabieasaurus
+
+--*/
+#pragma once
+
+#include "Lock.h"
+
+#define EPOCH_MAX_SLOTS             128         // Readers beyond this share the overflow counters
+#define EPOCH_COUNT                 3
+
+
+/*++
+
+Class Name:
+
+    CEpochManager
+
+Class Description:
+
+    The readers enter an epoch before reading the shared objects and
+    leave it when they are done, without taking a lock. The writers
+    replace the shared object and retire the old one instead of freeing
+    it. The retired object is freed once the global epoch has advanced
+    twice, at that point no reader can be holding it.
+
+    Every reader thread claims a slot on first use and publishes the
+    epoch it is in to the slot. The global epoch advances only when all
+    the active readers are in the current epoch. If all the slots are
+    taken the reader counts itself in the shared overflow counter of
+    its epoch instead.
+
+    The epochs nest, a thread that is in an epoch can enter it again.
+
+--*/
+class CEpochManager
+{
+public:
+    typedef void (*PFN_RECLAIM)(PVOID Object);
+
+protected:
+    //
+    // One reader slot, padded to the cache line so the readers do not share
+    // the line. State is (epoch << 1) | 1 while the reader is in an epoch
+    //
+    struct DECLSPEC_ALIGN(64) EPOCH_SLOT
+    {
+        LONG volatile   State;
+        LONG            Nest;
+    };
+
+    struct RETIRED
+    {
+        PVOID           Object;
+        PFN_RECLAIM     Reclaim;
+    };
+
+    EPOCH_SLOT          m_Slots[EPOCH_MAX_SLOTS];
+    LONG volatile       m_nSlots;           // Slots claimed so far
+    DWORD               m_dwTlsIndex;       // Slot index + 1 of the thread
+
+    LONG volatile       m_nEpoch;           // The global epoch
+    LONG volatile       m_nOverflow[EPOCH_COUNT];   // Readers without a slot in each epoch
+    std::deque<RETIRED> m_Retired[EPOCH_COUNT];
+    CLock               m_RetireLock;
+
+    //
+    // Returns the slot of the thread, claiming one if required. Returns
+    // NULL if all of the slots are taken
+    //
+    EPOCH_SLOT* GetSlot(void);
+
+    //
+    // Enter/Leave for the threads without a slot
+    //
+    void EnterOverflow(void);
+    void LeaveOverflow(void);
+
+    //
+    // Advances the global epoch if all the readers are in the current
+    // epoch and frees the objects retired two epochs back. Called with
+    // the retire lock held
+    //
+    void TryAdvance(void);
+
+    template <class T>
+    static void DeleteObject(PVOID Object) {
+        delete (T*)Object;
+    }
+
+    // C'tor/D'tor
+public:
+    CEpochManager(void);
+    ~CEpochManager(void);
+
+public:
+    //
+    // Enter/Leave the read side of the epoch
+    //
+    void Enter(void);
+    void Leave(void);
+
+    //
+    // Frees the object once the readers that could be holding it are gone
+    //
+    void Retire(
+        _In_ PVOID Object,
+        _In_ PFN_RECLAIM Reclaim
+        );
+
+    template <class T>
+    inline void Retire(_In_ T* Object) {
+        if (Object != NULL) Retire(Object, &CEpochManager::DeleteObject<T>);
+    }
+};
+
+
+// Keeps the thread in the epoch for the scope
+class CEpochGuard
+{
+private:
+    CEpochManager&  m_Epochs;
+
+public:
+    CEpochGuard(CEpochManager& Epochs) : m_Epochs(Epochs) { m_Epochs.Enter(); }
+    ~CEpochGuard() { m_Epochs.Leave(); }
+};
@@ -0,0 +1,368 @@
+/*++
+
+    Copyright (c) Pai Financials LLC.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    FetchQueue.cpp
+
+Abstract:
+
+    Implements the priority queue of the tickers to query
+
+Author:
+
+    nabieasaurus
+
+--*/
+#include "StdAfx.h"
+#include "FetchQueue.h"
+
+//
+// The parts of the score. The misses go before the refreshes, and those
+// before the prefetches, unless the earnings date is close
+//
+#define FETCH_SCORE_MISS            500
+#define FETCH_SCORE_REFRESH         200
+#define FETCH_SCORE_PREFETCH        0
+#define FETCH_SCORE_UNCONFIRMED     50
+#define FETCH_SCORE_REQUESTED       100
+
+//
+// The score for the days to the earnings date, the first entry that has
+// the days within its limit applies
+//
+static const struct
+{
+    INT     Days;
+    INT     Score;
+} FetchDaysScore[] = {
+    { 1, 300 },
+    { 7, 200 },
+    { 14, 100 },
+    { 30, 50 },
+};
+
+//
+// The lowest score of the priority classes, the last class takes the rest
+//
+static const INT FetchPriorityScore[FetchPriorityCount - 1] = { 600, 450, 300 };
+
+//
+// The upper bound in milliseconds of the wait histogram buckets
+//
+static const DWORD FetchWaitLimits[FETCH_WAIT_BUCKETS] = {
+    10, 100, 1000, 10 * 1000, 60 * 1000, 10 * 60 * 1000, MAXDWORD };
+
+
+CFetchQueue::CFetchQueue(
+    void
+    )
+/*++
+
+Routine Description:
+
+    This is the default constructor for the CFetchQueue
+
+--*/
+{
+    m_nSequence = 0;
+    ZeroMemory((PVOID)m_nDepth, sizeof(m_nDepth));
+    ZeroMemory((PVOID)m_Waits, sizeof(m_Waits));
+}
+
+
+_Use_decl_annotations_
+DWORD
+CFetchQueue::WaitLimit(
+    INT Bucket
+    )
+/*++
+
+Routine Description:
+
+    Returns the upper bound of the wait histogram bucket in milliseconds
+
+--*/
+{
+    return FetchWaitLimits[Bucket];
+}
+
+
+_Use_decl_annotations_
+INT
+CFetchQueue::Score(
+    const FETCH_REQUEST& Request
+    )
+/*++
+
+Routine Description:
+
+    Computes the score of the request, the higher score is queried first
+
+Parameters:
+
+    Request - What is known about the ticker
+
+Return Value:
+
+    The score
+
+--*/
+{
+    INT score = (Request.Kind == FetchMiss) ? FETCH_SCORE_MISS :
+        ((Request.Kind == FetchRefresh) ? FETCH_SCORE_REFRESH : FETCH_SCORE_PREFETCH);
+
+    if (Request.DaysToEarnings != FETCH_DAYS_UNKNOWN)
+    {
+        INT days = (Request.DaysToEarnings < 0) ? -Request.DaysToEarnings : Request.DaysToEarnings;
+
+        for (int nCtr = 0; nCtr < _countof(FetchDaysScore); nCtr++)
+        {
+            if (days <= FetchDaysScore[nCtr].Days)
+            {
+                score += FetchDaysScore[nCtr].Score;
+                break;
+            }
+        }
+
+        if (Request.Confirmed == false) { score += FETCH_SCORE_UNCONFIRMED; }
+    }
+
+    if (Request.Requested == true) { score += FETCH_SCORE_REQUESTED; }
+
+    return score;
+}
+
+
+_Use_decl_annotations_
+EFetchPriority
+CFetchQueue::Priority(
+    INT Score
+    )
+/*++
+
+Routine Description:
+
+    Returns the priority class of the score
+
+--*/
+{
+    int nCtr;
+
+    for (nCtr = 0; nCtr < _countof(FetchPriorityScore); nCtr++)
+    {
+        if (Score >= FetchPriorityScore[nCtr]) { break; }
+    }
+
+    return (EFetchPriority)nCtr;
+}
+
+
+_Use_decl_annotations_
+void
+CFetchQueue::Insert(
+    const ENTRY& Entry
+    )
+/*++
+
+Routine Description:
+
+    Adds the entry to the set and the map. Called with the lock held
+
+--*/
+{
+    m_Entries.insert(Entry);
+    m_Queued[Entry.Ticker] = Entry;
+    InterlockedIncrement(&m_nDepth[Priority(Entry.Score)]);
+}
+
+
+_Use_decl_annotations_
+void
+CFetchQueue::Remove(
+    const ENTRY& Entry
+    )
+/*++
+
+Routine Description:
+
+    Removes the entry from the set and the map. Called with the lock held
+
+--*/
+{
+    InterlockedDecrement(&m_nDepth[Priority(Entry.Score)]);
+    m_Entries.erase(Entry);
+    m_Queued.Erase(Entry.Ticker);
+}
+
+
+_Use_decl_annotations_
+bool
+CFetchQueue::Push(
+    const FETCH_REQUEST& Request
+    )
+/*++
+
+Routine Description:
+
+    Queues the ticker with the score of the request. If the ticker is
+    already queued it keeps its place in the arrival order and only its
+    score is raised.
+
+Parameters:
+
+    Request - The ticker and what is known about it
+
+Return Value:
+
+    true - if the ticker was queued
+    false - if the ticker was already in the queue
+
+--*/
+{
+    CAutoLock   al(m_Lock);
+    ENTRY*      pQueued = m_Queued.Find(Request.Ticker);
+    ENTRY       entry;
+
+    entry.Score = Score(Request);
+    entry.Requested = Request.Requested;
+    entry.Ticker = Request.Ticker;
+
+    if (pQueued != NULL)
+    {
+        ENTRY queued = *pQueued;
+
+        if (entry.Score > queued.Score)
+        {
+            entry.Sequence = queued.Sequence;
+            entry.dwQueued = queued.dwQueued;
+            entry.Requested = entry.Requested || queued.Requested;
+
+            Remove(queued);
+            Insert(entry);
+        }
+
+        return false;
+    }
+
+    entry.Sequence = m_nSequence++;
+    entry.dwQueued = GetTickCount();
+    Insert(entry);
+
+    return true;
+}
+
+
+_Use_decl_annotations_
+void
+CFetchQueue::Touch(
+    const TICKER_KEY& Ticker
+    )
+/*++
+
+Routine Description:
+
+    Adds the bonus of a recent request to the score of the queued ticker,
+    once
+
+Parameters:
+
+    Ticker - The ticker symbol in upper case
+
+--*/
+{
+    CAutoLock   al(m_Lock);
+    ENTRY*      pQueued = m_Queued.Find(Ticker);
+
+    if ((pQueued == NULL) || (pQueued->Requested == true)) { return; }
+
+    ENTRY queued = *pQueued;
+    ENTRY entry = queued;
+
+    entry.Score += FETCH_SCORE_REQUESTED;
+    entry.Requested = true;
+
+    Remove(queued);
+    Insert(entry);
+}
+
+
+_Use_decl_annotations_
+bool
+CFetchQueue::Pop(
+    TICKER_KEY& Ticker
+    )
+/*++
+
+Routine Description:
+
+    Takes the ticker with the highest score and adds the time it waited
+    to the histogram of its priority class
+
+Parameters:
+
+    Ticker - Returns the ticker to query
+
+Return Value:
+
+    true - if a ticker was taken
+    false - if the queue is empty
+
+--*/
+{
+    CAutoLock al(m_Lock);
+
+    if (m_Entries.empty()) { return false; }
+
+    ENTRY   entry = *m_Entries.begin();
+    DWORD   dwWaited = GetTickCount() - entry.dwQueued;
+    int     nBucket;
+
+    Remove(entry);
+    Ticker = entry.Ticker;
+
+    for (nBucket = 0; nBucket < FETCH_WAIT_BUCKETS - 1; nBucket++)
+    {
+        if (dwWaited < FetchWaitLimits[nBucket]) { break; }
+    }
+
+    InterlockedIncrement(&m_Waits[Priority(entry.Score)][nBucket]);
+
+    return true;
+}
+
+
+UINT32
+CFetchQueue::Size(
+    void
+    )
+/*++
+
+Routine Description:
+
+    Returns the number of tickers in the queue
+
+--*/
+{
+    CAutoLock al(m_Lock);
+    return (UINT32)m_Entries.size();
+}
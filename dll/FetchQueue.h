@@ -0,0 +1,194 @@
+/*++
+
+    Copyright (c) Pai Financials LLC.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    FetchQueue.h
+
+Abstract:
+
+    Priority queue of the tickers waiting to be queried from the website
+
+Author:
+
+    nabieasaurus
+
+--*/
+#pragma once
+
+#include "Lock.h"
+#include "TickerMap.h"
+
+//
+// The priority classes of the queue, the histograms are kept per class
+//
+enum EFetchPriority
+{
+    FetchUrgent,
+    FetchHigh,
+    FetchNormal,
+    FetchLow,
+    FetchPriorityCount,
+};
+
+//
+// Why the ticker is queried
+//
+enum EFetchKind
+{
+    FetchMiss,                          // Not in the cache, the caller has nothing to show
+    FetchRefresh,                       // In the cache and due for a requery
+    FetchPrefetch,                      // Warming up the cache, nobody asked for it yet
+};
+
+#define FETCH_DAYS_UNKNOWN          MAXINT      // The earnings date is not known
+#define FETCH_WAIT_BUCKETS          7           // Wait histogram buckets, see FetchWaitLimits
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// struct
+//      FETCH_REQUEST
+//
+// abstract
+//      What is known about the ticker when it is queued, used to rank it
+//
+struct FETCH_REQUEST
+{
+    TICKER_KEY  Ticker;
+    EFetchKind  Kind;
+    INT         DaysToEarnings;         // FETCH_DAYS_UNKNOWN if there is no date
+    bool        Confirmed;
+    bool        Requested;              // A caller asked for the ticker just now
+};
+
+
+/*++
+
+Class Name:
+
+    CFetchQueue
+
+Class Description:
+
+    The tickers waiting for the fetch threads, highest score first and in
+    the order they were queued for the same score. The score favors the
+    misses over the refreshes and the prefetches, the earnings dates that
+    are close, the dates that are not confirmed and the tickers that the
+    callers asked for recently. A ticker is queued once, queueing it again
+    or asking for it while it waits raises its score.
+
+    The depth of the queue and the histogram of the time waited in the
+    queue are kept for every priority class, to check that the urgent
+    tickers go first.
+
+--*/
+class CFetchQueue
+{
+protected:
+    struct ENTRY
+    {
+        INT         Score;
+        UINT32      Sequence;           // Orders the same score by arrival
+        DWORD       dwQueued;           // Tick count when the ticker was queued
+        bool        Requested;          // The score has the bonus for a caller asking
+        TICKER_KEY  Ticker;
+
+        bool operator < (const ENTRY& Entry) const {
+            if (Score != Entry.Score) return Score > Entry.Score;
+            return Sequence < Entry.Sequence;
+        }
+    };
+
+    std::set<ENTRY>     m_Entries;
+    CTickerMap<ENTRY>   m_Queued;           // Ticker to its entry in the set
+    UINT32              m_nSequence;
+    CLock               m_Lock;
+
+    LONG volatile       m_nDepth[FetchPriorityCount];
+    LONG volatile       m_Waits[FetchPriorityCount][FETCH_WAIT_BUCKETS];
+
+    void Insert(
+        _In_ const ENTRY& Entry
+        );
+
+    void Remove(
+        _In_ const ENTRY& Entry
+        );
+
+    // Not copyable
+    CFetchQueue(const CFetchQueue&);
+    CFetchQueue& operator = (const CFetchQueue&);
+
+    // C'tor/D'tor
+public:
+    CFetchQueue(void);
+    ~CFetchQueue(void) { }
+
+    // Properties
+public:
+    inline LONG GetDepth(_In_ INT Priority) { return m_nDepth[Priority]; }
+    inline LONG GetWaits(_In_ INT Priority, _In_ INT Bucket) { return m_Waits[Priority][Bucket]; }
+
+    //
+    // The upper bound in milliseconds of the wait histogram bucket
+    //
+    static DWORD WaitLimit(_In_ INT Bucket);
+
+    // Operations
+public:
+    //
+    // Returns the score and the priority class of the request
+    //
+    static INT Score(
+        _In_ const FETCH_REQUEST& Request
+        );
+
+    static EFetchPriority Priority(
+        _In_ INT Score
+        );
+
+    //
+    // Queues the ticker. Returns false if the ticker was already queued,
+    // its score is raised if the new request scores higher
+    //
+    bool Push(
+        _In_ const FETCH_REQUEST& Request
+        );
+
+    //
+    // Raises the score of the queued ticker that a caller asked for again
+    //
+    void Touch(
+        _In_ const TICKER_KEY& Ticker
+        );
+
+    //
+    // Takes the ticker with the highest score. Returns false if the queue
+    // is empty
+    //
+    bool Pop(
+        _Out_ TICKER_KEY& Ticker
+        );
+
+    UINT32 Size(void);
+};
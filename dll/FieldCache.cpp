@@ -0,0 +1,200 @@
+/*++
+
+    Copyright (c) Pai Financials LLC.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+Module Name:
+
+    FieldCache.cpp
+
+Abstract:
+
+    Implements the memoized text of the date fields
+
+Author:
+
+    nabieasaurus
+
+--*/
+#include "StdAfx.h"
+#include "FieldCache.h"
+
+#define SECONDS_IN_DAY              (24 * 60 * 60)
+
+
+CFieldCache::CFieldCache(
+    void
+    )
+/*++
+
+Routine Description:
+
+    This is the default constructor for the CFieldCache
+
+--*/
+{
+    ZeroMemory((PVOID)m_pDates, sizeof(m_pDates));
+    ZeroMemory(m_Days, sizeof(m_Days));
+    m_nToday = 0;
+    m_nNextRollover = 0;
+    m_nFormatted = 0;
+}
+
+
+CFieldCache::~CFieldCache(
+    void
+    )
+/*++
+
+Routine Description:
+
+    This is the default destructor for the CFieldCache
+
+--*/
+{
+    for (int nCtr = 0; nCtr < _countof(m_pDates); nCtr++)
+    {
+        delete [] m_pDates[nCtr];
+    }
+}
+
+
+void
+CFieldCache::CheckRollover(
+    void
+    )
+/*++
+
+Routine Description:
+
+    Recomputes the eastern day index and the time of the next eastern
+    midnight. Today is published before the next rollover so the readers
+    that skip the check see the new day.
+
+--*/
+{
+    CAutoLock   al(m_Lock);
+    CFeedTime   ftNow(FT_CURRENT);
+    UINT32      nowUtc = ftNow.GetUtcTime();
+
+    if (nowUtc < m_nNextRollover) { return; }
+
+    UINT32      nowEastern = ftNow.GetNyseTime();
+
+    InterlockedExchange((LONG volatile*)&m_nToday, (LONG)(nowEastern / SECONDS_IN_DAY));
+    InterlockedExchange((LONG volatile*)&m_nNextRollover,
+        (LONG)(nowUtc + (SECONDS_IN_DAY - (nowEastern % SECONDS_IN_DAY))));
+
+    LogTrace("Eastern day rolled over to %d", m_nToday);
+}
+
+
+_Use_decl_annotations_
+LPCSTR
+CFieldCache::GetDateText(
+    UINT32 EarningsTime
+    )
+/*++
+
+Routine Description:
+
+    Returns the earnings date in the long format. The date is formatted
+    the first time the day is asked for, the eastern conversion is not
+    repeated for the other symbols reporting on the same day.
+
+Parameters:
+
+    EarningsTime - The utc time of the earnings date
+
+--*/
+{
+    UINT32 day = EarningsTime / SECONDS_IN_DAY;
+    UINT32 chunk = day / FIELD_DAY_CHUNK_SIZE;
+
+    if (chunk >= FIELD_DAY_MAX_CHUNKS) { return ""; }
+
+    DATE_TEXT* pChunk = m_pDates[chunk];
+    if ((pChunk != NULL) && pChunk[day % FIELD_DAY_CHUNK_SIZE].IsValid)
+    {
+        return pChunk[day % FIELD_DAY_CHUNK_SIZE].Text;
+    }
+
+    CAutoLock al(m_Lock);
+
+    if (m_pDates[chunk] == NULL)
+    {
+        m_pDates[chunk] = new DATE_TEXT[FIELD_DAY_CHUNK_SIZE]();
+    }
+
+    DATE_TEXT* pText = &m_pDates[chunk][day % FIELD_DAY_CHUNK_SIZE];
+    if (pText->IsValid == false)
+    {
+        CFeedTime(TzUtc, EarningsTime).ToStringLong(pText->Text);
+        m_nFormatted++;
+
+        //
+        // Publish the text
+        //
+        MemoryBarrier();
+        pText->IsValid = true;
+    }
+
+    return pText->Text;
+}
+
+
+_Use_decl_annotations_
+LPCSTR
+CFieldCache::GetDaysText(
+    INT Days
+    )
+/*++
+
+Routine Description:
+
+    Returns the days to earnings in the "NN Days" format. The days beyond
+    FIELD_DAYS_RANGE are clamped, the earnings are never that far out.
+
+Parameters:
+
+    Days - The days to earnings
+
+--*/
+{
+    if (Days < -FIELD_DAYS_RANGE) { Days = -FIELD_DAYS_RANGE; }
+    if (Days >= FIELD_DAYS_RANGE) { Days = FIELD_DAYS_RANGE - 1; }
+
+    DAYS_TEXT* pText = &m_Days[Days + FIELD_DAYS_RANGE];
+    if (pText->IsValid) { return pText->Text; }
+
+    CAutoLock al(m_Lock);
+
+    if (pText->IsValid == false)
+    {
+        sprintf_s(pText->Text, "%02d Days", Days);
+        m_nFormatted++;
+
+        MemoryBarrier();
+        pText->IsValid = true;
+    }
+
+    return pText->Text;
+}
@@ -0,0 +1,138 @@
+/*++
+
+    Copyright (c) Pai Financials LLC.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+Module Name:
+
+    FieldCache.h
+
+Abstract:
+
+    Memoized text of the date fields returned by the getters
+
+Author:
+
+    nabieasaurus
+
+--*/
+#pragma once
+
+#include "Lock.h"
+#include "FeedTime.h"
+
+#define FIELD_DAY_CHUNK_SIZE        1024
+#define FIELD_DAY_MAX_CHUNKS        64          // Day index upto 64K, year 2149
+#define FIELD_DATE_SIZE             32
+#define FIELD_DAYS_SIZE             16
+#define FIELD_DAYS_RANGE            1024        // Days text is memoized for -N..N-1
+
+
+/*++
+
+Class Name:
+
+    CFieldCache
+
+Class Description:
+
+    The text of the earnings date and of the days to earnings depends only
+    on the earnings date and on today, so it is memoized by value instead
+    of per record. The date text is formatted the first time a date is
+    asked for and kept in a table indexed by the day of the date. There
+    are only a few hundred distinct earnings dates at any time, so this
+    is a small table for any number of symbols.
+
+    The days to earnings is the day of the earnings date less today.
+    Today is the eastern day index and is recomputed once at the eastern
+    midnight, not on every call. The text for the days is memoized by
+    the number of days.
+
+    The text is never changed once it is published, the readers do not
+    take the lock.
+
+--*/
+class CFieldCache
+{
+protected:
+    struct DATE_TEXT
+    {
+        CHAR            Text[FIELD_DATE_SIZE];
+        bool volatile   IsValid;
+    };
+
+    struct DAYS_TEXT
+    {
+        CHAR            Text[FIELD_DAYS_SIZE];
+        bool volatile   IsValid;
+    };
+
+    DATE_TEXT* volatile m_pDates[FIELD_DAY_MAX_CHUNKS];
+    DAYS_TEXT           m_Days[2 * FIELD_DAYS_RANGE];
+    CLock               m_Lock;
+
+    INT32 volatile      m_nToday;           // Eastern day index
+    UINT32 volatile     m_nNextRollover;    // Utc time of the next eastern midnight
+    LONG volatile       m_nFormatted;       // Number of strings formatted
+
+    //
+    // Recomputes today if the eastern midnight has passed
+    //
+    void CheckRollover(void);
+
+    // C'tor/D'tor
+public:
+    CFieldCache(void);
+    ~CFieldCache(void);
+
+public:
+    //
+    // Returns the eastern day index for today
+    //
+    inline INT32 GetToday(void) {
+        if ((UINT32)_time32(NULL) >= m_nNextRollover) CheckRollover();
+        return m_nToday;
+    }
+
+    //
+    // Returns the days from today to the earnings date. The earnings dates
+    // are eastern midnight, so the utc day index is the eastern day index
+    //
+    inline INT GetDaysTo(_In_ UINT32 EarningsTime) {
+        return (INT)(EarningsTime / (24 * 60 * 60)) - GetToday();
+    }
+
+    //
+    // Returns the earnings date in the long format
+    //
+    LPCSTR GetDateText(
+        _In_ UINT32 EarningsTime
+        );
+
+    //
+    // Returns the days to earnings in the "NN Days" format
+    //
+    LPCSTR GetDaysText(
+        _In_ INT Days
+        );
+
+    inline LONG Formatted(void) const { return m_nFormatted; }
+};
@@ -169,10 +169,11 @@ Abstract:
     
 --*/
 {
-    String      httpString;
-    CHAR        chBuffer[512];
-    CFeedTime   currentTime(FT_CURRENT);
-    CFeedTime   startOfWeek(currentTime);
+    String          httpString;
+    CHAR            chBuffer[512];
+    CFeedTime       currentTime(FT_CURRENT);
+    CFeedTime       startOfWeek(currentTime);
+    FXEVENTS_QUEUE  fxEvents;
 
 
     //
@@ -203,12 +204,11 @@ Abstract:
     }
 
     //
-    // Clear the cache, Parse the response and populate the earnings queue
+    // Parse the response and populate a new events queue, the current
+    // queue is kept until the new one is complete
     //
     LPSTR       szHttpData = (LPSTR) httpString.c_str();
     int         lineCtr = 0;
-    
-    m_FxEventsQueue.clear();
 
     while (szHttpData != NULL)
     {
@@ -262,18 +262,15 @@ Abstract:
 
         if (fxDate >= currentTime)
         {
-            PFOREX_EVENT ptrFxEvent = new FOREX_EVENT(fxDate, szValue[3], szValue[4], szValue[5]);
-            if (ptrFxEvent != NULL)
-            {
-                //ptrFxEvent->Dump();
-                m_FxEventsQueue.push_back(ptrFxEvent);
-            }
+            fxEvents.push_back(FOREX_EVENT(fxDate, szValue[3], szValue[4], szValue[5]));
         }
     }
 
     //
-    // Parsing successful. Update the query time
+    // Parsing successful. Swap in the new queue, the old events are
+    // freed with it, and update the query time
     //
+    m_FxEventsQueue.swap(fxEvents);
     m_QueryTime = currentTime;
 
 Cleanup:
@@ -283,9 +280,11 @@ Cleanup:
 
 
 
-PFOREX_EVENT
+_Use_decl_annotations_
+bool
 CForexMgr::GetNextFxEvent(
-    LPCSTR CurrencyPair
+    LPCSTR CurrencyPair,
+    FOREX_EVENT& Event
     )
 /*++
 
@@ -294,6 +293,9 @@ Abstract:
     Also periodically downloads the events from DailyFx even if the data is cached. This is
     done so that we get fresh data every interval specified.
 
+    The event is copied out under the lock, so the caller never holds on to
+    an event of a queue that was replaced.
+
 --*/
     
 {
@@ -333,10 +335,10 @@ Abstract:
             //
             // Try to find one event that corresponds with currency pair
             //
-            if ((strstr(szCurPair, (*fxIt)->StrCurrency) != NULL) &&
-                ((*fxIt)->EventDateTime >= currentTime))
+            if ((strstr(szCurPair, fxIt->StrCurrency) != NULL) &&
+                (fxIt->EventDateTime >= currentTime))
             {
-                retVal = *fxIt;
+                retVal = &(*fxIt);
                 if (retVal->EventImportance >= 3)
                     break;
             }
@@ -347,11 +349,11 @@ Abstract:
             // Check if there are events that are at the same time with
             // higher priority
             //
-            if ((strstr(szCurPair, (*fxIt)->StrCurrency) != NULL) &&
-                (retVal->EventDateTime == (*fxIt)->EventDateTime) &&
-                (retVal->EventImportance < (*fxIt)->EventImportance))
+            if ((strstr(szCurPair, fxIt->StrCurrency) != NULL) &&
+                (retVal->EventDateTime == fxIt->EventDateTime) &&
+                (retVal->EventImportance < fxIt->EventImportance))
             {
-                retVal = *fxIt;
+                retVal = &(*fxIt);
             }
             else
             {
@@ -360,6 +362,10 @@ Abstract:
         }
     }
 
+    if (retVal != NULL)
+    {
+        Event = *retVal;
+    }
 
-    return retVal;
+    return (retVal != NULL);
 }
\ No newline at end of file
@@ -66,6 +66,11 @@ protected:
 
     // Constructors
 public:
+    FOREX_EVENT(void) : EventImportance(0) {
+        StrCurrency[0] = StrEventDate[0] = StrEventTime[0] = '\0';
+        StrEventDesc[0] = StrDuration[0] = '\0';
+    }
+
     FOREX_EVENT(
         CFeedTime Time,
         LPCSTR Currency,
@@ -105,11 +110,12 @@ public:
 };
 
 //
-// Data structure to hold the events
+// Data structure to hold the events. The queue owns the events, a refresh
+// builds a new queue and swaps it in
 //
 typedef FOREX_EVENT*                        PFOREX_EVENT;
-typedef std::deque<PFOREX_EVENT>            FXEVENTS_QUEUE;
-typedef std::deque<PFOREX_EVENT>::iterator  FXEVENTS_QUEUE_IT;
+typedef std::deque<FOREX_EVENT>             FXEVENTS_QUEUE;
+typedef std::deque<FOREX_EVENT>::iterator   FXEVENTS_QUEUE_IT;
 
 
 
@@ -164,10 +170,15 @@ public:
     void Dump() {
         for (FXEVENTS_QUEUE_IT fxIt = m_FxEventsQueue.begin(); 
             fxIt != m_FxEventsQueue.end(); fxIt++)
-            (*fxIt)->Dump();
+            fxIt->Dump();
     }
 
-    PFOREX_EVENT GetNextFxEvent(
-        LPCSTR CurrencyPair
+    //
+    // Copies the next event of the currency pair, the queue can be
+    // replaced by the next refresh once the lock is released
+    //
+    bool GetNextFxEvent(
+        _In_ LPCSTR CurrencyPair,
+        _Out_ FOREX_EVENT& Event
         );
 };
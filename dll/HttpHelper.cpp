@@ -80,7 +80,8 @@ _Use_decl_annotations_
 bool
 CHttpWinInet::InitializeA(
     LPCSTR szUserAgent,
-    LPCSTR szServer
+    LPCSTR szServer,
+    INTERNET_PORT nPort
     )
 {
     bool retVal = false;
@@ -96,7 +97,7 @@ CHttpWinInet::InitializeA(
 
 
     // Connect to the http server
-    m_hConnection = InternetConnectA(m_hSession, szServer, INTERNET_DEFAULT_HTTP_PORT,
+    m_hConnection = InternetConnectA(m_hSession, szServer, nPort,
         NULL, NULL, INTERNET_SERVICE_HTTP, 0, NULL);
     CHK_EXP_ERR(m_hConnection == NULL, "InternetConnectA");
 
@@ -112,7 +113,8 @@ Cleanup:
 _Use_decl_annotations_
 bool
 CHttpWinInet::RecvResponse(
-    std::string& Response
+    std::string& Response,
+    PDWORD StatusCode
     )
 {
     CHAR chBuffer[4096] = {};
@@ -148,6 +150,8 @@ CHttpWinInet::RecvResponse(
     }
 
 Cleanup:
+    if (StatusCode != NULL) { *StatusCode = dwStatusCode; }
+
     if (m_hRequest != NULL)
     {
         InternetCloseHandle(m_hRequest);
@@ -305,7 +309,8 @@ Cleanup:
 _Use_decl_annotations_
 bool
 CHttpWinInetSecure::RecvResponse(
-    std::string& Response
+    std::string& Response,
+    PDWORD StatusCode
     )
 {
     CHAR chBuffer[4096] = {};
@@ -341,6 +346,8 @@ CHttpWinInetSecure::RecvResponse(
 
 Cleanup:
 
+    if (StatusCode != NULL) { *StatusCode = dwStatusCode; }
+
     if (m_hRequest != NULL)
     {
         InternetCloseHandle(m_hRequest);
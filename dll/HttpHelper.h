@@ -73,14 +73,16 @@ public:
     //
     // Initialize in ascii
     //
-    bool InitializeA(_In_ LPCSTR szUserAgent, _In_ LPCSTR szServer);
+    bool InitializeA(_In_ LPCSTR szUserAgent, _In_ LPCSTR szServer,
+        _In_ INTERNET_PORT nPort = INTERNET_DEFAULT_HTTP_PORT);
 
 
 public:
     //
-    // Receive response for the request sent
+    // Receive response for the request sent. Returns the http status code
+    // of the response, 0 if there was none
     //
-    bool RecvResponse(_Inout_ std::string& String);
+    bool RecvResponse(_Inout_ std::string& String, _Out_opt_ PDWORD StatusCode = NULL);
 
     //
     // Send a request to the server in unicode
@@ -176,9 +178,10 @@ public:
 public:
 
     //
-    // Receive response for the request sent
+    // Receive response for the request sent. Returns the http status code
+    // of the response, 0 if there was none
     //
-    bool RecvResponse(_Inout_ std::string& String);
+    bool RecvResponse(_Inout_ std::string& String, _Out_opt_ PDWORD StatusCode = NULL);
 
     //
     // Send a request to the server in unicode
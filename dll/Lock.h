@@ -38,6 +38,8 @@ Author:
 // Lock management
 class CLock
 {
+    friend class CCondition;
+
 private:
     CRITICAL_SECTION    m_cs;
 
@@ -47,6 +49,7 @@ public:
 
 public:
     void Lock() { EnterCriticalSection(&m_cs);  }
+    bool TryLock() { return TryEnterCriticalSection(&m_cs) != FALSE; }
     void Unlock() { LeaveCriticalSection(&m_cs); }
 };
 
@@ -61,3 +64,22 @@ public:
     CAutoLock(CLock& Lock) : m_Lock(Lock) { m_Lock.Lock(); }
     ~CAutoLock() { m_Lock.Unlock(); }
 };
+
+
+// Condition variable used with the lock
+class CCondition
+{
+private:
+    CONDITION_VARIABLE  m_cv;
+
+public:
+    CCondition() { InitializeConditionVariable(&m_cv); }
+
+public:
+    // The lock must be held by the caller, it is released while waiting
+    bool Wait(CLock& Lock, DWORD Milliseconds = INFINITE) {
+        return SleepConditionVariableCS(&m_cv, &Lock.m_cs, Milliseconds) != FALSE;
+    }
+
+    void WakeAll() { WakeAllConditionVariable(&m_cv); }
+};
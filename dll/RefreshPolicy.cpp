@@ -0,0 +1,213 @@
+/*++
+
+    Copyright (c) Pai Financials LLC.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+Module Name:
+
+    RefreshPolicy.cpp
+
+Abstract:
+
+    Implements the policies that decide when the earnings data is queried
+    again
+
+Author:
+
+    nabieasaurus
+
+--*/
+#include "StdAfx.h"
+#include "RefreshPolicy.h"
+#include "FeedTime.h"
+
+#define SECS_PER_DAY                TIME_IN_SECS(24, 0, 0)
+
+
+_Use_decl_annotations_
+void
+CRefreshPolicy::SetPolicy(
+    ERefreshPolicy Policy,
+    const REFRESH_INTERVALS& Intervals
+    )
+/*++
+
+Routine Description:
+
+    Sets the policy and the intervals of the adaptive policy. Called
+    before the cache is loaded
+
+Parameters:
+
+    Policy - The policy that decides the refresh time
+
+    Intervals - The intervals in days
+
+--*/
+{
+    CAutoLock al(m_Lock);
+
+    m_Policy = ((UINT32)Policy < RefreshPolicyCount) ? Policy : RefreshPolicyAdaptive;
+    m_Intervals = Intervals;
+
+    if (m_Intervals.NearUnconfirmedDays == 0) { m_Intervals.NearUnconfirmedDays = 1; }
+    if (m_Intervals.NearConfirmedDays == 0) { m_Intervals.NearConfirmedDays = 1; }
+    if (m_Intervals.FarUnconfirmedDays == 0) { m_Intervals.FarUnconfirmedDays = 1; }
+    if (m_Intervals.FarConfirmedDays == 0) { m_Intervals.FarConfirmedDays = 1; }
+    if (m_Intervals.ChangedDays == 0) { m_Intervals.ChangedDays = 1; }
+    if (m_Intervals.FixedRandDays == 0) { m_Intervals.FixedRandDays = 1; }
+}
+
+
+_Use_decl_annotations_
+UINT32
+CRefreshPolicy::GetRefreshTime(
+    const TICKER_KEY& Ticker,
+    bool Confirmed,
+    UINT32 QueryDate,
+    UINT32 EarningsDate
+    )
+/*++
+
+Routine Description:
+
+    Returns the time the record is due for a query. The interval is
+    picked by the days from the query to the earnings date and if the
+    date was confirmed, and is cut short if the date moved on the last
+    query. The due time is spread by the ticker hash over a part of the
+    interval so the records queried together are not due together.
+
+    Whatever the interval, the record is due when it enters the near
+    window and a few days after the earnings date, to get the next date.
+
+    The fixed policy is the rule of the older releases: every record a
+    few days after the query, spread over a few more days, or after the
+    earnings date.
+
+Parameters:
+
+    Ticker - The ticker symbol in upper case
+
+    Confirmed - If the earnings date is confirmed
+
+    QueryDate - The utc time of the last query
+
+    EarningsDate - The earnings date
+
+Return Value:
+
+    The utc time the record is due
+
+--*/
+{
+    UINT32  spread = Ticker.Hash() >> 1;
+    UINT32  due, cap;
+
+    if (m_Policy == RefreshPolicyFixed)
+    {
+        due = QueryDate + (m_Intervals.FixedQueryDays + spread % m_Intervals.FixedRandDays + 1) * SECS_PER_DAY;
+        cap = EarningsDate + (m_Intervals.FixedPostDays + 1) * SECS_PER_DAY;
+
+        return (due < cap) ? due : cap;
+    }
+
+    CAutoLock   al(m_Lock);
+    INT         daysTo = (INT)(EarningsDate / SECS_PER_DAY) - (INT)(QueryDate / SECS_PER_DAY);
+    UINT32      interval;
+
+    if (daysTo <= (INT)m_Intervals.NearDays)
+    {
+        //
+        // Past the date the website has no new date yet, query it daily
+        //
+        interval = ((daysTo >= 0) && (Confirmed == true)) ? m_Intervals.NearConfirmedDays :
+            m_Intervals.NearUnconfirmedDays;
+    }
+    else
+    {
+        interval = (Confirmed == true) ? m_Intervals.FarConfirmedDays : m_Intervals.FarUnconfirmedDays;
+    }
+
+    if ((m_Changed.Find(Ticker) != NULL) && (m_Intervals.ChangedDays < interval))
+    {
+        interval = m_Intervals.ChangedDays;
+    }
+
+    interval *= SECS_PER_DAY;
+    due = QueryDate + interval + spread % (interval / REFRESH_SPREAD_DIVISOR);
+
+    //
+    // Due as the date enters the near window and after the earnings date
+    //
+    cap = EarningsDate - m_Intervals.NearDays * SECS_PER_DAY;
+    if ((daysTo > (INT)m_Intervals.NearDays) && (cap > QueryDate) && (cap < due)) { due = cap; }
+
+    cap = EarningsDate + m_Intervals.PostEarningsDays * SECS_PER_DAY;
+    if ((daysTo >= 0) && (cap > QueryDate) && (cap < due)) { due = cap; }
+
+    return due;
+}
+
+
+_Use_decl_annotations_
+void
+CRefreshPolicy::OnQueried(
+    const TICKER_KEY& Ticker,
+    bool Available,
+    UINT32 PreviousDate,
+    UINT32 EarningsDate,
+    UINT32 QueryDate
+    )
+/*++
+
+Routine Description:
+
+    Notes the tickers whose earnings date moved before the date was
+    reached, the move to the next quarter after the release is not a
+    change. A query that finds the date where it was clears the ticker.
+
+Parameters:
+
+    Ticker - The ticker symbol in upper case
+
+    Available - If the query found the earnings data
+
+    PreviousDate - The earnings date before the query, 0 if there was none
+
+    EarningsDate - The earnings date found by the query
+
+    QueryDate - The utc time of the query
+
+--*/
+{
+    CAutoLock al(m_Lock);
+
+    if ((Available == true) && (PreviousDate != 0) && (PreviousDate != EarningsDate) &&
+        (PreviousDate > QueryDate))
+    {
+        LogInfo("Earnings date moved for %s", Ticker.Chars);
+        m_Changed[Ticker] = PreviousDate;
+        return;
+    }
+
+    m_Changed.Erase(Ticker);
+}
+
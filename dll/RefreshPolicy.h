@@ -0,0 +1,201 @@
+/*++
+
+    Copyright (c) Pai Financials LLC.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+Module Name:
+
+    RefreshPolicy.h
+
+Abstract:
+
+    Decides when the earnings data of a ticker is queried again
+
+Author:
+
+    nabieasaurus
+
+--*/
+#pragma once
+
+#include "Lock.h"
+#include "TickerMap.h"
+
+//
+// The default intervals of the adaptive policy, in days. A date inside the
+// near window is refreshed daily till it is confirmed, a confirmed date far
+// out monthly. A date that moved on the last query is refreshed at the
+// changed interval, whichever is shorter
+//
+#define REFRESH_NEAR_DAYS               14
+#define REFRESH_NEAR_UNCONFIRMED_DAYS   1
+#define REFRESH_NEAR_CONFIRMED_DAYS     7
+#define REFRESH_FAR_UNCONFIRMED_DAYS    7
+#define REFRESH_FAR_CONFIRMED_DAYS      30
+#define REFRESH_CHANGED_DAYS            2
+#define REFRESH_POST_EARNINGS_DAYS      1
+
+//
+// The default settings of the fixed rule of the older releases, kept as
+// the baseline for the simulation. The ini entries of the older releases,
+// EarningsQueryDays, EarningsRandDays and PostEarningsDays, set them
+//
+#define REFRESH_FIXED_QUERY_DAYS        5
+#define REFRESH_FIXED_RAND_DAYS         5
+#define REFRESH_FIXED_POST_DAYS         3
+
+//
+// The due time is spread by the ticker hash over this part of the interval
+//
+#define REFRESH_SPREAD_DIVISOR          4
+
+//
+// The policies that decide the refresh time
+//
+enum ERefreshPolicy
+{
+    RefreshPolicyFixed,                 // Every record after the same number of days
+    RefreshPolicyAdaptive,              // By the earnings proximity and the confirmation
+    RefreshPolicyCount,
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// struct
+//      REFRESH_INTERVALS
+//
+// abstract
+//      The intervals of the adaptive and of the fixed policies in days, read
+//      from the ini file
+//
+struct REFRESH_INTERVALS
+{
+    UINT32      NearDays;               // The window before the earnings date
+    UINT32      NearUnconfirmedDays;
+    UINT32      NearConfirmedDays;
+    UINT32      FarUnconfirmedDays;
+    UINT32      FarConfirmedDays;
+    UINT32      ChangedDays;            // The date moved on the last query
+    UINT32      PostEarningsDays;       // After the earnings date, for the next date
+    UINT32      FixedQueryDays;         // The fixed policy, after the last query
+    UINT32      FixedRandDays;          // The fixed policy, spread over these days
+    UINT32      FixedPostDays;          // The fixed policy, after the earnings date
+
+    REFRESH_INTERVALS() :
+        NearDays(REFRESH_NEAR_DAYS),
+        NearUnconfirmedDays(REFRESH_NEAR_UNCONFIRMED_DAYS),
+        NearConfirmedDays(REFRESH_NEAR_CONFIRMED_DAYS),
+        FarUnconfirmedDays(REFRESH_FAR_UNCONFIRMED_DAYS),
+        FarConfirmedDays(REFRESH_FAR_CONFIRMED_DAYS),
+        ChangedDays(REFRESH_CHANGED_DAYS),
+        PostEarningsDays(REFRESH_POST_EARNINGS_DAYS),
+        FixedQueryDays(REFRESH_FIXED_QUERY_DAYS),
+        FixedRandDays(REFRESH_FIXED_RAND_DAYS),
+        FixedPostDays(REFRESH_FIXED_POST_DAYS) { }
+};
+
+
+/*++
+
+Class Name:
+
+    CRefreshPolicy
+
+Class Description:
+
+    Returns the utc time the earnings data of a ticker has to be queried
+    again, from the state of the record at its last query. The adaptive
+    policy spends the queries where the date can still move: the dates
+    close by that are not confirmed are refreshed daily, the confirmed
+    ones far out rarely, and a ticker whose date moved on the last query
+    is watched closely until a query finds it unchanged.
+
+    The tickers whose date moved are kept in a ticker map, the record has
+    no room for it. The map is not saved, after a restart they go back to
+    their regular interval.
+
+    The policy only applies to the records with the earnings data, the
+    others are queried on the negative cache ladder.
+
+--*/
+class CRefreshPolicy
+{
+protected:
+    ERefreshPolicy          m_Policy;
+    REFRESH_INTERVALS       m_Intervals;
+    CTickerMap<UINT32>      m_Changed;          // Ticker to the earnings date it moved from
+    CLock                   m_Lock;
+
+    // Not copyable
+    CRefreshPolicy(const CRefreshPolicy&);
+    CRefreshPolicy& operator = (const CRefreshPolicy&);
+
+    // C'tor/D'tor
+public:
+    CRefreshPolicy(void) : m_Policy(RefreshPolicyAdaptive) { }
+    ~CRefreshPolicy(void) { }
+
+    // Properties
+public:
+    inline ERefreshPolicy GetPolicy(void) const { return m_Policy; }
+    inline const REFRESH_INTERVALS& GetIntervals(void) const { return m_Intervals; }
+    inline UINT32 GetChangedCount(void) { return m_Changed.Size(); }
+
+    static LPCSTR PolicyName(_In_ ERefreshPolicy Policy) {
+        static LPCSTR StrPolicies[] = { "Fixed", "Adaptive" };
+
+        return ((UINT32)Policy < _countof(StrPolicies)) ? StrPolicies[Policy] : "";
+    }
+
+    // Operations
+public:
+    //
+    // Sets the policy and its intervals. The intervals of 0 are taken as 1
+    //
+    void SetPolicy(
+        _In_ ERefreshPolicy Policy,
+        _In_ const REFRESH_INTERVALS& Intervals
+        );
+
+    //
+    // Returns the utc time the record with the earnings data is due for a
+    // query
+    //
+    UINT32 GetRefreshTime(
+        _In_ const TICKER_KEY& Ticker,
+        _In_ bool Confirmed,
+        _In_ UINT32 QueryDate,
+        _In_ UINT32 EarningsDate
+        );
+
+    //
+    // Called with the result of every query, notes if the earnings date
+    // moved before it was reached
+    //
+    void OnQueried(
+        _In_ const TICKER_KEY& Ticker,
+        _In_ bool Available,
+        _In_ UINT32 PreviousDate,
+        _In_ UINT32 EarningsDate,
+        _In_ UINT32 QueryDate
+        );
+};
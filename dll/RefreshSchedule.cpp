@@ -0,0 +1,175 @@
+/*++
+
+    Copyright (c) Pai Financials LLC.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+Module Name:
+
+    RefreshSchedule.cpp
+
+Abstract:
+
+    Implements the time ordered queue of the tickers due for a refresh
+
+Author:
+
+    nabieasaurus
+
+--*/
+#include "StdAfx.h"
+#include "RefreshSchedule.h"
+
+
+_Use_decl_annotations_
+void
+CRefreshSchedule::Update(
+    const TICKER_KEY& Ticker,
+    UINT32 Due
+    )
+/*++
+
+Routine Description:
+
+    Removes the entry of the ticker for its previous time and adds it for
+    the new time
+
+Parameters:
+
+    Ticker - The ticker symbol in upper case
+
+    Due - The utc time the ticker is due for a refresh, 0 to remove it
+
+--*/
+{
+    CAutoLock       al(m_Lock);
+    REFRESH_ENTRY   entry;
+    UINT32*         pDue = m_Times.Find(Ticker);
+
+    entry.Ticker = Ticker;
+
+    if (pDue != NULL)
+    {
+        if (*pDue == Due) { return; }
+
+        entry.Due = *pDue;
+        m_Entries.erase(entry);
+        m_Times.Erase(Ticker);
+    }
+
+    if (Due == 0) { return; }
+
+    entry.Due = Due;
+    m_Entries.insert(entry);
+    m_Times.Insert(Ticker, Due);
+}
+
+
+void
+CRefreshSchedule::Clear(
+    void
+    )
+/*++
+
+Routine Description:
+
+    Removes all of the tickers, called when the cache is reloaded
+
+--*/
+{
+    CAutoLock al(m_Lock);
+
+    m_Entries.clear();
+    m_Times.Clear();
+}
+
+
+_Use_decl_annotations_
+bool
+CRefreshSchedule::PopDue(
+    UINT32 Now,
+    TICKER_KEY& Ticker
+    )
+/*++
+
+Routine Description:
+
+    Takes the ticker that is due first out of the schedule, if its time
+    has come
+
+Parameters:
+
+    Now - The current utc time
+
+    Ticker - Returns the ticker that is due
+
+Return Value:
+
+    true - if a ticker was due
+    false - if the schedule is empty or the first ticker is not due yet
+
+--*/
+{
+    CAutoLock al(m_Lock);
+
+    std::set<REFRESH_ENTRY>::iterator it = m_Entries.begin();
+    if ((it == m_Entries.end()) || (it->Due > Now)) { return false; }
+
+    Ticker = it->Ticker;
+    m_Entries.erase(it);
+    m_Times.Erase(Ticker);
+
+    return true;
+}
+
+
+_Use_decl_annotations_
+UINT32
+CRefreshSchedule::GetDueCount(
+    UINT32 Now
+    )
+/*++
+
+Routine Description:
+
+    Counts the tickers due at the time by walking the front of the
+    schedule, the cost is the number of tickers due
+
+Parameters:
+
+    Now - The current utc time
+
+Return Value:
+
+    The number of tickers due
+
+--*/
+{
+    CAutoLock   al(m_Lock);
+    UINT32      nDue = 0;
+
+    for (std::set<REFRESH_ENTRY>::const_iterator it = m_Entries.begin();
+        (it != m_Entries.end()) && (it->Due <= Now); it++)
+    {
+        nDue++;
+    }
+
+    return nDue;
+}
@@ -0,0 +1,131 @@
+/*++
+
+    Copyright (c) Pai Financials LLC.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+Module Name:
+
+    RefreshSchedule.h
+
+Abstract:
+
+    Time ordered queue of the tickers due for a refresh
+
+Author:
+
+    nabieasaurus
+
+--*/
+#pragma once
+
+#include "Lock.h"
+#include "TickerMap.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// struct
+//      REFRESH_ENTRY
+//
+// abstract
+//      One ticker in the refresh schedule. The entries are ordered by the
+//      time they are due and the tickers due at the same time by name.
+//
+struct REFRESH_ENTRY
+{
+    UINT32      Due;
+    TICKER_KEY  Ticker;
+
+    inline bool operator < (const REFRESH_ENTRY& Entry) const {
+        if (Due != Entry.Due) return Due < Entry.Due;
+        return strncmp(Ticker.Chars, Entry.Ticker.Chars, TICKER_KEY_SIZE) < 0;
+    }
+};
+
+
+/*++
+
+Class Name:
+
+    CRefreshSchedule
+
+Class Description:
+
+    Keeps the tickers of the cache ordered by the utc time their record
+    has to be queried again, so the refresh scheduler takes the ones that
+    are due from the front without looking at the rest. The due time of
+    each ticker is kept in a ticker map to find its entry when the time
+    changes.
+
+    A ticker is in the schedule once. It is taken out when it is handed
+    to the fetch threads and put back with its next time once the query
+    completes.
+
+--*/
+class CRefreshSchedule
+{
+protected:
+    std::set<REFRESH_ENTRY>     m_Entries;
+    CTickerMap<UINT32>          m_Times;            // Ticker to the due time in the schedule
+    CLock                       m_Lock;
+
+    // Not copyable
+    CRefreshSchedule(const CRefreshSchedule&);
+    CRefreshSchedule& operator = (const CRefreshSchedule&);
+
+    // C'tor/D'tor
+public:
+    CRefreshSchedule(void) { }
+    ~CRefreshSchedule(void) { }
+
+    // Properties
+public:
+    inline UINT32 Size(void) { return m_Times.Size(); }
+
+    // Operations
+public:
+    //
+    // Moves the ticker to the due time. A time of 0 removes the ticker
+    // from the schedule
+    //
+    void Update(
+        _In_ const TICKER_KEY& Ticker,
+        _In_ UINT32 Due
+        );
+
+    void Clear(void);
+
+    //
+    // Takes the first ticker out of the schedule if it is due at Now.
+    // Returns false if no ticker is due
+    //
+    bool PopDue(
+        _In_ UINT32 Now,
+        _Out_ TICKER_KEY& Ticker
+        );
+
+    //
+    // Returns the number of tickers due at Now
+    //
+    UINT32 GetDueCount(
+        _In_ UINT32 Now
+        );
+};
@@ -0,0 +1,155 @@
+/*++
+
+    Copyright (c) Pai Financials LLC.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    SlabAllocator.h
+
+Abstract:
+
+    Fixed size object allocator that carves the objects out of large blocks
+
+Author:
+
+    nabieasaurus
+
+--*/
+#pragma once
+
+#include <new>
+#include <type_traits>
+#include "Lock.h"
+
+
+/*++
+
+Class Name:
+
+    CSlabAllocator
+
+Class Description:
+
+    Allocates the objects of type T from blocks of BlockSize objects. The
+    freed objects go on a free list and are reused by the next allocation.
+    All of the objects are released together when the allocator is deleted,
+    so the objects must not need a destructor.
+
+    The caller constructs the object in the memory returned by Allocate
+    with placement new.
+
+--*/
+template <class T, UINT32 BlockSize = 4096>
+class CSlabAllocator
+{
+    static_assert(std::is_trivially_destructible<T>::value,
+        "The slab does not run the destructors of the objects");
+
+private:
+    union SLOT
+    {
+        SLOT*       pNext;                  // Next free slot
+        BYTE        Object[sizeof(T)];
+        double      Align;
+    };
+
+    struct BLOCK
+    {
+        BLOCK*      pNext;
+        SLOT        Slots[BlockSize];
+    };
+
+    BLOCK*          m_pBlocks;              // The block being carved is first
+    UINT32          m_nUsed;                // Slots carved from the first block
+    SLOT*           m_pFree;
+    LONG volatile   m_nBlocks;
+    LONG volatile   m_nObjects;             // Objects allocated and not freed
+    CLock           m_Lock;
+
+    // Not copyable
+    CSlabAllocator(const CSlabAllocator&);
+    CSlabAllocator& operator = (const CSlabAllocator&);
+
+    // C'tor/D'tor
+public:
+    CSlabAllocator() : m_pBlocks(NULL), m_nUsed(BlockSize), m_pFree(NULL),
+        m_nBlocks(0), m_nObjects(0) { }
+
+    ~CSlabAllocator() {
+        while (m_pBlocks != NULL)
+        {
+            BLOCK* pBlock = m_pBlocks;
+            m_pBlocks = pBlock->pNext;
+            delete pBlock;
+        }
+    }
+
+    // Properties
+public:
+    inline LONG Blocks() const { return m_nBlocks; }
+    inline LONG Objects() const { return m_nObjects; }
+
+    // Operations
+public:
+    //
+    // Returns the memory for one object
+    //
+    PVOID Allocate() {
+        CAutoLock al(m_Lock);
+        SLOT* pSlot;
+
+        if (m_pFree != NULL)
+        {
+            pSlot = m_pFree;
+            m_pFree = pSlot->pNext;
+        }
+        else
+        {
+            if (m_nUsed == BlockSize)
+            {
+                BLOCK* pBlock = new BLOCK;
+                pBlock->pNext = m_pBlocks;
+                m_pBlocks = pBlock;
+                m_nUsed = 0;
+                m_nBlocks++;
+            }
+
+            pSlot = &m_pBlocks->Slots[m_nUsed++];
+        }
+
+        m_nObjects++;
+        return pSlot->Object;
+    }
+
+    //
+    // Returns the object to the free list
+    //
+    void Free(_In_ T* Object) {
+        if (Object == NULL) return;
+
+        CAutoLock al(m_Lock);
+        SLOT* pSlot = (SLOT*)Object;
+
+        pSlot->pNext = m_pFree;
+        m_pFree = pSlot;
+        m_nObjects--;
+    }
+};
@@ -0,0 +1,238 @@
+/*++
+
+    Copyright (c) Pai Financials LLC.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+Module Name:
+
+    StringPool.cpp
+
+Abstract:
+
+    Implements the pool of interned strings
+
+Author:
+
+    nabieasaurus
+
+--*/
+#include "StdAfx.h"
+#include "StringPool.h"
+
+
+CStringPool::CStringPool(
+    void
+    )
+/*++
+
+Routine Description:
+
+    This is the default constructor for the CStringPool
+
+--*/
+{
+    m_nCount = 0;
+    m_nBytes = 0;
+    ZeroMemory(m_pChunks, sizeof(m_pChunks));
+}
+
+
+CStringPool::~CStringPool(
+    void
+    )
+/*++
+
+Routine Description:
+
+    This is the default destructor for the CStringPool
+
+--*/
+{
+    for (LONG nCtr = 0; nCtr < m_nCount; nCtr++)
+    {
+        delete [] (LPSTR)m_pChunks[nCtr / STRING_POOL_CHUNK_SIZE][nCtr % STRING_POOL_CHUNK_SIZE];
+    }
+
+    for (int nCtr = 0; nCtr < _countof(m_pChunks); nCtr++)
+    {
+        delete [] (LPSTR*)m_pChunks[nCtr];
+    }
+}
+
+
+_Use_decl_annotations_
+UINT16
+CStringPool::Intern(
+    LPCSTR Str
+    )
+/*++
+
+Routine Description:
+
+    Returns the id for the string. If the string was not seen before it
+    is copied into the pool and the id is published after the copy, so
+    the readers never see a partial string. The freed ids are reused
+    before new ones are issued.
+
+Parameters:
+
+    Str - The string to intern
+
+Return Value:
+
+    The id, STRING_POOL_EMPTY_ID for the empty string or if the pool is full
+
+--*/
+{
+    if ((Str == NULL) || (Str[0] == '\0')) { return STRING_POOL_EMPTY_ID; }
+
+    CAutoLock al(m_Lock);
+
+    STRING_INDEX::iterator it = m_Index.find(Str);
+    if (it != m_Index.end()) { return it->second; }
+
+    size_t  cbStr = strlen(Str) + 1;
+    LPSTR   pStr;
+    UINT16  id;
+
+    if (m_FreeIds.empty() == false)
+    {
+        id = m_FreeIds.back();
+        m_FreeIds.pop_back();
+
+        pStr = new CHAR[cbStr];
+        memcpy(pStr, Str, cbStr);
+
+        //
+        // Publish the string, the id was not readable since it was freed
+        //
+        UINT32 index = (UINT32)(id - 1);
+        InterlockedExchangePointer(
+            (PVOID volatile*)&m_pChunks[index / STRING_POOL_CHUNK_SIZE][index % STRING_POOL_CHUNK_SIZE], pStr);
+    }
+    else
+    {
+        UINT32 index = (UINT32)m_nCount;
+        UINT32 chunk = index / STRING_POOL_CHUNK_SIZE;
+
+        if ((chunk >= STRING_POOL_MAX_CHUNKS) || (index + 1 > STRING_POOL_MAX_ID))
+        {
+            LogError("String pool is full, unable to add %s", Str);
+            return STRING_POOL_EMPTY_ID;
+        }
+
+        if (m_pChunks[chunk] == NULL)
+        {
+            m_pChunks[chunk] = new LPSTR[STRING_POOL_CHUNK_SIZE]();
+        }
+
+        pStr = new CHAR[cbStr];
+        memcpy(pStr, Str, cbStr);
+        m_pChunks[chunk][index % STRING_POOL_CHUNK_SIZE] = pStr;
+
+        id = (UINT16)(index + 1);
+
+        //
+        // Publish the string
+        //
+        InterlockedIncrement(&m_nCount);
+    }
+
+    m_Index[Str] = id;
+    m_nBytes += (LONG)cbStr;
+
+    return id;
+}
+
+
+_Use_decl_annotations_
+void
+CStringPool::Sweep(
+    const std::vector<bool>& Used,
+    std::vector<UINT16>& Swept
+    )
+/*++
+
+Routine Description:
+
+    Removes the strings that are not used from the index. The new callers
+    interning the same text get a new id, the readers holding the old id
+    still read the string till it is freed.
+
+Parameters:
+
+    Used - Indexed by id, true for the ids that are still referenced
+
+    Swept - Returns the ids removed from the index
+
+--*/
+{
+    CAutoLock al(m_Lock);
+
+    Swept.clear();
+
+    for (STRING_INDEX::iterator it = m_Index.begin(); it != m_Index.end(); )
+    {
+        if ((it->second < Used.size()) && (Used[it->second] == true))
+        {
+            it++;
+            continue;
+        }
+
+        Swept.push_back(it->second);
+        it = m_Index.erase(it);
+    }
+}
+
+
+_Use_decl_annotations_
+void
+CStringPool::Free(
+    const std::vector<UINT16>& Swept
+    )
+/*++
+
+Routine Description:
+
+    Deletes the swept strings and adds their ids to the free ids
+
+Parameters:
+
+    Swept - The ids returned by Sweep
+
+--*/
+{
+    CAutoLock al(m_Lock);
+
+    for (size_t nCtr = 0; nCtr < Swept.size(); nCtr++)
+    {
+        UINT32  index = (UINT32)(Swept[nCtr] - 1);
+        LPSTR   pStr = (LPSTR)InterlockedExchangePointer(
+            (PVOID volatile*)&m_pChunks[index / STRING_POOL_CHUNK_SIZE][index % STRING_POOL_CHUNK_SIZE], NULL);
+
+        if (pStr == NULL) { continue; }
+
+        m_nBytes -= (LONG)(strlen(pStr) + 1);
+        delete [] pStr;
+
+        m_FreeIds.push_back(Swept[nCtr]);
+    }
+}
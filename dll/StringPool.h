@@ -0,0 +1,134 @@
+/*++
+
+    Copyright (c) Pai Financials LLC.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+Module Name:
+
+    StringPool.h
+
+Abstract:
+
+    Pool of interned strings referenced by a 16 bit id
+
+Author:
+
+    nabieasaurus
+
+--*/
+#pragma once
+
+#include "Lock.h"
+
+#define STRING_POOL_EMPTY_ID        0           // The id of the empty string
+#define STRING_POOL_CHUNK_SIZE      1024
+#define STRING_POOL_MAX_CHUNKS      64          // Upto 64K strings
+#define STRING_POOL_MAX_ID          0xFFFF      // The last id of the last chunk does not fit
+
+
+/*++
+
+Class Name:
+
+    CStringPool
+
+Class Description:
+
+    Keeps one copy of every distinct string and hands out a 16 bit id for
+    it, so the records refer to the rarely used text fields with the id
+    instead of carrying the text inline. The empty string is always id 0
+    and is not stored.
+
+    The string pointers are kept in fixed size chunks that are never
+    moved, so the id is resolved to the string without a lock. The
+    strings no longer used are reclaimed in two steps. Sweep removes them
+    from the index, so they are not handed out again, and once the
+    readers that could still hold their ids are gone, Free deletes them
+    and their ids are reused.
+
+--*/
+class CStringPool
+{
+protected:
+    typedef std::map<String, UINT16> STRING_INDEX;
+
+    STRING_INDEX        m_Index;                        // String to id
+    LPSTR volatile*     m_pChunks[STRING_POOL_MAX_CHUNKS];  // Strings for id 1..N
+    std::vector<UINT16> m_FreeIds;                      // Freed ids, reused first
+    LONG volatile       m_nCount;                       // Number of ids issued
+    LONG volatile       m_nBytes;                       // Bytes used by the strings
+    CLock               m_Lock;
+
+    // C'tor/D'tor
+public:
+    CStringPool(void);
+    ~CStringPool(void);
+
+public:
+    //
+    // Returns the id of the string, adding it if required. Returns
+    // STRING_POOL_EMPTY_ID for the empty string or if the pool is full
+    //
+    UINT16 Intern(
+        _In_ LPCSTR Str
+        );
+
+    //
+    // Removes the strings whose ids are not marked in Used from the index
+    // and returns their ids. The strings stay readable till they are freed
+    //
+    void Sweep(
+        _In_ const std::vector<bool>& Used,
+        _Out_ std::vector<UINT16>& Swept
+        );
+
+    //
+    // Deletes the swept strings and makes their ids available again. Called
+    // once no reader can hold the ids
+    //
+    void Free(
+        _In_ const std::vector<UINT16>& Swept
+        );
+
+    //
+    // Returns the string for the id, the empty string if the id is not valid
+    //
+    inline LPCSTR Get(_In_ UINT16 Id) {
+        if ((Id == STRING_POOL_EMPTY_ID) || (Id > m_nCount)) return "";
+
+        UINT32 index = (UINT32)(Id - 1);
+        LPCSTR pStr = m_pChunks[index / STRING_POOL_CHUNK_SIZE][index % STRING_POOL_CHUNK_SIZE];
+
+        return (pStr != NULL) ? pStr : "";
+    }
+
+    //
+    // The pool is full when all of the ids are issued and none is free
+    //
+    inline bool IsFull(void) {
+        CAutoLock al(m_Lock);
+        return (m_FreeIds.empty() == true) && (m_nCount >= STRING_POOL_MAX_ID);
+    }
+
+    inline LONG Count(void) const { return m_nCount; }
+    inline LONG Live(void) const { return (LONG)m_Index.size(); }
+    inline LONG Bytes(void) const { return m_nBytes; }
+};
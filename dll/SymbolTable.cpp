@@ -0,0 +1,280 @@
+/*++
+
+    Copyright (c) Pai Financials LLC.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    SymbolTable.cpp
+
+Abstract:
+
+    Implements the symbol table that interns the ticker symbols into
+    dense integer handles
+
+Author:
+
+    nabieasaurus
+
+--*/
+#include "StdAfx.h"
+#include "SymbolTable.h"
+
+
+_Use_decl_annotations_
+CSymbolTable::CSymbolTable(
+    CEpochManager& Epochs
+    ) : m_Epochs(Epochs)
+/*++
+
+Routine Description:
+
+    This is the default constructor for the CSymbolTable
+
+--*/
+{
+    m_pIndex = new SYMBOL_INDEX(64, SYMBOL_MIN_DELTA);
+    m_nCount = 0;
+    ZeroMemory(m_pChunks, sizeof(m_pChunks));
+}
+
+
+CSymbolTable::~CSymbolTable(
+    void
+    )
+/*++
+
+Routine Description:
+
+    This is the default destructor for the CSymbolTable. The records
+    bound to the entries are owned by the cache and are not deleted.
+
+--*/
+{
+    for (int nCtr = 0; nCtr < _countof(m_pChunks); nCtr++)
+    {
+        delete [] m_pChunks[nCtr];
+    }
+
+    delete m_pIndex;
+}
+
+
+_Use_decl_annotations_
+INT
+CSymbolTable::Intern(
+    const TICKER_KEY& Key
+    )
+/*++
+
+Routine Description:
+
+    Returns the handle for the ticker. If the ticker was not seen before
+    a new entry is allocated and the handle is published after the entry
+    is filled, so the lock free readers never see a partial entry.
+
+Parameters:
+
+    Key - The packed ticker symbol
+
+Return Value:
+
+    The handle, SYMBOL_INVALID_HANDLE if the table is full
+
+--*/
+{
+    INT handle = Find(Key);
+    if (handle != SYMBOL_INVALID_HANDLE) { return handle; }
+
+    CAutoLock al(m_Lock);
+
+    //
+    // The ticker could have been interned by another thread. The index is
+    // only replaced under the lock, it does not need the epoch here
+    //
+    SYMBOL_INDEX* pIndex = m_pIndex;
+
+    handle = FindInIndex(pIndex, Key);
+    if (handle != SYMBOL_INVALID_HANDLE) { return handle; }
+
+    UINT32 index = (UINT32)m_nCount;
+    UINT32 chunk = index / SYMBOL_CHUNK_SIZE;
+
+    if (chunk >= SYMBOL_MAX_CHUNKS)
+    {
+        LogError("Symbol table is full, unable to add %s", Key.Chars);
+        return SYMBOL_INVALID_HANDLE;
+    }
+
+    if (m_pChunks[chunk] == NULL)
+    {
+        m_pChunks[chunk] = new SYMBOL_ENTRY[SYMBOL_CHUNK_SIZE]();
+    }
+
+    SYMBOL_ENTRY* pEntry = &m_pChunks[chunk][index % SYMBOL_CHUNK_SIZE];
+    pEntry->Key = Key;
+    pEntry->Data = NULL;
+
+    handle = (INT)index + 1;
+
+    //
+    // Publish the entry, then the handle in the delta. A reader that finds
+    // the handle finds the entry filled and within the count
+    //
+    InterlockedIncrement(&m_nCount);
+
+    UINT32 slot = Key.Hash() & pIndex->DeltaMask;
+    while (pIndex->Delta[slot] != 0) { slot = (slot + 1) & pIndex->DeltaMask; }
+
+    InterlockedExchange((LONG volatile*)&pIndex->Delta[slot], handle);
+    pIndex->DeltaCount++;
+
+    if (pIndex->DeltaCount >= pIndex->DeltaLimit)
+    {
+        Republish();
+    }
+
+    LogTrace("Interned %s as %d", Key.Chars, handle);
+    return handle;
+}
+
+
+_Use_decl_annotations_
+INT
+CSymbolTable::Find(
+    const TICKER_KEY& Key
+    )
+/*++
+
+Routine Description:
+
+    Returns the handle for the ticker if it was interned before. The
+    snapshot and the delta of the published index are looked up in the
+    epoch, the index is not freed while it is looked up.
+
+--*/
+{
+    CEpochGuard eg(m_Epochs);
+
+    return FindInIndex(m_pIndex, Key);
+}
+
+
+_Use_decl_annotations_
+INT
+CSymbolTable::FindInIndex(
+    SYMBOL_INDEX* Index,
+    const TICKER_KEY& Key
+    )
+/*++
+
+Routine Description:
+
+    Looks up the ticker in the snapshot and then probes the delta up to
+    the first empty slot. The delta holds the handles, the key is read
+    from the entry of the handle which never changes once issued.
+
+Parameters:
+
+    Index - The index to look up
+
+    Key - The packed ticker symbol
+
+Return Value:
+
+    The handle, SYMBOL_INVALID_HANDLE if the ticker is not in the index
+
+--*/
+{
+    INT* pHandle = Index->Snapshot.Find(Key);
+    if (pHandle != NULL) { return *pHandle; }
+
+    for (UINT32 slot = Key.Hash() & Index->DeltaMask; ; slot = (slot + 1) & Index->DeltaMask)
+    {
+        INT handle = Index->Delta[slot];
+        if (handle == 0) { break; }
+
+        SYMBOL_ENTRY* pEntry = GetEntry(handle);
+        if ((pEntry != NULL) && (pEntry->Key == Key)) { return handle; }
+    }
+
+    return SYMBOL_INVALID_HANDLE;
+}
+
+
+void
+CSymbolTable::Republish(
+    void
+    )
+/*++
+
+Routine Description:
+
+    Builds a new index with the tickers of the current snapshot and the
+    delta and an empty delta sized for a quarter of the new snapshot,
+    publishes it and retires the current one. The readers see either
+    index with all of the tickers interned so far.
+
+--*/
+{
+    SYMBOL_INDEX*   pOld = m_pIndex;
+    UINT32          nSymbols = pOld->Snapshot.Size() + pOld->DeltaCount;
+    UINT32          nLimit = (nSymbols / 4 > SYMBOL_MIN_DELTA) ? nSymbols / 4 : SYMBOL_MIN_DELTA;
+    SYMBOL_INDEX*   pNew = new SYMBOL_INDEX(nSymbols * 2, nLimit);
+
+    for (HANDLE_MAP::iterator it = pOld->Snapshot.begin(); it != pOld->Snapshot.end(); it++)
+    {
+        pNew->Snapshot.Insert(it->Key, it->Value);
+    }
+
+    for (UINT32 slot = 0; slot <= pOld->DeltaMask; slot++)
+    {
+        INT handle = pOld->Delta[slot];
+        if (handle != 0) { pNew->Snapshot.Insert(GetEntry(handle)->Key, handle); }
+    }
+
+    InterlockedExchangePointer((PVOID volatile*)&m_pIndex, pNew);
+
+    LogTrace("Symbol index republished with %d symbols", pNew->Snapshot.Size());
+
+    m_Epochs.Retire(pOld);
+}
+
+
+void
+CSymbolTable::UnbindAll(
+    void
+    )
+/*++
+
+Routine Description:
+
+    Unbinds the records from all of the handles. The handles stay valid
+    and are bound again when the symbol is looked up.
+
+--*/
+{
+    CAutoLock al(m_Lock);
+
+    for (INT handle = 1; handle <= m_nCount; handle++)
+    {
+        GetEntry(handle)->Data = NULL;
+    }
+}
@@ -0,0 +1,197 @@
+/*++
+
+    Copyright (c) Pai Financials LLC.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    SymbolTable.h
+
+Abstract:
+
+    The symbol table interns the ticker symbols into dense integer
+    handles that the callers can cache
+
+Author:
+
+    nabieasaurus
+
+--*/
+#pragma once
+
+#include "TickerMap.h"
+#include "Lock.h"
+#include "Epoch.h"
+
+#define SYMBOL_INVALID_HANDLE       0
+#define SYMBOL_CHUNK_SIZE           1024
+#define SYMBOL_MAX_CHUNKS           4096        // Upto 4M symbols
+#define SYMBOL_MIN_DELTA            64          // Delta size before the index is republished
+
+class CEarningsData;
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// struct
+//      SYMBOL_INDEX
+//
+// abstract
+//      The published ticker to handle index. The snapshot is immutable, the
+//      delta is an open addressed array of the handles interned after it.
+//      The delta is only appended to and is sized for twice its limit, so
+//      the probe always ends on an empty slot. Both are replaced together.
+//
+struct SYMBOL_INDEX
+{
+    CTickerMap<INT>     Snapshot;                       // Ticker to handle, merged
+    INT volatile*       Delta;                          // Handles, 0 for the empty slot
+    UINT32              DeltaMask;                      // Slots in the delta - 1
+    UINT32              DeltaLimit;                     // Republished at this many
+    UINT32              DeltaCount;                     // Changed under the table lock
+
+    SYMBOL_INDEX(_In_ UINT32 Capacity, _In_ UINT32 Limit) : Snapshot(Capacity) {
+        UINT32 nSlots = 16;
+        while (nSlots < Limit * 2) nSlots *= 2;
+
+        Delta = new INT[nSlots]();
+        DeltaMask = nSlots - 1;
+        DeltaLimit = Limit;
+        DeltaCount = 0;
+    }
+
+    ~SYMBOL_INDEX() {
+        delete [] (INT*)Delta;
+    }
+
+private:
+    SYMBOL_INDEX(const SYMBOL_INDEX&);
+    SYMBOL_INDEX& operator = (const SYMBOL_INDEX&);
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// struct
+//      SYMBOL_ENTRY
+//
+// abstract
+//      One entry per handle. The key never changes once the handle is
+//      issued, the record bound to it changes when the cache is loaded
+//      or the symbol is added to the cache.
+//
+struct SYMBOL_ENTRY
+{
+    TICKER_KEY                  Key;        // The ticker symbol
+    CEarningsData* volatile     Data;       // The cached record, NULL if not bound
+};
+
+
+
+/*++
+
+Class Name:
+
+    CSymbolTable
+
+Class Description:
+
+    Maps the ticker symbols to dense handles starting at 1. The entries
+    are allocated in fixed size chunks that are never moved, so a handle
+    is resolved to its entry with two array indexes and without a lock.
+
+    The ticker to handle index is an immutable snapshot and an append
+    only delta, both looked up in the epoch without a lock. The new
+    symbols are appended to the delta under the table lock, and once the
+    delta grows to a quarter of the snapshot both are merged into a new
+    index. The old index is retired through the epoch manager.
+
+--*/
+class CSymbolTable
+{
+protected:
+    typedef CTickerMap<INT> HANDLE_MAP;
+
+    CEpochManager&      m_Epochs;
+    SYMBOL_INDEX* volatile m_pIndex;                    // Published ticker to handle index
+    CLock               m_Lock;
+    SYMBOL_ENTRY*       m_pChunks[SYMBOL_MAX_CHUNKS];   // Entries for handle 1..N
+    LONG volatile       m_nCount;                       // Number of handles issued
+
+    //
+    // Looks up the ticker in the index, the caller is in the epoch
+    //
+    INT FindInIndex(
+        _In_ SYMBOL_INDEX* Index,
+        _In_ const TICKER_KEY& Key
+        );
+
+    //
+    // Merges the delta into a new snapshot. Called with the table lock held
+    //
+    void Republish(void);
+
+    // C'tor/D'tor
+public:
+    CSymbolTable(_In_ CEpochManager& Epochs);
+    ~CSymbolTable(void);
+
+public:
+    //
+    // Returns the handle for the ticker, adding it if required. Returns
+    // SYMBOL_INVALID_HANDLE if the table is full
+    //
+    INT Intern(
+        _In_ const TICKER_KEY& Key
+        );
+
+    //
+    // Returns the handle for the ticker or SYMBOL_INVALID_HANDLE. The lookup
+    // does not take a lock
+    //
+    INT Find(
+        _In_ const TICKER_KEY& Key
+        );
+
+    //
+    // Returns the entry for the handle or NULL if the handle is not valid
+    //
+    inline SYMBOL_ENTRY* GetEntry(_In_ INT Handle) {
+        if ((Handle <= SYMBOL_INVALID_HANDLE) || (Handle > m_nCount)) return NULL;
+
+        UINT32 index = (UINT32)(Handle - 1);
+        return &m_pChunks[index / SYMBOL_CHUNK_SIZE][index % SYMBOL_CHUNK_SIZE];
+    }
+
+    //
+    // Binds the record to the handle
+    //
+    inline void Bind(_In_ INT Handle, _In_ CEarningsData* Data) {
+        SYMBOL_ENTRY* pEntry = GetEntry(Handle);
+        if (pEntry != NULL) pEntry->Data = Data;
+    }
+
+    //
+    // Unbinds all of the records, called when the cache is reloaded
+    //
+    void UnbindAll(void);
+
+    inline INT Count(void) const { return m_nCount; }
+};
@@ -0,0 +1,390 @@
+/*++
+
+    Copyright (c) Pai Financials LLC.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    TickerMap.h
+
+Abstract:
+
+    The packed ticker key and the open addressing hash table keyed
+    by the ticker symbol
+
+Author:
+
+    nabieasaurus
+
+--*/
+#pragma once
+
+#include <emmintrin.h>
+
+#define TICKER_KEY_SIZE             16
+#define MAX_TICKER_KEY_LENGTH       (TICKER_KEY_SIZE - 1)
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// struct
+//      TICKER_KEY
+//
+// abstract
+//      The ticker symbol in upper case packed into 16 bytes and padded with
+//      zeros, so two keys are compared with a single SSE2 compare. An all
+//      zero key is the empty key.
+//
+struct TICKER_KEY
+{
+    union
+    {
+        CHAR    Chars[TICKER_KEY_SIZE];
+        UINT32  Dwords[TICKER_KEY_SIZE / sizeof(UINT32)];
+    };
+
+    //
+    // Packs the ticker in upper case. Returns false if the ticker
+    // is empty or does not fit in the key
+    //
+    bool Set(_In_ LPCSTR Ticker) {
+        int nCtr;
+
+        Clear();
+        for (nCtr = 0; (Ticker[nCtr] != '\0') && (nCtr < MAX_TICKER_KEY_LENGTH); nCtr++)
+        {
+            CHAR ch = Ticker[nCtr];
+            Chars[nCtr] = ((ch >= 'a') && (ch <= 'z')) ? (ch - 'a' + 'A') : ch;
+        }
+
+        if ((nCtr == 0) || (Ticker[nCtr] != '\0'))
+        {
+            Clear();
+            return false;
+        }
+
+        return true;
+    }
+
+    inline void Clear() {
+        Dwords[0] = Dwords[1] = Dwords[2] = Dwords[3] = 0;
+    }
+
+    inline bool IsEmpty() const {
+        return Chars[0] == '\0';
+    }
+
+    inline bool operator == (const TICKER_KEY& Key) const {
+        __m128i left = _mm_loadu_si128((const __m128i*)Chars);
+        __m128i right = _mm_loadu_si128((const __m128i*)Key.Chars);
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(left, right)) == 0xFFFF;
+    }
+
+    inline bool operator != (const TICKER_KEY& Key) const {
+        return !(*this == Key);
+    }
+
+    //
+    // FNV-1a over the dwords followed by the murmur finalizer
+    //
+    inline UINT32 Hash() const {
+        UINT32 hash = 2166136261U;
+
+        for (int nCtr = 0; nCtr < _countof(Dwords); nCtr++)
+        {
+            hash = (hash ^ Dwords[nCtr]) * 16777619U;
+        }
+
+        hash ^= hash >> 16;
+        hash *= 0x85EBCA6BU;
+        hash ^= hash >> 13;
+        hash *= 0xC2B2AE35U;
+        hash ^= hash >> 16;
+
+        return hash;
+    }
+};
+
+
+
+/*++
+
+Class Name:
+
+    CTickerList
+
+Class Description:
+
+    Writes the tickers into the caller's buffer separated by commas, for
+    the exports that return a list of tickers. The buffer always holds a
+    terminated list. A ticker that does not fit is not written, and no
+    ticker is written after it so the list is not missing one in the middle.
+
+--*/
+class CTickerList
+{
+private:
+    LPSTR       m_Buffer;
+    INT         m_nSize;
+    INT         m_nUsed;
+    INT         m_nCount;
+    bool        m_bFull;
+
+public:
+    CTickerList(_Out_writes_(BufferSize) LPSTR Buffer, _In_ INT BufferSize) :
+        m_Buffer(Buffer), m_nSize(BufferSize), m_nUsed(0), m_nCount(0), m_bFull(BufferSize <= 0)
+    {
+        if (m_bFull == false) m_Buffer[0] = '\0';
+    }
+
+    //
+    // Appends the ticker, returns false once the buffer is full
+    //
+    bool Append(_In_ const TICKER_KEY& Ticker) {
+        INT nLength = (INT)strnlen(Ticker.Chars, TICKER_KEY_SIZE);
+        INT nNeeded = nLength + ((m_nCount == 0) ? 0 : 1);
+
+        if ((m_bFull == true) || (m_nUsed + nNeeded >= m_nSize))
+        {
+            m_bFull = true;
+            return false;
+        }
+
+        if (m_nCount != 0) m_Buffer[m_nUsed++] = ',';
+        memcpy(m_Buffer + m_nUsed, Ticker.Chars, nLength);
+        m_nUsed += nLength;
+        m_Buffer[m_nUsed] = '\0';
+        m_nCount++;
+
+        return true;
+    }
+
+    inline INT Count() const { return m_nCount; }
+};
+
+
+
+/*++
+
+Class Name:
+
+    CTickerMap
+
+Class Description:
+
+    Open addressing hash table with linear probing keyed by TICKER_KEY.
+    The entries are stored inline in one flat array, so a lookup hashes
+    the key and compares 16 byte keys in consecutive slots without any
+    heap allocation. Erase uses backward shift so no tombstones are left
+    behind.
+
+    The table is not thread safe, the caller provides the locking.
+
+--*/
+template <class V>
+class CTickerMap
+{
+public:
+    struct ENTRY
+    {
+        TICKER_KEY  Key;
+        V           Value;
+    };
+
+    class iterator
+    {
+        friend class CTickerMap;
+
+    private:
+        ENTRY*  m_pEntry;
+        ENTRY*  m_pEnd;
+
+        iterator(ENTRY* pEntry, ENTRY* pEnd) : m_pEntry(pEntry), m_pEnd(pEnd) {
+            SkipEmpty();
+        }
+
+        void SkipEmpty() {
+            while ((m_pEntry != m_pEnd) && m_pEntry->Key.IsEmpty()) m_pEntry++;
+        }
+
+    public:
+        ENTRY& operator * () const { return *m_pEntry; }
+        ENTRY* operator -> () const { return m_pEntry; }
+
+        iterator& operator ++ () { m_pEntry++; SkipEmpty(); return *this; }
+        iterator operator ++ (int) { iterator it(*this); ++(*this); return it; }
+
+        bool operator == (const iterator& it) const { return m_pEntry == it.m_pEntry; }
+        bool operator != (const iterator& it) const { return m_pEntry != it.m_pEntry; }
+    };
+
+private:
+    ENTRY*      m_pEntries;
+    UINT32      m_nCapacity;            // Always power of 2
+    UINT32      m_nCount;
+
+    // Not copyable
+    CTickerMap(const CTickerMap&);
+    CTickerMap& operator = (const CTickerMap&);
+
+    //
+    // Returns the slot that holds the key or the empty slot where it goes
+    //
+    inline UINT32 Probe(const TICKER_KEY& Key) const {
+        UINT32 mask = m_nCapacity - 1;
+        UINT32 slot = Key.Hash() & mask;
+
+        while (!m_pEntries[slot].Key.IsEmpty() && (m_pEntries[slot].Key != Key))
+        {
+            slot = (slot + 1) & mask;
+        }
+
+        return slot;
+    }
+
+    void Grow() {
+        ENTRY*  pOld = m_pEntries;
+        UINT32  nOld = m_nCapacity;
+
+        m_nCapacity *= 2;
+        m_pEntries = new ENTRY[m_nCapacity]();
+
+        for (UINT32 nCtr = 0; nCtr < nOld; nCtr++)
+        {
+            if (!pOld[nCtr].Key.IsEmpty())
+            {
+                m_pEntries[Probe(pOld[nCtr].Key)] = pOld[nCtr];
+            }
+        }
+
+        delete [] pOld;
+    }
+
+    // C'tor/D'tor
+public:
+    CTickerMap(_In_ UINT32 Capacity = 64) : m_nCount(0) {
+        m_nCapacity = 16;
+        while (m_nCapacity < Capacity) m_nCapacity *= 2;
+        m_pEntries = new ENTRY[m_nCapacity]();
+    }
+
+    ~CTickerMap() {
+        delete [] m_pEntries;
+    }
+
+    // Properties
+public:
+    inline UINT32 Size() const { return m_nCount; }
+    inline bool Empty() const { return m_nCount == 0; }
+    inline UINT32 Capacity() const { return m_nCapacity; }
+
+    iterator begin() { return iterator(m_pEntries, m_pEntries + m_nCapacity); }
+    iterator end() { return iterator(m_pEntries + m_nCapacity, m_pEntries + m_nCapacity); }
+
+    // Operations
+public:
+    //
+    // Returns pointer to the value or NULL if the key is not in the table
+    //
+    inline V* Find(_In_ const TICKER_KEY& Key) {
+        ENTRY* pEntry = &m_pEntries[Probe(Key)];
+        return pEntry->Key.IsEmpty() ? NULL : &pEntry->Value;
+    }
+
+    //
+    // Inserts the key, returns false if the key is already in the table
+    //
+    bool Insert(_In_ const TICKER_KEY& Key, _In_ const V& Value) {
+        _ASSERT(!Key.IsEmpty());
+
+        // Keep the load factor under 70%
+        if ((m_nCount + 1) * 10 > m_nCapacity * 7) Grow();
+
+        ENTRY* pEntry = &m_pEntries[Probe(Key)];
+        if (!pEntry->Key.IsEmpty()) return false;
+
+        pEntry->Key = Key;
+        pEntry->Value = Value;
+        m_nCount++;
+        return true;
+    }
+
+    //
+    // Returns the value for the key, inserting a default value if required
+    //
+    V& operator [] (_In_ const TICKER_KEY& Key) {
+        V* pValue = Find(Key);
+        if (pValue == NULL)
+        {
+            Insert(Key, V());
+            pValue = Find(Key);
+        }
+        return *pValue;
+    }
+
+    //
+    // Removes the key, returns false if the key was not in the table
+    //
+    bool Erase(_In_ const TICKER_KEY& Key) {
+        UINT32 mask = m_nCapacity - 1;
+        UINT32 hole = Probe(Key);
+
+        if (m_pEntries[hole].Key.IsEmpty()) return false;
+
+        //
+        // Shift back the entries of the probe sequence into the hole
+        //
+        for (UINT32 next = (hole + 1) & mask;
+            !m_pEntries[next].Key.IsEmpty();
+            next = (next + 1) & mask)
+        {
+            UINT32 home = m_pEntries[next].Key.Hash() & mask;
+            bool bStays = (hole <= next) ?
+                ((hole < home) && (home <= next)) :
+                ((hole < home) || (home <= next));
+
+            if (!bStays)
+            {
+                m_pEntries[hole] = m_pEntries[next];
+                hole = next;
+            }
+        }
+
+        m_pEntries[hole].Key.Clear();
+        m_pEntries[hole].Value = V();
+        m_nCount--;
+        return true;
+    }
+
+    void Clear() {
+        for (UINT32 nCtr = 0; nCtr < m_nCapacity; nCtr++)
+        {
+            m_pEntries[nCtr].Key.Clear();
+            m_pEntries[nCtr].Value = V();
+        }
+        m_nCount = 0;
+    }
+
+    void Swap(_Inout_ CTickerMap& Map) {
+        std::swap(m_pEntries, Map.m_pEntries);
+        std::swap(m_nCapacity, Map.m_nCapacity);
+        std::swap(m_nCount, Map.m_nCount);
+    }
+};
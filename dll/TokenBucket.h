@@ -0,0 +1,113 @@
+/*++
+
+    Copyright (c) Pai Financials LLC.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+Module Name:
+
+    TokenBucket.h
+
+Abstract:
+
+    Token bucket that limits the rate of the requests sent to a host
+
+Author:
+
+    nabieasaurus
+
+--*/
+#pragma once
+
+#include "Lock.h"
+
+
+/*++
+
+Class Name:
+
+    CTokenBucket
+
+Class Description:
+
+    The bucket fills up at Rate tokens a second up to Burst tokens and
+    every request takes one token. A request that finds the bucket empty
+    reserves the next token and waits for it, so the requests are sent in
+    the order they asked and never faster than the rate, however many
+    threads are sending them.
+
+    A rate of 0 does not limit the requests.
+
+--*/
+class CTokenBucket
+{
+protected:
+    double          m_Rate;                 // Tokens per millisecond
+    double          m_Burst;
+    double          m_Tokens;               // Less than 0 if the tokens are reserved
+    DWORD           m_dwLastFill;
+    CLock           m_Lock;
+
+    // C'tor/D'tor
+public:
+    CTokenBucket(void) : m_Rate(0), m_Burst(0), m_Tokens(0), m_dwLastFill(0) { }
+
+    // Properties
+public:
+    inline bool IsLimited(void) const { return m_Rate > 0; }
+
+    // Operations
+public:
+    //
+    // Sets the requests per second, the bucket holds a second of requests
+    //
+    void SetRate(_In_ UINT32 RequestsPerSec) {
+        CAutoLock al(m_Lock);
+
+        m_Rate = RequestsPerSec / 1000.0;
+        m_Burst = (RequestsPerSec > 1) ? RequestsPerSec : 1;
+        m_Tokens = m_Burst;
+        m_dwLastFill = GetTickCount();
+    }
+
+    //
+    // Takes a token and returns the milliseconds to wait for it
+    //
+    DWORD Reserve(void) {
+        CAutoLock al(m_Lock);
+
+        if (m_Rate <= 0) return 0;
+
+        DWORD dwNow = GetTickCount();
+        m_Tokens += (DWORD)(dwNow - m_dwLastFill) * m_Rate;
+        if (m_Tokens > m_Burst) m_Tokens = m_Burst;
+        m_dwLastFill = dwNow;
+
+        m_Tokens -= 1;
+        return (m_Tokens >= 0) ? 0 : (DWORD)(-m_Tokens / m_Rate + 1);
+    }
+
+    //
+    // Waits till the request can be sent
+    //
+    void Acquire(void) {
+        DWORD dwWait = Reserve();
+        if (dwWait != 0) Sleep(dwWait);
+    }
+};
@@ -56,6 +56,9 @@ Author:
 #include <stdarg.h>
 
 #include <map>
+#include <set>
+#include <vector>
+#include <unordered_map>
 #include <deque>
 #include <string>
 #include <fstream>
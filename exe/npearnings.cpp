@@ -66,6 +66,9 @@ TestStocks()
         "AMD",
     };
 
+    printf("Symbols Prefetched             = %d\n\n",
+        PrefetchEarnings(symList, _countof(symList)));
+
     for (int i = 0; i < _countof(symList); i++)
     {
         printf(
@@ -78,6 +81,52 @@ TestStocks()
             symList[i], GetDaysToEarningsRelease(symList[i]),
             symList[i], GetEarningsConfirmation(symList[i]));
     }
+
+    printf(
+        "Cache Misses                   = %d\n"
+        "Queries Sent                   = %d\n"
+        "Queries Coalesced              = %d\n"
+        "Queries Rate Limited           = %d\n",
+        GetEarningsCounter("CacheMisses"),
+        GetEarningsCounter("Fetches"),
+        GetEarningsCounter("FetchesCoalesced"),
+        GetEarningsCounter("RateLimited"));
+
+    printf("Diagnostics                    = %s\n", GetEarningsDiagnostics());
+}
+
+
+void 
+TestHandles()
+{
+    LPCSTR symList[] = { "MSFT", "aapl", "AMD" };
+
+    for (int i = 0; i < _countof(symList); i++)
+    {
+        INT handle = GetSymbolHandle(symList[i]);
+
+        printf(
+            "%s: Handle                     = %d\n"
+            "%s: Earnings Date              = %s\n"
+            "%s: Earnings Days to Release   = %s\n\n",
+            symList[i], handle,
+            symList[i], GetEarningsReleaseDateByHandle(handle),
+            symList[i], GetDaysToEarningsReleaseByHandle(handle));
+    }
+}
+
+
+void 
+TestRefreshPolicy()
+{
+    //
+    // Replay the cache file for a quarter, 0 is the fixed and 1 the adaptive policy
+    //
+    printf(
+        "Fixed Policy Queries           = %d\n"
+        "Adaptive Policy Queries        = %d\n",
+        SimulateRefreshPolicy(0, 91),
+        SimulateRefreshPolicy(1, 91));
 }
 
 
@@ -85,4 +134,8 @@ int
 main(/*int argc, char *argv[]*/)
 {
     TestStocks();
+    TestHandles();
+    TestRefreshPolicy();
+
+    ShutdownEarnings();
 }